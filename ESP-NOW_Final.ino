@@ -3,106 +3,303 @@
 
 /* ---- Declaration of constants ---- */
 /*
-    In this sheet, we use one constant :
+    In this sheet, we use the following constants :
+    - BOOT_DELAY_MS, the delay after the power is turned on (it can be raised to read the first messages on the serial monitor).
     - NUMBER_ATTEMPT_MAX, the number maximum of MASTER_DETECTION message sent to decide if there is a master or not.
+      In relay mode, a board which hears other boards looking for a master sends one more message each time, up to RELAY_HOPS_MAX times
+      more : it may be far from the master and wait for the buoys between them to join.
+    - DETECTION_WINDOW_MS and DETECTION_JITTER_MS, the time to wait for a MASTER_REPLY after a MASTER_DETECTION message is
+      DETECTION_WINDOW_MS plus a random jitter, so that the boards which boot together do not retry at the same time.
+    - DETECTION_TIMEOUT_MS, the longer window used by a board whose cached master has not answered : a network exists, and its master
+      may be busy, so the board is careful before creating a second one.
+    - ID_REPLY_TIMEOUT_MS, the time to wait for an ID_REPLY after an ID_REQUEST message, for every hop in relay mode.
+    - WARM_START_TIMEOUT_MS, the time given to the master saved in the boot cache to send a message as the master (an ID_REPLY, a
+      HEARTBEAT...), from the start of the warm start or from its last message, before the board goes back to the master detection.
+    - the states of the boot :
+      BOOT_START, the boot cache is read.
+      BOOT_WARM_START, the board sends ID_REQUEST messages to the master saved in the boot cache.
+      BOOT_DISCOVERY, the board sends MASTER_DETECTION messages.
+      BOOT_ID_REQUEST, a master has answered, the board sends ID_REQUEST messages.
+      BOOT_MASTER, no master has answered, the board becomes the master.
+      BOOT_READY, the board has an ID.
 */
+#ifndef BOOT_DELAY_MS
+#define BOOT_DELAY_MS 0
+#endif
 #define NUMBER_ATTEMPT_MAX 5
+#define DETECTION_WINDOW_MS 200
+#define DETECTION_JITTER_MS 100
+#define DETECTION_TIMEOUT_MS 1000
+#define ID_REPLY_TIMEOUT_MS 50
+#define WARM_START_TIMEOUT_MS 2000
+
+#define BOOT_START 0
+#define BOOT_WARM_START 1
+#define BOOT_DISCOVERY 2
+#define BOOT_ID_REQUEST 3
+#define BOOT_MASTER 4
+#define BOOT_READY 5
 
 /* ---- Declaration of variables ---- */
 /*
-    In this sheet, we use one variable :
+    In this sheet, we use the following variables :
+   - bootState, the state of the boot, and stateStart, the time when the board entered it.
    - attempt, an integer used to count the number of attempts to detect if there is a master in the network.
+   - attemptMax, the number of MASTER_DETECTION messages sent before the board becomes the master.
+   - detectionWindow, the time to wait for a MASTER_REPLY, without the jitter.
+   - joinBackoff, the random backoff before every ID_REQUEST message (see backoff.h).
+     Its window widens when a message fails or gets no reply, and shrinks when a reply arrives.
+   - bootCache, the master and the ID saved in the NVS at the last boot (see bootCache.h).
 */
+int bootState = BOOT_START;
+unsigned long stateStart;
 int attempt = 0;
+int attemptMax = NUMBER_ATTEMPT_MAX;
+unsigned long detectionWindow = DETECTION_WINDOW_MS;
+structBackoff joinBackoff;
+structBootCache bootCache;
+
+/* ---- Procedure for changing the state of the boot ---- */
+void enterState(int state) {
+  TRACE(TRACE_BOOT_STATE, state, 0, 0);
+  bootState = state;
+  stateStart = millis();
+  attempt = 0;
+}
+
+/* ---- Procedure for sending a MASTER_DETECTION message and waiting for the MASTER_REPLY ---- */
+/*
+   OUTPUT : the next state of the boot (int).
+*/
+int stepDiscovery() {
+  /*if the board has sent all its MASTER_DETECTION messages without reply, it becomes the master.*/
+  if (attempt == attemptMax)
+    return BOOT_MASTER;
+  /*...else it prints the number of attempt and sends a MASTER_DETECTION message.*/
+  Serial.println("MASTER_DETECTION, attempt : " + String(attempt + 1));
+  /*
+    senderID = -1
+    receiverID = 0
+    typeMessage = MASTER_DETECTION
+    payload = the MAC address of the board
+  */
+  /*the message is prepared in a frame of the pool, during the boot it is the only frame taken so the pool is never empty.*/
+  structFrame *request = allocFrame(&framePool);
+  request->len = prepareMessage(&request->msg, MASTER_DETECTION, myID, 0);
+  request->len = putMacAddress(&request->msg, request->len, myRawMacAddress);
+  /*the message is sent to the broadcast address.*/
+  sendFailed = false;
+  sendMessage(receiverAddress, &request->msg, request->len);
+  releaseFrame(&framePool, request);
+  attempt++;
+  /*the program waits for a MASTER_REPLY, which is handled during the wait, and stops as soon as it has arrived.*/
+  relayDetectionHeard = false;
+  waitReply(detectionWindow + random(0, DETECTION_JITTER_MS), isMasterFound);
+  if (RELAY_MODE && relayDetectionHeard && (attemptMax < NUMBER_ATTEMPT_MAX * RELAY_HOPS_MAX))
+    attemptMax++;
+  if (!master)
+    return BOOT_DISCOVERY;
+
+  /*a master has answered, the buoy becomes a slave and its ESP status becomes -1.*/
+  ESPstatus = -1;
+  Serial.println(F("master detected on the network, ID request in progress"));
+  Serial.println();
+  Serial.println(F("permanent modification of receiverAddress"));
+  /*printing the old address of communication.*/
+  Serial.println(F("old receiverAddress : FF:FF:FF:FF:FF:FF"));
+  /*printing the new address of communication.*/
+  Serial.println("new receiverAddress : " + macAddressToString(receiverAddress));
+  Serial.println();
+  return BOOT_ID_REQUEST;
+}
+
+/* ---- Procedure for sending an ID_REQUEST message and waiting for the ID_REPLY ---- */
+/*
+   OUTPUT : the next state of the boot (int).
+*/
+int stepIDRequest() {
+  /*a random backoff is established before the sending to avoid collision between the different ID_REQUEST message sent in the same time.*/
+  /*the procedure of ID assignment takes on average 8,35 ms so the backoff is a multiple of 9 ms (see backoff.h).*/
+  backoffWait(&joinBackoff, isIDAssigned);
+  if (myID != -1)
+    return BOOT_READY;
+  /*
+    senderID = -1
+    receiverID = 0
+    typeMessage = ID_REQUEST
+    payload = the MAC address of the board
+  */
+  /*the message is sent to the master MAC address, with a new sequence number at each attempt.*/
+  structFrame *request = allocFrame(&framePool);
+  request->len = prepareMessage(&request->msg, ID_REQUEST, myID, 0);
+  request->len = putMacAddress(&request->msg, request->len, myRawMacAddress);
+  sendFailed = false;
+  esp_err_t result = sendMessage(receiverAddress, &request->msg, request->len);
+  releaseFrame(&framePool, request);
+  /*the program waits for the ID_REPLY. If the request was not acknowledged or got no reply, the backoff widens.*/
+  unsigned long timeout = (RELAY_MODE && (relayHops > 1)) ? ID_REPLY_TIMEOUT_MS * relayHops : ID_REPLY_TIMEOUT_MS;
+  if ((result == ESP_OK) && (waitReply(timeout, isIDAssigned) == REPLY_RECEIVED)) {
+    backoffSuccess(&joinBackoff);
+    return BOOT_READY;
+  }
+  backoffFailure(&joinBackoff);
+  metricsCount(METRIC_JOIN_RETRIES);
+  return bootState;
+}
+
+/* ---- Procedure for starting from the boot cache ---- */
+/*
+   OUTPUT : the first state of the boot (int).
+   DESCRITPION : Without boot cache, the board detects the master. If the board was a slave, it asks its ID directly to the master saved
+   in the cache, which skips the master detection. If it was the master, it sends only one MASTER_DETECTION message before taking back its role.
+*/
+int startFromCache() {
+  if (!loadBootCache(&bootCache))
+    return BOOT_DISCOVERY;
+  if (memcmp(bootCache.masterMacAddress, myRawMacAddress, 6) == 0) {
+    Serial.println(F("boot cache : this board was the master"));
+    attemptMax = 1;
+    return BOOT_DISCOVERY;
+  }
+  Serial.println("boot cache : master " + macAddressToString(bootCache.masterMacAddress) + ", ID " + String(bootCache.buoyID));
+  /*the board sends its ID_REQUEST messages to the cached master, as if it had answered a MASTER_DETECTION message.*/
+  memcpy(receiverAddress, bootCache.masterMacAddress, 6);
+  memcpy(peerInfo.peer_addr, receiverAddress, 6);
+  if ((esp_now_add_peer(&peerInfo) != ESP_OK) && !esp_now_is_peer_exist(receiverAddress)) {
+    Serial.println(F("Failed to add peer"));
+    memset(receiverAddress, 0xFF, 6);
+    return BOOT_DISCOVERY;
+  }
+  master = true;
+  ESPstatus = -1;
+  return BOOT_WARM_START;
+}
+
+/* ---- Procedure for giving up the warm start ---- */
+/*
+   OUTPUT : the next state of the boot (int).
+   DESCRITPION : The cached master has not answered in time, the board goes back to the broadcast address and detects the master.
+*/
+int stopWarmStart() {
+  Serial.println(F("the cached master does not answer, master detection in progress"));
+  master = false;
+  ESPstatus = 0;
+  memset(receiverAddress, 0xFF, 6);
+  detectionWindow = DETECTION_TIMEOUT_MS;
+  backoffReset(&joinBackoff);
+  return BOOT_DISCOVERY;
+}
+
+/* ---- Procedure for becoming the master ---- */
+/*
+   OUTPUT : the next state of the boot (int).
+   DESCRITPION : The master reloads the buoy registry saved in the flash (see registryLog.h), so that the known buoys keep their ID.
+   If there is no registry saved, or if it belongs to another master, a new one is created with the board as the buoy 0.
+*/
+int becomeMaster() {
+  /*the network doesn't have a master so the buoy becomes one.*/
+  /*its ESP status changes to 1 and it ID to 0*/
+  ESPstatus = 1;
+  myID = 0;
+  /*in relay mode, the messages to the buoys which do not hear the master follow their path in the registry (see relay.h).*/
+  relayStartMaster(&buoyList);
+  Serial.println(F("no master detected on the network"));
+  Serial.println();
+  if (loadRegistryLog(&buoyList) && (isBuoyExists(&buoyList, macAddressToKey(myRawMacAddress)) == 0)) {
+    /*only the number of buoys is printed, printing the whole list would delay the first ID_REPLY.*/
+    Serial.println("IDlist restored : " + String(nbBuoys(&buoyList)) + " buoys");
+    return BOOT_READY;
+  }
+  /*the program initialises the buoy registry by adding the board as the first buoy (ID 0).*/
+  Serial.println(F("creation of the IDlist."));
+  initRegistry(&buoyList);
+  addNewBuoy(&buoyList, macAddressToKey(myRawMacAddress));
+  compactRegistryLog(&buoyList);
+  /*and printing the list initialised.*/
+  Serial.println(F("IDlist created :"));
+  printBuoyList(&buoyList);
+  return BOOT_READY;
+}
 
 void setup() {
   /*calling the InitBoard() function.*/
   initBoard();
-  /*when the power is turned on, a delay is required.*/
-  delay(1500);
+  delayAndDispatch(BOOT_DELAY_MS);
 
   /*printing informations about the buoy after the initialisation.*/
   Serial.println();
   printBoardInfo();
 
-  /* ---- STEP 1 : MASTER DETECTION ---- */
-
-  /*as long as the board doesn't send 5 times a MASTER_DETECTION message and the boolean master is false then...*/
-  while (!master && (attempt != NUMBER_ATTEMPT_MAX)) {
-    /*...then it prints the number of attempt and sends a MASTER_DETECTION message.*/
-    Serial.println("MASTER_DETECTION, attempt : " + String(attempt + 1));
-    /*
-      senderID = -1
-      receiverID = 0
-      typeMessage = MASTER_DETECTION
-      message = the MAC address of the board
-    */
-    myData.senderID = myID;
-    myData.receiverID = 0;
-    strcpy(myData.typeMessage, "MASTER_DETECTION");
-    myMacAddress.toCharArray(myData.message, CHAR_LENGTH);
-    Serial.println(F("Sending message..."));
-    Serial.println();
-    /*the message is sent to the broadcast address.*/
-    esp_err_t result = esp_now_send(receiverAddress, (uint8_t *) &myData, sizeof(myData));
-    attempt++;
-    /*the program waits 1 second between each MASTER_DETECTION message.*/
-    delay(1000);
-  }
-
-  /* ---- STEP 2 : ID ASSIGNMENT ---- */
-
-  /*if the boolean master is true then...*/
-  if (master) {
-    /*...then the buoy becomes a slave and its ESP status becomes -1.*/
-    ESPstatus = -1;
-    Serial.println(F("master detected on the network, ID request in progress"));
-    Serial.println();
-    /*rndm is used to define the random delay in order to avoid collision during the ID requesto of the slave*/
-    long rndm;
-    Serial.println(F("permanent modification of receiverAddress"));
-    /*printing the old address of communication.*/
-    Serial.println(F("old receiverAddress : FF:FF:FF:FF:FF:FF"));
-    /*printing the new address of communication.*/
-    Serial.println("new receiverAddress : " + macAddressToString(receiverAddress));
-    Serial.println();
-    /*sending a ID_REQUEST message.*/
-    /*
-      senderID = -1
-      receiverID = 0
-      typeMessage = ID_REQUEST
-      message = the MAC address of the board
-    */
-    strcpy(myData.typeMessage, "ID_REQUEST");
-    myMacAddress.toCharArray(myData.message, CHAR_LENGTH);
-    /*as long as the slave as an undefined ID (equal to -1) then...*/
-    while (myID == -1) {
-      /*...a random delay is established before the sending to avoid collision between the different ID_REQUEST message sent in the same time.*/
-      rndm = random(0, 5);
-      /*the procedure of ID assignment takes on average 8,35 ms so the delay is established as a multiple of 9 ms between 0 and 45 ms.*/
-      delay(9 * rndm);
-      /*the message is sent to the master MAC address.*/
-      esp_err_t result = esp_now_send(receiverAddress, (uint8_t *) &myData, sizeof(myData));
-      Serial.println(F("ID_REQUEST, message sent!"));
-      Serial.println();
-      delay(50);
+  /* ---- STATE MACHINE OF THE BOOT ---- */
+  /*
+    Every step sends one message and waits for the event which decides the next state : the reply, the failure of the sending
+    or the end of the timeout. No step waits longer than needed.
+  */
+  backoffReset(&joinBackoff);
+  unsigned long joinStart = millis();
+  enterState(BOOT_START);
+  while (bootState != BOOT_READY) {
+    int next = bootState;
+    switch (bootState) {
+      case BOOT_START:
+        next = startFromCache();
+        break;
+      /* STEP 1 : MASTER DETECTION */
+      case BOOT_DISCOVERY:
+        next = stepDiscovery();
+        break;
+      /* STEP 2 : ID ASSIGNMENT */
+      case BOOT_WARM_START:
+        next = stepIDRequest();
+        /*the cached master heard as the master (ID 0) may be late with the ID_REPLY because of the other buoys, the board waits for it.
+          A MAC acknowledgement is not enough : the cached master may be alive but no longer the master (after a failover), and then it
+          ignores the requests.*/
+        if ((long)(masterHeardAt - stateStart) > 0)
+          stateStart = masterHeardAt;
+        if ((next == BOOT_WARM_START) && (millis() - stateStart >= WARM_START_TIMEOUT_MS))
+          next = stopWarmStart();
+        break;
+      case BOOT_ID_REQUEST:
+        next = stepIDRequest();
+        break;
+      case BOOT_MASTER:
+        next = becomeMaster();
+        break;
     }
-  } else {
-    /*...else the network doesn't have a master so the buoy becomes one.*/
-    /*its ESP status changes to 1 and it ID to 0*/
-    ESPstatus = 1;
-    myID = 0;
-    /*the program initialises the buoy list by adding the board as the first buoy in the list.*/
-    Serial.println(F("no master detected on the network, creation of the IDlist."));
-    Serial.println();
-    /*and printing the list initialised.*/
-    buoyList = addNewBuoy(buoyList, myMacAddress);
-    Serial.println(F("IDlist created :"));
-    printBuoyList(buoyList);
+    if (next != bootState)
+      enterState(next);
   }
-  /*printing the new informations about the buoy.*/
+  /*the time taken to get the ID is kept in the metrics (see metrics.h).*/
+  metricsObserve(METRIC_JOIN_MS, millis() - joinStart);
+  /*the master and the ID are saved for the next boot.*/
+  saveBootCache(&bootCache, (ESPstatus == 1) ? myRawMacAddress : receiverAddress, myID);
+  /*printing the new informations about the buoy and its memory.*/
   printBoardInfo();
+  printMemoryReport();
+  /*the telemetry starts once the buoy has its ID (see telemetry.h).*/
+  initTelemetry();
+  /*the master sends its HEARTBEAT, the slaves watch it and elect a new master if it dies (see failover.h).*/
+  startFailover((ESPstatus == 1) ? myRawMacAddress : receiverAddress, macAddressToKey(myRawMacAddress));
 }
 
 void loop() {
+  /*the received messages are handled by the main task.*/
+  dispatchMessages();
+  /*the master sends its HEARTBEAT, a slave checks that its master is alive. After a failover, the new master and the ID are saved.*/
+  if (serviceFailover())
+    saveBootCache(&bootCache, (ESPstatus == 1) ? myRawMacAddress : receiverAddress, myID);
+  /*the master sends the pending ID_REPLY batch at the end of its window.*/
+  serviceIdBatch();
+  /*the master sends the BEACON of the time slots at the beginning of every superframe.*/
+  if (ESPstatus == 1)
+    serviceBeacon();
+  /*a slave samples and sends its telemetry, the master writes the samples received on the serial monitor.*/
+  if ((ESPstatus == -1) && (myID != -1))
+    serviceTelemetry(myID, receiverAddress);
+  else if (ESPstatus == 1)
+    exportTelemetry(&buoyList);
+  /*the host connected to the serial monitor pulls the metrics of the board or of another buoy (see metrics.h).*/
+  serviceMetrics();
+  /*the events of the trace are written on the serial monitor as long as the UART has room for them.*/
+  traceFlush();
 }
@@ -0,0 +1,81 @@
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+/* ---- Declaration of librairies ---- */
+#include <stdint.h>
+
+/* ---- Declaration of constants ---- */
+/*
+    The retries of MASTER_DETECTION and ID_REQUEST wait a random backoff, chosen at compile time with BACKOFF_STRATEGY (by default BACKOFF_CONTENTION_WINDOW) :
+    - BACKOFF_FIXED, the first version : a random multiple of 9 ms between 0 and 36 ms, whatever happens.
+    - BACKOFF_BINARY_EXPONENTIAL, the window is doubled at every failure and set back to its minimum at the first success.
+    - BACKOFF_CONTENTION_WINDOW, as the CSMA/CA of the WiFi : the window is doubled at every failure but only decreased by one slot
+      at every success, so that a buoy remembers that the channel is crowded. The countdown is frozen while the channel is busy (see backoffWait()).
+    The backoff is a random number of slots in [0, window[ :
+    - BACKOFF_SLOT_MS, the duration of a slot, about the time the master needs to handle a request.
+    - BACKOFF_WINDOW_MIN and BACKOFF_WINDOW_MAX, the bounds of the window in slots.
+*/
+#define BACKOFF_FIXED 0
+#define BACKOFF_BINARY_EXPONENTIAL 1
+#define BACKOFF_CONTENTION_WINDOW 2
+
+#ifndef BACKOFF_STRATEGY
+#define BACKOFF_STRATEGY BACKOFF_CONTENTION_WINDOW
+#endif
+#ifndef BACKOFF_SLOT_MS
+#define BACKOFF_SLOT_MS 9
+#endif
+#ifndef BACKOFF_WINDOW_MIN
+#define BACKOFF_WINDOW_MIN 5
+#endif
+#ifndef BACKOFF_WINDOW_MAX
+#define BACKOFF_WINDOW_MAX 1024
+#endif
+
+/* ---- Definition of the backoff structure ---- */
+/*
+   - window, the current window in slots.
+   - failures, the number of failures since the last success.
+*/
+typedef struct structBackoff {
+  uint16_t window;
+  uint16_t failures;
+} structBackoff;
+
+/* ---- Procedure for initialising a backoff ---- */
+void backoffReset(structBackoff *backoff) {
+  backoff->window = BACKOFF_WINDOW_MIN;
+  backoff->failures = 0;
+}
+
+/* ---- Procedure for drawing the next backoff ---- */
+/*
+   INPUT : the backoff (structBackoff).
+   OUTPUT : the time to wait before the next attempt in milliseconds (unsigned long).
+*/
+unsigned long backoffDelay(const structBackoff *backoff) {
+  return BACKOFF_SLOT_MS * random(0, backoff->window);
+}
+
+/* ---- Procedure for widening the window after a failure ---- */
+/*
+   INPUT : the backoff (structBackoff).
+   OUTPUT : nothing (void).
+   DESCRITPION : A failure is a message which could not be sent, or a message sent without reply. Except for BACKOFF_FIXED the window is doubled.
+*/
+void backoffFailure(structBackoff *backoff) {
+  backoff->failures++;
+  if (BACKOFF_STRATEGY != BACKOFF_FIXED)
+    backoff->window = (2 * backoff->window < BACKOFF_WINDOW_MAX) ? 2 * backoff->window : BACKOFF_WINDOW_MAX;
+}
+
+/* ---- Procedure for shrinking the window after a success ---- */
+void backoffSuccess(structBackoff *backoff) {
+  backoff->failures = 0;
+  if (BACKOFF_STRATEGY == BACKOFF_BINARY_EXPONENTIAL)
+    backoff->window = BACKOFF_WINDOW_MIN;
+  else if ((BACKOFF_STRATEGY == BACKOFF_CONTENTION_WINDOW) && (backoff->window > BACKOFF_WINDOW_MIN))
+    backoff->window--;
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef BOOT_CACHE_H
+#define BOOT_CACHE_H
+
+/* ---- Declaration of librairies ---- */
+#include <Preferences.h>
+#include <stdint.h>
+#include <string.h>
+
+/* ---- Declaration of constants ---- */
+/*
+    The boot cache is stored in the NVS of the board (Preferences library), so that it survives a reboot or a brownout :
+    - BOOT_CACHE_NAMESPACE, the NVS namespace of the sketch.
+    - the keys, the MAC address of the master ("master") and the ID the board received from it ("id").
+*/
+#define BOOT_CACHE_NAMESPACE "espnow"
+#define BOOT_CACHE_KEY_MASTER "master"
+#define BOOT_CACHE_KEY_ID "id"
+
+/* ---- Definition of the boot cache ---- */
+/*
+   - masterMacAddress, the MAC address of the master of the last network joined (the board itself if it was the master).
+   - buoyID, the ID of the board in this network.
+*/
+typedef struct structBootCache {
+  uint8_t masterMacAddress[6];
+  int buoyID;
+} structBootCache;
+
+/* ---- Procedure for reading the boot cache ---- */
+/*
+   INPUT : the cache to fill (structBootCache).
+   OUTPUT : true if the NVS holds a cache, false after the first boot of the board (bool).
+*/
+bool loadBootCache(structBootCache *cache) {
+  memset(cache->masterMacAddress, 0, 6);
+  cache->buoyID = -1;
+  Preferences preferences;
+  if (!preferences.begin(BOOT_CACHE_NAMESPACE, true))
+    return false;
+  bool found = (preferences.getBytes(BOOT_CACHE_KEY_MASTER, cache->masterMacAddress, 6) == 6);
+  cache->buoyID = preferences.getShort(BOOT_CACHE_KEY_ID, -1);
+  preferences.end();
+  return found && (cache->buoyID != -1);
+}
+
+/* ---- Procedure for writing the boot cache ---- */
+/*
+   INPUT : the cache read at the boot (structBootCache), the MAC address of the master (table of uint8_t) and the ID of the board (int).
+   OUTPUT : nothing (void).
+   DESCRITPION : The NVS is only written if the master or the ID has changed, to spare the flash.
+*/
+void saveBootCache(structBootCache *cache, const uint8_t masterMacAddress[], int buoyID) {
+  if ((memcmp(cache->masterMacAddress, masterMacAddress, 6) == 0) && (cache->buoyID == buoyID))
+    return;
+  memcpy(cache->masterMacAddress, masterMacAddress, 6);
+  cache->buoyID = buoyID;
+  Preferences preferences;
+  if (!preferences.begin(BOOT_CACHE_NAMESPACE, false))
+    return;
+  preferences.putBytes(BOOT_CACHE_KEY_MASTER, cache->masterMacAddress, 6);
+  preferences.putShort(BOOT_CACHE_KEY_ID, cache->buoyID);
+  preferences.end();
+}
+
+#endif
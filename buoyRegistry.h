@@ -0,0 +1,222 @@
+#ifndef BUOY_REGISTRY_H
+#define BUOY_REGISTRY_H
+
+/* ---- Declaration of librairies ---- */
+#include <stdint.h>
+#include <string.h>
+
+/* ---- Declaration of constants ---- */
+/*
+    The registry of the buoys uses four constants :
+    - BUOY_MAX, the maximum number of buoys (the master included) known by the master.
+    - REGISTRY_BITS, the hash table has 2 pow REGISTRY_BITS slots. It must have at least twice more slots than BUOY_MAX so that it is never more than half full.
+    - REGISTRY_EMPTY, the value of a free slot of the hash table.
+    - REGISTRY_NO_BUOY, the key of an ID which has no buoy yet (a hole, see claimBuoy()). It is the key of the broadcast address,
+      which is never the MAC address of a buoy.
+*/
+#ifndef BUOY_MAX
+#define BUOY_MAX 1024
+#endif
+#ifndef REGISTRY_BITS
+#define REGISTRY_BITS 11
+#endif
+#define REGISTRY_SLOTS (1 << REGISTRY_BITS)
+#define REGISTRY_EMPTY 0xFFFF
+#define REGISTRY_NO_BUOY 0xFFFFFFFFFFFFULL
+
+static_assert(REGISTRY_SLOTS >= 2 * BUOY_MAX, "the registry hash table must have at least 2 * BUOY_MAX slots");
+static_assert(BUOY_MAX < REGISTRY_EMPTY, "a buoy ID must fit in a slot of the hash table");
+
+/* ---- Definition of the buoy registry ---- */
+/*
+   The master records the MAC address of every buoy in a registry. The ID of a buoy is its place in the registry :
+   the master is the buoy 0 and the others are numbered in the order of their first ID_REQUEST.
+   After a failover, the new master gives back to every slave the ID it claims (see failover.h) : the IDs not claimed yet are holes.
+   The registry is composed of five fields :
+   - slots, an open-addressing hash table (linear probing) which gives the ID of a buoy from its MAC address. A slot contains an ID or REGISTRY_EMPTY.
+   - macAddresses, the MAC address of every buoy, indexed by its ID (reverse lookup).
+   - count, the number of buoys in the registry.
+   - parents and hops, the path to every buoy, indexed by its ID : the buoy which relays its messages to the master (0 if the buoy
+     reaches the master directly) and its number of hops (see relay.h). They are learnt from the messages received and not saved in the flash.
+   A MAC address is stored as a key : its six bytes packed in an uint64_t (see macAddressToKey).
+   The lookup and the insertion cost one hash and a few probes, without any allocation.
+*/
+typedef struct structBuoyRegistry {
+  uint16_t slots[REGISTRY_SLOTS];
+  uint64_t macAddresses[BUOY_MAX];
+  int16_t parents[BUOY_MAX];
+  uint8_t hops[BUOY_MAX];
+  int count;
+} structBuoyRegistry;
+
+/* ---- Procedure for converting a MAC address into a registry key ---- */
+/*
+   INPUT : the MAC address (table of uint8_t).
+   OUTPUT : the key of the MAC address (uint64_t).
+   DESCRITPION : The six bytes of the MAC address are packed in the 48 lower bits of the key, the first byte being the most significant one.
+*/
+uint64_t macAddressToKey(const uint8_t addressMac[]) {
+  uint64_t key = 0;
+  for (int i = 0; i < 6; i++)
+    key = (key << 8) | addressMac[i];
+  return key;
+}
+
+/* ---- Procedure for converting a registry key into a MAC address ---- */
+/*
+   INPUT : the MAC address to fill (table of uint8_t), the key (uint64_t).
+   OUTPUT : nothing (void).
+   DESCRITPION : Reverse of macAddressToKey.
+*/
+void keyToMacAddress(uint8_t addressMac[], uint64_t key) {
+  for (int i = 5; i >= 0; i--) {
+    addressMac[i] = key & 0xFF;
+    key >>= 8;
+  }
+}
+
+/* ---- Procedure for hashing a key ---- */
+/*
+   INPUT : the key (uint64_t).
+   OUTPUT : the first slot to probe (uint32_t).
+   DESCRITPION : Fibonacci hashing, the key is multiplied by 2 pow 64 divided by the golden ratio and the REGISTRY_BITS upper bits are kept.
+   The MAC addresses of a fleet often only differ by their last bytes, the multiplication spreads them over the whole table.
+*/
+uint32_t registryHash(uint64_t key) {
+  return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - REGISTRY_BITS));
+}
+
+/* ---- Procedure for initialising the registry ---- */
+/*
+   INPUT : the registry (structBuoyRegistry).
+   OUTPUT : nothing (void).
+   DESCRITPION : All the slots are marked as free and the registry is empty.
+*/
+void initRegistry(structBuoyRegistry *registry) {
+  memset(registry->slots, 0xFF, sizeof(registry->slots));
+  registry->count = 0;
+}
+
+/* ---- Procedure for counting the number of buoys in the registry ---- */
+int nbBuoys(const structBuoyRegistry *registry) {
+  return registry->count;
+}
+
+/* ---- Procedure for checking if a buoy is in the registry ---- */
+/*
+   INPUT : the registry (structBuoyRegistry), the key of the MAC address of the buoy sought (uint64_t).
+   OUTPUT : the ID of the buoy (int), -1 if the buoy is unknown.
+   DESCRITPION : The program probes the slots from the hash of the key until it finds the buoy or a free slot.
+   As the table is never more than half full, a free slot is always found quickly.
+*/
+int isBuoyExists(const structBuoyRegistry *registry, uint64_t key) {
+  uint32_t slot = registryHash(key);
+  while (registry->slots[slot] != REGISTRY_EMPTY) {
+    /*if the buoy of this slot has the MAC address sought...*/
+    if (registry->macAddresses[registry->slots[slot]] == key)
+      /*...then it returns its ID.*/
+      return registry->slots[slot];
+    /*...else it probes the next slot.*/
+    slot = (slot + 1) & (REGISTRY_SLOTS - 1);
+  }
+  return -1;
+}
+
+/* ---- Procedure for placing a buoy in the registry ---- */
+/*
+   INPUT : the registry (structBuoyRegistry), the free slot of the hash table (uint32_t), the ID (int) and the key of the MAC address of the buoy (uint64_t).
+   OUTPUT : nothing (void).
+   DESCRITPION : A hole is not written in the hash table, its key is never looked for.
+*/
+void placeBuoy(structBuoyRegistry *registry, uint32_t slot, int buoyID, uint64_t key) {
+  registry->macAddresses[buoyID] = key;
+  registry->parents[buoyID] = 0;
+  registry->hops[buoyID] = 1;
+  if (key != REGISTRY_NO_BUOY)
+    registry->slots[slot] = buoyID;
+}
+
+/* ---- Procedure for adding a buoy in the registry ---- */
+/*
+   INPUT : the registry (structBuoyRegistry), the key of the MAC address of the buoy (uint64_t).
+   OUTPUT : the ID of the buoy (int), -1 if the registry is full.
+   DESCRITPION : If the buoy is already known, the program returns its ID. Else the new buoy takes the next ID (the number of buoys in the registry)
+   and the first free slot found from the hash of its key. REGISTRY_NO_BUOY adds a hole.
+*/
+int addNewBuoy(structBuoyRegistry *registry, uint64_t key) {
+  uint32_t slot = registryHash(key);
+  while (registry->slots[slot] != REGISTRY_EMPTY) {
+    if (registry->macAddresses[registry->slots[slot]] == key)
+      return registry->slots[slot];
+    slot = (slot + 1) & (REGISTRY_SLOTS - 1);
+  }
+  /*if the registry is full, the buoy can't be added.*/
+  if (registry->count == BUOY_MAX)
+    return -1;
+  placeBuoy(registry, slot, registry->count, key);
+  return registry->count++;
+}
+
+/* ---- Procedure for adding a buoy with the ID it claims ---- */
+/*
+   INPUT : the registry (structBuoyRegistry), the key of the MAC address of the buoy (uint64_t), the ID claimed (int).
+   OUTPUT : the ID of the buoy (int), -1 if the ID claimed belongs to another buoy or is not valid.
+   DESCRITPION : A new master rebuilds the registry from the IDs of the slaves (see failover.h). If the buoy is already known, it keeps its ID.
+   Else it takes the ID claimed : if this ID is after the last one, the IDs between them become holes, which only their buoy can claim
+   (addNewBuoy() gives the IDs after the last one). A buoy which claims a hole fills it.
+*/
+int claimBuoy(structBuoyRegistry *registry, uint64_t key, int buoyID) {
+  int known = isBuoyExists(registry, key);
+  if (known != -1)
+    return known;
+  if ((buoyID <= 0) || (buoyID >= BUOY_MAX) || (key == REGISTRY_NO_BUOY)
+      || ((buoyID < registry->count) && (registry->macAddresses[buoyID] != REGISTRY_NO_BUOY)))
+    return -1;
+  while (registry->count < buoyID)
+    addNewBuoy(registry, REGISTRY_NO_BUOY);
+  if (buoyID == registry->count)
+    return addNewBuoy(registry, key);
+  uint32_t slot = registryHash(key);
+  while (registry->slots[slot] != REGISTRY_EMPTY)
+    slot = (slot + 1) & (REGISTRY_SLOTS - 1);
+  placeBuoy(registry, slot, buoyID, key);
+  return buoyID;
+}
+
+/* ---- Procedure for recording the path to a buoy ---- */
+/*
+   INPUT : the registry (structBuoyRegistry), the ID of the buoy (int), the ID of the buoy which relayed its message (int, 0 if none)
+   and the number of hops of the message (int).
+   OUTPUT : nothing (void).
+*/
+void setBuoyPath(structBuoyRegistry *registry, int buoyID, int parent, int hops) {
+  if ((buoyID <= 0) || (buoyID >= registry->count) || (parent < 0) || (parent >= registry->count) || (parent == buoyID))
+    return;
+  registry->parents[buoyID] = parent;
+  registry->hops[buoyID] = hops;
+}
+
+/* ---- Procedure for reading the path to a buoy ---- */
+/*
+   INPUT : the registry (structBuoyRegistry), the ID of the buoy (int), the relays to fill (table of int16_t) and its size (int).
+   OUTPUT : the number of relays between the master and the buoy, -1 if the path is longer than the table (a loop) (int).
+   DESCRITPION : The parents are followed from the buoy up to the master, the relays are written from the master down to the buoy.
+*/
+int getBuoyRoute(const structBuoyRegistry *registry, int buoyID, int16_t route[], int routeMax) {
+  int count = 0;
+  if ((buoyID <= 0) || (buoyID >= registry->count))
+    return 0;
+  for (int id = registry->parents[buoyID]; id > 0; id = registry->parents[id]) {
+    if (count == routeMax)
+      return -1;
+    route[count++] = id;
+  }
+  for (int i = 0; i < count / 2; i++) {
+    int16_t id = route[i];
+    route[i] = route[count - 1 - i];
+    route[count - 1 - i] = id;
+  }
+  return count;
+}
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef FAILOVER_H
+#define FAILOVER_H
+
+/* ---- Declaration of librairies ---- */
+#include <Arduino.h>
+#include <stdint.h>
+#include <string.h>
+#include "buoyRegistry.h"
+#include "relay.h"
+#include "backoff.h"
+#include "tdma.h"
+#include "trace.h"
+#include "moduleStats.h"
+
+/* ---- Declaration of constants ---- */
+/*
+    The failover of the master uses the following constants :
+    - FAILOVER_HEARTBEAT_MS, the period of the HEARTBEAT of the master. With 0, there is no HEARTBEAT nor failover : a slave whose master
+      is dead waits for a reboot. In relay mode the HEARTBEAT is not relayed, so the failover is off by default.
+      With the time slots, the HEARTBEAT is sent in a slot of the master (see tdma.h) : it is due TDMA_MASTER_PERIOD_MS early, so that
+      the next slot of the master comes before FAILOVER_HEARTBEAT_MS.
+    - FAILOVER_TIMEOUT_MS, the time without message of the master after which a slave starts an election (a few lost HEARTBEAT are not enough).
+    - ELECTION_WINDOW_MS, the duration of an election, and ELECTION_JITTER_MS, the random delay before a candidate sends its ELECTION,
+      so that the candidates do not all send at the same time.
+    - CLAIM_SLOT_MS, the first claim of a slave is sent CLAIM_SLOT_MS times its ID after the first HEARTBEAT of the new master : every
+      slave hears this HEARTBEAT at the same time, so the claims of the fleet follow each other without collision. CLAIM_TIMEOUT_MS, the time to wait for the reply of a claim before the next one (plus a random backoff, see backoff.h).
+    - the states of the failover :
+      FAILOVER_OFF, the board has no role yet, or the failover is off.
+      FAILOVER_LEAD, the board is the master and sends the HEARTBEAT.
+      FAILOVER_FOLLOW, the board is a slave of a live master.
+      FAILOVER_ELECTION, the master is silent, the board takes part in an election.
+      FAILOVER_WAIT, the board has lost the election, it waits for the HEARTBEAT of the winner.
+      FAILOVER_CLAIM, the board has heard a new master and claims its ID from it.
+*/
+#ifndef FAILOVER_HEARTBEAT_MS
+#if RELAY_MODE
+#define FAILOVER_HEARTBEAT_MS 0
+#else
+#define FAILOVER_HEARTBEAT_MS 100
+#endif
+#endif
+#ifndef FAILOVER_TIMEOUT_MS
+#define FAILOVER_TIMEOUT_MS 350
+#endif
+#ifndef ELECTION_WINDOW_MS
+#define ELECTION_WINDOW_MS 60
+#endif
+#define ELECTION_JITTER_MS 20
+#ifndef CLAIM_SLOT_MS
+#define CLAIM_SLOT_MS 2
+#endif
+#define CLAIM_TIMEOUT_MS 50
+
+#define FAILOVER_OFF 0
+#define FAILOVER_LEAD 1
+#define FAILOVER_FOLLOW 2
+#define FAILOVER_ELECTION 3
+#define FAILOVER_WAIT 4
+#define FAILOVER_CLAIM 5
+
+/* the actions asked by the failover to the board (see serviceFailover() and handleFailover() in utilities.h) */
+#define FAILOVER_NONE 0
+#define FAILOVER_SEND_HEARTBEAT 1
+#define FAILOVER_SEND_ELECTION 2
+#define FAILOVER_TAKE_OVER 3
+#define FAILOVER_FOLLOW_NEW 4
+#define FAILOVER_SEND_CLAIM 5
+
+static_assert((FAILOVER_HEARTBEAT_MS == 0) || (FAILOVER_TIMEOUT_MS >= 3 * FAILOVER_HEARTBEAT_MS), "a slave must miss several HEARTBEAT before an election");
+static_assert(ELECTION_JITTER_MS < ELECTION_WINDOW_MS, "the ELECTION of a candidate must be sent during the election");
+static_assert((RELAY_MODE == 0) || (FAILOVER_HEARTBEAT_MS == 0), "the HEARTBEAT and the ELECTION are not relayed");
+static_assert((FAILOVER_HEARTBEAT_MS == 0) || (TDMA_SLOT_MS == 0) || (TDMA_MASTER_PERIOD_MS < FAILOVER_HEARTBEAT_MS),
+              "a slot of the master must come between two HEARTBEAT");
+
+/* ---- Definition of the failover ---- */
+/*
+   The master broadcasts a HEARTBEAT every FAILOVER_HEARTBEAT_MS. Every message of the master proves that it is alive (the BEACON, the
+   ID_REPLY_BATCH...). A slave which has heard nothing from its master for FAILOVER_TIMEOUT_MS starts an election :
+   - the candidates are the slaves, the winner is the one whose MAC address is the lowest (its key, see macAddressToKey()), so that
+     every board elects the same winner whatever the order of the messages. A board keeps the best candidate heard (electionBest).
+   - after a random jitter, a board sends an ELECTION with its MAC address, unless it has already heard a better candidate : only a few
+     ELECTION are sent, whatever the size of the fleet. A board which hears an ELECTION takes part in the election too.
+   - at the end of ELECTION_WINDOW_MS, the board which is still the best candidate becomes the master. It keeps its former ID aside.
+     The others wait for its HEARTBEAT, and start a new election if it does not come within FAILOVER_TIMEOUT_MS (the winner is dead too).
+   - if the master is alive (a slave has missed its HEARTBEAT), it answers the ELECTION with a HEARTBEAT at once, which stops the election.
+   The new master starts with an empty registry. When a slave hears the HEARTBEAT of a new master, it sends its messages to it and claims
+   its ID with an ID_REQUEST whose senderID is this ID. The new master gives every slave the ID it claims (claimBuoy()), so the data
+   keyed by the IDs stays valid. The claims are sent in the order of the IDs and repeated until the ID_REPLY arrives.
+   The HEARTBEAT also carries the number of IDs given by the master (holes included). A new master keeps the IDs of the master it followed
+   as holes (failoverFleetCount) : a new buoy which asks an ID during the claims gets the next one, not an ID which a slave has not claimed yet.
+   If two masters hear each other, the one with the highest MAC address becomes a slave of the other and claims its former ID. A slave
+   also prefers a master with a lower MAC address to its own, so that two networks which meet merge into one.
+
+   - failoverState, the state of the board, entered at failoverSince (millis()).
+   - failoverMasterKey, the key of the MAC address of the master followed (0 if it is unknown), last heard at failoverHeardAt.
+   - electionBest, the best candidate heard during the election, electionSendAt the time to send the ELECTION and electionSent whether it is sent.
+   - claimAt, the time of the next claim, and claimBackoff, the random backoff between the claims.
+   - failoverFormerID, the ID of the board before it became the master (-1 if it has always been the master).
+   - failoverFleetCount, the number of IDs given by the master followed, carried by its HEARTBEAT.
+   - failoverBeatAt, the time of the last HEARTBEAT sent by the master.
+   - failoverUnanswered, a message to the master has not been acknowledged by the WiFi since the master was last heard (set by OnDataSent).
+   - failoverChanged, the master or the ID of the board has changed since the last call of failoverChange().
+   - failoverStats, the counters of the failover (see moduleStats.h).
+*/
+int failoverState = FAILOVER_OFF;
+unsigned long failoverSince;
+uint64_t failoverMasterKey = 0;
+unsigned long failoverHeardAt;
+uint64_t electionBest;
+unsigned long electionSendAt;
+bool electionSent;
+unsigned long claimAt;
+structBackoff claimBackoff;
+int failoverFormerID = -1;
+int failoverFleetCount = 0;
+unsigned long failoverBeatAt;
+volatile bool failoverUnanswered = false;
+bool failoverChanged = false;
+structFailoverStats failoverStats;
+
+/* ---- Procedure for entering a state ---- */
+void failoverEnter(int state) {
+  failoverState = state;
+  failoverSince = millis();
+}
+
+/* ---- Procedure for starting the failover ---- */
+/*
+   INPUT : the MAC address of the master (table of uint8_t), the key of the MAC address of the board (uint64_t).
+   OUTPUT : nothing (void).
+   DESCRITPION : It is called once the board has its role. The master sends its first HEARTBEAT at once.
+*/
+void startFailover(const uint8_t masterAddress[], uint64_t myKey) {
+  if (FAILOVER_HEARTBEAT_MS == 0)
+    return;
+  failoverMasterKey = macAddressToKey(masterAddress);
+  failoverHeardAt = millis();
+  failoverBeatAt = millis() - FAILOVER_HEARTBEAT_MS;
+  failoverEnter((failoverMasterKey == myKey) ? FAILOVER_LEAD : FAILOVER_FOLLOW);
+}
+
+/* ---- Procedure for starting an election ---- */
+void startElection(uint64_t myKey) {
+  failoverEnter(FAILOVER_ELECTION);
+  electionBest = myKey;
+  electionSent = false;
+  electionSendAt = millis() + random(0, ELECTION_JITTER_MS);
+  failoverStats.elections++;
+}
+
+/* ---- Procedure for noting a message of the master ---- */
+/*
+   INPUT : the MAC address of the sender of a message (table of uint8_t).
+   OUTPUT : nothing (void).
+   DESCRITPION : Every message of the master followed by a slave refreshes its liveness.
+*/
+void failoverHeard(const uint8_t mac[]) {
+  if ((failoverState >= FAILOVER_FOLLOW) && (macAddressToKey(mac) == failoverMasterKey)) {
+    failoverHeardAt = millis();
+    failoverUnanswered = false;
+  }
+}
+
+/* ---- Procedure for checking if the master followed is alive ---- */
+/*
+   OUTPUT : true if the master has been heard during the last half of FAILOVER_TIMEOUT_MS (bool).
+*/
+bool failoverMasterAlive() {
+  return ((failoverState == FAILOVER_FOLLOW) || (failoverState == FAILOVER_CLAIM)) && (millis() - failoverHeardAt < FAILOVER_TIMEOUT_MS / 2);
+}
+
+/* ---- Procedure for checking if a slave must hold its DATA messages ---- */
+/*
+   OUTPUT : true if the board is a slave whose master is silent, or which claims its ID from a new master (bool).
+   DESCRITPION : A DATA message to a dead master is sent with all the retries of the WiFi, the DATA messages of the fleet would fill
+   the channel during the election and the claims : a slave holds them as soon as the WiFi reports a message to the master as not
+   acknowledged, or as it misses a HEARTBEAT, until it hears the master again. After its claim, it still holds them for
+   FAILOVER_TIMEOUT_MS, so that the fleet claims its IDs before the DATA messages are sent.
+*/
+bool failoverHolding() {
+  if (failoverState < FAILOVER_FOLLOW)
+    return false;
+  if ((failoverState != FAILOVER_FOLLOW) || failoverUnanswered || (millis() - failoverHeardAt > FAILOVER_HEARTBEAT_MS * 3 / 2))
+    return true;
+  return (failoverStats.attachments > 0) && (millis() - failoverSince < FAILOVER_TIMEOUT_MS);
+}
+
+/* ---- Procedure for receiving an ELECTION ---- */
+/*
+   INPUT : the key of the candidate (uint64_t), the key of the MAC address of the board (uint64_t).
+   OUTPUT : the action of the board (int).
+   DESCRITPION : The master answers with a HEARTBEAT. A slave whose master is alive ignores the ELECTION : the HEARTBEAT of the master
+   will stop it. So does a board which has just lost an election, the ELECTION is a late one of this election. Else the board takes part
+   in the election and keeps the best candidate.
+*/
+int failoverCandidate(uint64_t key, uint64_t myKey) {
+  if (failoverState == FAILOVER_LEAD) {
+    failoverBeatAt = millis() - FAILOVER_HEARTBEAT_MS;
+    return FAILOVER_SEND_HEARTBEAT;
+  }
+  if ((failoverState == FAILOVER_OFF) || failoverMasterAlive()
+      || ((failoverState == FAILOVER_WAIT) && (millis() - failoverSince < ELECTION_WINDOW_MS)))
+    return FAILOVER_NONE;
+  if (failoverState != FAILOVER_ELECTION)
+    startElection(myKey);
+  if (key < electionBest)
+    electionBest = key;
+  return FAILOVER_NONE;
+}
+
+/* ---- Procedure for receiving a HEARTBEAT ---- */
+/*
+   INPUT : the key of the master which sent it (uint64_t), the key of the MAC address of the board (uint64_t), the ID it would claim (int)
+   and the number of IDs given by the master (int).
+   OUTPUT : the action of the board (int).
+   DESCRITPION : The HEARTBEAT of the master followed stops an election. A board follows another master if it has a lower MAC address,
+   or if its own master is not alive : then it claims its ID from the new master. So a master which hears a master with a lower MAC address
+   becomes its slave, and all the boards end with the same master.
+*/
+int failoverHeartbeat(uint64_t key, uint64_t myKey, int buoyID, int fleetCount) {
+  if ((failoverState == FAILOVER_OFF) || (key == myKey))
+    return FAILOVER_NONE;
+  if (key == failoverMasterKey) {
+    failoverHeardAt = millis();
+    failoverFleetCount = fleetCount;
+    if ((failoverState == FAILOVER_ELECTION) || (failoverState == FAILOVER_WAIT))
+      failoverEnter(FAILOVER_FOLLOW);
+    return FAILOVER_NONE;
+  }
+  if ((key > failoverMasterKey) && ((failoverState == FAILOVER_LEAD) || failoverMasterAlive()))
+    return FAILOVER_NONE;
+  if (failoverState == FAILOVER_LEAD)
+    failoverStats.stepDowns++;
+  failoverMasterKey = key;
+  failoverHeardAt = millis();
+  failoverFleetCount = fleetCount;
+  failoverEnter(FAILOVER_CLAIM);
+  claimAt = millis() + ((buoyID > 0) ? buoyID * CLAIM_SLOT_MS : random(0, CLAIM_TIMEOUT_MS));
+  backoffReset(&claimBackoff);
+  failoverChanged = true;
+  return FAILOVER_FOLLOW_NEW;
+}
+
+/* ---- Procedure for noting a broadcast of the master ---- */
+/*
+   DESCRITPION : Every slave hears a message broadcast by the master, so it stands for the next HEARTBEAT : during a join, the master sends
+   ID_REPLY_BATCH messages and no HEARTBEAT.
+*/
+void failoverBroadcast() {
+  if (failoverState == FAILOVER_LEAD)
+    failoverBeatAt = millis();
+}
+
+/* ---- Procedure for the claimed ID received ---- */
+/*
+   DESCRITPION : The ID_REPLY of the new master has been received, the board follows it.
+*/
+void failoverAttached() {
+  backoffSuccess(&claimBackoff);
+  failoverEnter(FAILOVER_FOLLOW);
+  failoverStats.attachments++;
+  failoverChanged = true;
+}
+
+/* ---- Procedure for becoming the master ---- */
+/*
+   INPUT : the ID of the board before the takeover (int), the key of its MAC address (uint64_t).
+   OUTPUT : nothing (void).
+*/
+void failoverTakeOver(int formerID, uint64_t myKey) {
+  TRACE(TRACE_TAKEOVER, formerID, 0, 0);
+  failoverFormerID = formerID;
+  failoverMasterKey = myKey;
+  failoverBeatAt = millis() - FAILOVER_HEARTBEAT_MS;
+  failoverEnter(FAILOVER_LEAD);
+  failoverStats.takeovers++;
+  failoverChanged = true;
+}
+
+/* ---- Procedure for the next action of the failover ---- */
+/*
+   INPUT : the key of the MAC address of the board (uint64_t).
+   OUTPUT : the action of the board (int).
+   DESCRITPION : It must be called regularly, it checks the timeouts of the current state :
+   - the master sends a HEARTBEAT every FAILOVER_HEARTBEAT_MS, in its next slot with the time slots (see tdma.h). A HEARTBEAT late
+     for FAILOVER_HEARTBEAT_MS, as the first one or the answer to an ELECTION, is sent at once.
+   - a slave whose master is silent for FAILOVER_TIMEOUT_MS starts an election.
+   - a candidate sends its ELECTION after its jitter if it is still the best one, and becomes the master at the end of the election.
+   - a slave which claims its ID sends a claim at claimAt, the next one after CLAIM_TIMEOUT_MS and a backoff which widens at every claim.
+*/
+int failoverStep(uint64_t myKey) {
+  unsigned long now = millis();
+  switch (failoverState) {
+    case FAILOVER_LEAD:
+#if FAILOVER_HEARTBEAT_MS == 0
+      return FAILOVER_NONE;
+#else
+      if ((now - failoverBeatAt < FAILOVER_HEARTBEAT_MS - ((TDMA_SLOT_MS == 0) ? 0 : TDMA_MASTER_PERIOD_MS))
+          || ((now - failoverBeatAt < FAILOVER_HEARTBEAT_MS) && !tdmaMasterMayTransmit()))
+        return FAILOVER_NONE;
+      failoverBeatAt = now;
+      failoverStats.heartbeats++;
+      return FAILOVER_SEND_HEARTBEAT;
+#endif
+    case FAILOVER_FOLLOW:
+    case FAILOVER_CLAIM:
+      if (now - failoverHeardAt >= FAILOVER_TIMEOUT_MS) {
+        uint8_t mac[6];
+        keyToMacAddress(mac, failoverMasterKey);
+        TRACE_MAC(TRACE_MASTER_LOST, now - failoverHeardAt, mac);
+        startElection(myKey);
+        return FAILOVER_NONE;
+      }
+      if ((failoverState == FAILOVER_FOLLOW) || ((long)(now - claimAt) < 0))
+        return FAILOVER_NONE;
+      claimAt = now + CLAIM_TIMEOUT_MS + backoffDelay(&claimBackoff);
+      backoffFailure(&claimBackoff);
+      failoverStats.claims++;
+      return FAILOVER_SEND_CLAIM;
+    case FAILOVER_ELECTION:
+      if (!electionSent && (electionBest == myKey) && ((long)(now - electionSendAt) >= 0)) {
+        electionSent = true;
+        failoverStats.candidacies++;
+        return FAILOVER_SEND_ELECTION;
+      }
+      if (now - failoverSince < ELECTION_WINDOW_MS)
+        return FAILOVER_NONE;
+      if (electionBest == myKey)
+        return FAILOVER_TAKE_OVER;
+      failoverEnter(FAILOVER_WAIT);
+      return FAILOVER_NONE;
+    case FAILOVER_WAIT:
+      if (now - failoverSince >= FAILOVER_TIMEOUT_MS)
+        startElection(myKey);
+      return FAILOVER_NONE;
+  }
+  return FAILOVER_NONE;
+}
+
+/* ---- Procedure for reading the changes of the failover ---- */
+/*
+   OUTPUT : true if the master or the ID of the board has changed since the last call (bool), the boot cache must be written again.
+*/
+bool failoverChange() {
+  bool changed = failoverChanged;
+  failoverChanged = false;
+  return changed;
+}
+
+#endif
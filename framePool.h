@@ -0,0 +1,78 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+/* ---- Declaration of librairies ---- */
+#include <stdint.h>
+#include <string.h>
+#include "message.h"
+
+/* ---- Declaration of constants ---- */
+/*
+    The frame pool uses one constant :
+    - FRAME_POOL_LENGTH, the number of messages which can be prepared at the same time (at most 32).
+      The main task uses one for the request of the boot or for a reply of the master, and one for the ID_REPLY batch being filled.
+*/
+#ifndef FRAME_POOL_LENGTH
+#define FRAME_POOL_LENGTH 4
+#endif
+
+static_assert((FRAME_POOL_LENGTH > 0) && (FRAME_POOL_LENGTH <= 32), "FRAME_POOL_LENGTH must be between 1 and 32");
+
+/* ---- Definition of the frame pool ---- */
+/*
+   The messages sent by the board are prepared in frames taken from a static pool instead of the heap, so that the program never allocates
+   memory once it runs : its memory is known at the compilation and it cannot be fragmented.
+   - frames, the messages of the pool, and len, the length of each message.
+   - freeMask, one bit per frame, set if the frame is free.
+   Four counters help to size the pool :
+   - inUse and highWater, the number of frames taken now and the maximum number of frames taken at the same time.
+   - allocations, the number of frames taken since the boot, and failures, the number of times the pool was empty.
+   NB : The pool is only used by the main task (setup() and loop()), it needs no lock.
+*/
+typedef struct structFrame {
+  structMessage msg;
+  int len;
+} structFrame;
+
+typedef struct structFramePool {
+  structFrame frames[FRAME_POOL_LENGTH];
+  uint32_t freeMask;
+  uint32_t inUse;
+  uint32_t highWater;
+  uint32_t allocations;
+  uint32_t failures;
+} structFramePool;
+
+/* ---- Procedure for initialising the frame pool ---- */
+void initFramePool(structFramePool *pool) {
+  memset(pool, 0, sizeof(structFramePool));
+  pool->freeMask = (FRAME_POOL_LENGTH == 32) ? 0xFFFFFFFFUL : (1UL << FRAME_POOL_LENGTH) - 1;
+}
+
+/* ---- Procedure for taking a frame from the pool ---- */
+/*
+   INPUT : the pool (structFramePool).
+   OUTPUT : a free frame, or NULL if the pool is empty (structFrame).
+   DESCRITPION : The first free frame is found with one instruction (count of the trailing zeros of freeMask), its bit is cleared.
+*/
+structFrame *allocFrame(structFramePool *pool) {
+  if (pool->freeMask == 0) {
+    pool->failures++;
+    return NULL;
+  }
+  int i = __builtin_ctz(pool->freeMask);
+  pool->freeMask &= ~(1UL << i);
+  pool->allocations++;
+  if (++pool->inUse > pool->highWater)
+    pool->highWater = pool->inUse;
+  pool->frames[i].len = 0;
+  return &pool->frames[i];
+}
+
+/* ---- Procedure for giving a frame back to the pool ---- */
+void releaseFrame(structFramePool *pool, structFrame *frame) {
+  pool->freeMask |= 1UL << (frame - pool->frames);
+  pool->inUse--;
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef MAC_ADDRESS_H
+#define MAC_ADDRESS_H
+
+/* ---- Declaration of librairies ---- */
+#include <stdint.h>
+
+/* ---- Declaration of constants ---- */
+/*
+    The text form of a MAC address is six bytes in hexadecimal separated by ":" ("24:0A:C4:00:00:01") :
+    - MAC_STRING_LENGTH, the length of the text with its final '\0'.
+*/
+#define MAC_STRING_LENGTH 18
+
+/* ---- Definition of the tables of the codec ---- */
+/*
+   The conversions use two tables computed at the compilation, so that a character costs one load instead of comparisons :
+   - macHexDigits, the character of every hexadecimal digit (in upper case, as WiFi.macAddress()).
+   - macHexValues, the value of every character : 0 to 15 for '0' to '9', 'A' to 'F' and 'a' to 'f', -1 for any other character.
+*/
+static constexpr char macHexDigits[] = "0123456789ABCDEF";
+
+constexpr int8_t macHexValue(int c) {
+  return (c >= '0' && c <= '9') ? c - '0' : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
+
+#define MAC_HEX_VALUES_4(c) macHexValue(c), macHexValue(c + 1), macHexValue(c + 2), macHexValue(c + 3)
+#define MAC_HEX_VALUES_16(c) MAC_HEX_VALUES_4(c), MAC_HEX_VALUES_4(c + 4), MAC_HEX_VALUES_4(c + 8), MAC_HEX_VALUES_4(c + 12)
+#define MAC_HEX_VALUES_64(c) MAC_HEX_VALUES_16(c), MAC_HEX_VALUES_16(c + 16), MAC_HEX_VALUES_16(c + 32), MAC_HEX_VALUES_16(c + 48)
+
+static constexpr int8_t macHexValues[256] = {MAC_HEX_VALUES_64(0), MAC_HEX_VALUES_64(64), MAC_HEX_VALUES_64(128), MAC_HEX_VALUES_64(192)};
+
+static_assert(macHexValues['a'] == 10 && macHexValues['F'] == 15 && macHexValues['9'] == 9 && macHexValues['g'] == -1, "wrong table of hexadecimal values");
+
+/* ---- Procedures for formatting a MAC address ---- */
+/*
+   INPUT : the text to fill (table of MAC_STRING_LENGTH char), the MAC address (table of uint8_t) or its key (uint64_t, see macAddressToKey).
+   OUTPUT : nothing (void).
+   DESCRITPION : Every byte gives two characters of the table macHexDigits, followed by ":" or by the final '\0'. Nothing is allocated.
+*/
+void formatMacAddress(char str[MAC_STRING_LENGTH], const uint8_t addressMac[]) {
+  for (int i = 0; i < 6; i++) {
+    str[3 * i] = macHexDigits[addressMac[i] >> 4];
+    str[3 * i + 1] = macHexDigits[addressMac[i] & 0x0F];
+    str[3 * i + 2] = (i == 5) ? '\0' : ':';
+  }
+}
+
+void formatMacKey(char str[MAC_STRING_LENGTH], uint64_t key) {
+  for (int i = 5; i >= 0; i--) {
+    str[3 * i] = macHexDigits[(key >> 4) & 0x0F];
+    str[3 * i + 1] = macHexDigits[key & 0x0F];
+    str[3 * i + 2] = (i == 5) ? '\0' : ':';
+    key >>= 8;
+  }
+}
+
+/* ---- Procedure for parsing a MAC address ---- */
+/*
+   INPUT : the text (char *), the key to fill (uint64_t).
+   OUTPUT : true if the text is a MAC address (bool).
+   DESCRITPION : The text must be exactly six pairs of hexadecimal digits, in upper or lower case, separated by ":" or "-".
+   The digits are read with the table macHexValues, an invalid character (-1) stops the parsing at once, so that the end of a short text
+   is never passed. The key is the one of macAddressToKey (the first byte is the most significant one), it is only written if the text is valid.
+*/
+bool parseMacAddress(const char *str, uint64_t *key) {
+  uint64_t value = 0;
+  for (int i = 0; i < 6; i++) {
+    int hex1 = macHexValues[(uint8_t)str[3 * i]];
+    if (hex1 < 0)
+      return false;
+    int hex0 = macHexValues[(uint8_t)str[3 * i + 1]];
+    if (hex0 < 0)
+      return false;
+    char separator = str[3 * i + 2];
+    if ((i == 5) ? (separator != '\0') : ((separator != ':') && (separator != '-')))
+      return false;
+    value = (value << 8) | (uint64_t)((hex1 << 4) | hex0);
+  }
+  *key = value;
+  return true;
+}
+
+#endif
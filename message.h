@@ -0,0 +1,133 @@
+#ifndef MESSAGE_H
+#define MESSAGE_H
+
+/* ---- Declaration of librairies ---- */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* ---- Declaration of constants ---- */
+/*
+    The wire format of the ESP messages uses the following constants :
+    - PROTOCOL_VERSION, the version of the wire format. A message with another version is ignored.
+    - MESSAGE_LENGTH_MAX, the maximum length of an ESP-NOW payload.
+    - the opcodes, the different categories of message send on the ESP network (typeMessage).
+*/
+#define PROTOCOL_VERSION 5
+#define MESSAGE_LENGTH_MAX 250
+
+#define MASTER_DETECTION 0x01
+#define MASTER_REPLY 0x02
+#define ID_REQUEST 0x03
+#define ID_REPLY 0x04
+#define ID_REPLY_BATCH 0x05
+#define DATA 0x06
+#define DATA_ACK 0x07
+#define BEACON 0x08
+#define RELAY 0x09
+#define HEARTBEAT 0x0A
+#define ELECTION 0x0B
+#define METRICS 0x0C
+
+/* ---- Definition of the message structure ---- */
+/*
+   An ESP message is a packed binary header followed by a variable-length payload. The header is composed of six elements :
+   - version, the version of the wire format (PROTOCOL_VERSION).
+   - typeMessage, the opcode of the message (MASTER_DETECTION, MASTER_REPLY...).
+   - sequence, the number of the message for its sender, incremented at every message sent.
+   - senderID, the ID of the board who sends the message (-1 if it is not attributed).
+   - receiverID, the ID of the board to which the message is addressed (-1 for every board without ID).
+   - payload, the content of the ESP message. Only the bytes used are sent :
+     MASTER_DETECTION and ID_REQUEST carry the raw MAC address of the sender (6 bytes), MASTER_REPLY the raw MAC address of the sender
+     and its number of hops to the master (7 bytes, see relay.h),
+     ID_REPLY carries the raw MAC address of the slave, its ID and its time slot (10 bytes, see tdma.h).
+     ID_REPLY_BATCH carries the number of slaves (1 byte) then the raw MAC address, the ID and the time slot of every slave (10 bytes each, see ID_BATCH_MAX).
+     BEACON carries the time of the master (4 bytes), the number of slots described (1 byte), the number and the owner of every slot
+     (3 bytes each, TDMA_BEACON_ENTRIES of them) and a final 0 (1 byte, see tdma.h).
+     RELAY carries its header (RELAY_HEADER_LENGTH bytes), its path (2 bytes per relay) then the whole message relayed between a buoy and
+     the master (see relay.h).
+     HEARTBEAT carries the raw MAC address of the master and its number of IDs given (8 bytes), ELECTION the raw MAC address of its sender,
+     a candidate to replace a silent master (6 bytes, see failover.h). An ID_REQUEST sent by a slave which already has an ID claims this ID
+     (senderID) from a new master.
+     DATA carries a batch of samples of the telemetry (5 bytes then TELEMETRY_SAMPLE_LENGTH bytes per sample, see telemetry.h),
+     DATA_ACK the acknowledgement of the DATA messages received (6 bytes, see reliable.h).
+     For these two messages, sequence is the number of the message for its sender and its receiver (per peer), not for the sender only.
+     METRICS without payload asks the receiver for its metrics, it answers with a METRICS which carries its snapshot (see metrics.h).
+   The fields are in little-endian, the byte order of the ESP32. The header is MESSAGE_HEADER_LENGTH (8) bytes long, so a message is
+   8 bytes (METRICS query) to MESSAGE_LENGTH_MAX bytes long : 14 bytes for most of the control messages, 15 for a MASTER_REPLY, 16 for a
+   HEARTBEAT and 18 for an ID_REPLY, instead of the 88 bytes of every message of the former text format.
+*/
+typedef struct __attribute__((packed)) structMessage {
+  uint8_t version;
+  uint8_t typeMessage;
+  uint16_t sequence;
+  int16_t senderID;
+  int16_t receiverID;
+  uint8_t payload[MESSAGE_LENGTH_MAX - 8];
+} structMessage;
+
+#define MESSAGE_HEADER_LENGTH offsetof(structMessage, payload)
+
+/*
+   ID_BATCH_ENTRY_LENGTH is the length of a MAC address, its ID and its time slot in a ID_REPLY_BATCH, ID_BATCH_MAX the number of them which fit in a message (24).
+*/
+#define ID_BATCH_ENTRY_LENGTH 10
+#define ID_BATCH_MAX ((MESSAGE_LENGTH_MAX - MESSAGE_HEADER_LENGTH - 1) / ID_BATCH_ENTRY_LENGTH)
+
+/* ---- Procedure for preparing a message ---- */
+/*
+   INPUT : the message (structMessage), its opcode (uint8_t), the sender ID (int), the receiver ID (int).
+   OUTPUT : the length of the message, the header only (int).
+   DESCRITPION : The program fills the header of the message and increments the sequence number of the board.
+   The payload is then added with putMacAddress and putID, which return the new length of the message.
+   NB : messageSequence is the sequence number of the next message sent by the board.
+*/
+uint16_t messageSequence = 0;
+int prepareMessage(structMessage *msg, uint8_t typeMessage, int senderID, int receiverID) {
+  msg->version = PROTOCOL_VERSION;
+  msg->typeMessage = typeMessage;
+  msg->sequence = messageSequence++;
+  msg->senderID = senderID;
+  msg->receiverID = receiverID;
+  return MESSAGE_HEADER_LENGTH;
+}
+
+/* ---- Procedures for writing the payload of a message ---- */
+/*
+   INPUT : the message (structMessage), its current length (int), the value to add.
+   OUTPUT : the new length of the message (int).
+   DESCRITPION : The value is copied at the end of the message, a MAC address on 6 bytes and an ID on 2 bytes.
+*/
+int putMacAddress(structMessage *msg, int len, const uint8_t addressMac[]) {
+  memcpy((uint8_t *)msg + len, addressMac, 6);
+  return len + 6;
+}
+
+int putID(structMessage *msg, int len, int buoyID) {
+  int16_t id = buoyID;
+  memcpy((uint8_t *)msg + len, &id, sizeof(id));
+  return len + sizeof(id);
+}
+
+/* ---- Procedure for reading an ID in the payload of a message ---- */
+/*
+   INPUT : the message (structMessage), the offset of the ID in the message (int).
+   OUTPUT : the ID (int).
+*/
+int getID(const structMessage *msg, int offset) {
+  int16_t id;
+  memcpy(&id, (const uint8_t *)msg + offset, sizeof(id));
+  return id;
+}
+
+/* ---- Procedure for checking a message received ---- */
+/*
+   INPUT : the data received (table of uint8_t), its length (int).
+   OUTPUT : true if the data is a message of this version of the protocol (bool).
+   DESCRITPION : The message must contain at least a whole header and have the same protocol version as the board.
+*/
+bool isMessageValid(const uint8_t *data, int len) {
+  return len >= (int)MESSAGE_HEADER_LENGTH && len <= (int)sizeof(structMessage) && data[0] == PROTOCOL_VERSION;
+}
+
+#endif
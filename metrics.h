@@ -0,0 +1,171 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/* ---- Declaration of librairies ---- */
+#include <Arduino.h>
+#include <stdint.h>
+#include <string.h>
+#include "message.h"
+#include "relay.h"
+#include "trace.h"
+#include "metricsSnapshot.h"
+
+/* ---- Declaration of constants ---- */
+/*
+    The metrics use the following constants, the counters, the histograms and the snapshot are defined in metricsSnapshot.h :
+    - METRICS_QUERY_LENGTH, the length of a query of the host on the serial monitor : METRICS_SYNC then the ID of the buoy asked
+      (2 bytes, -1 for the board itself).
+    - METRICS_QUERY_TIMEOUT_MS, the time given to a buoy to answer a query, before the next query is read.
+    - METRICS_NO_QUERY, the result of metricsReadQuery() when no query is waiting.
+*/
+#define METRICS_QUERY_LENGTH 3
+#ifndef METRICS_QUERY_TIMEOUT_MS
+#define METRICS_QUERY_TIMEOUT_MS 50
+#endif
+#define METRICS_NO_QUERY -2
+
+static_assert(MESSAGE_HEADER_LENGTH + RELAY_HEADER_LENGTH + MESSAGE_HEADER_LENGTH + sizeof(structMetricsSnapshot) <= MESSAGE_LENGTH_MAX,
+              "a snapshot must fit in a METRICS message relayed to the master");
+
+/* ---- Definition of the metrics ---- */
+/*
+   The metrics replace the counters printed on the serial monitor : every buoy keeps them in a structMetrics in RAM, updated in place,
+   so that they take a fixed memory and cost a few additions, and copies them into a structMetricsSnapshot when it is asked for them :
+   - the frames sent per opcode are counted by sendTicket() (see reliable.h), the frames received by the dispatcher.
+   - the counters of events are incremented where the event happens, OnDataSent included (WiFi task) : they are added atomically.
+     The other counters are copied from their module by snapshotMetrics() (see utilities.h), when a snapshot is taken.
+   - a value of a histogram increments the count of its bucket, whose number is the number of bits of the value.
+   The snapshot is pulled by a METRICS message without payload, the buoy answers with a METRICS message which carries it (see message.h).
+   The host connected to the serial monitor of a buoy pulls the snapshot of the buoy or of any other one with a query : the snapshot
+   is written on the serial monitor with metricsWrite(), and decoded by sim/metrics_decode.cpp. The host sends its next query once the
+   snapshot is written (the UART of the ESP32 only buffers 256 bytes), the buoy reads it once the previous one is answered or too late.
+   A METRICS message is not sent again : a buoy which has not answered after METRICS_QUERY_TIMEOUT_MS is written in the trace, the host
+   may ask it again.
+   - metrics, the registry of the metrics of the board.
+   - metricsQuery and metricsQueryLength, the bytes of the query read so far.
+   - metricsQueryID, the ID asked by the query waiting for its answer (METRICS_NO_QUERY if there is none), metricsQueryAt the time
+     it was sent.
+*/
+structMetrics metrics;
+uint8_t metricsQuery[METRICS_QUERY_LENGTH];
+int metricsQueryLength = 0;
+int metricsQueryID = METRICS_NO_QUERY;
+unsigned long metricsQueryAt;
+
+/* ---- Procedures for counting ---- */
+/*
+   metricsCount counts an event, metricsSent and metricsReceived a frame of the opcode given (the unknown opcodes are not counted).
+   NB : Only metricsCount can be called by the WiFi task.
+*/
+void metricsCount(int counter) {
+  __atomic_fetch_add(&metrics.counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+void metricsSent(uint8_t typeMessage) {
+  if ((typeMessage >= 1) && (typeMessage <= METRICS_TYPES))
+    metrics.sent[typeMessage - 1]++;
+}
+
+void metricsReceived(uint8_t typeMessage) {
+  if ((typeMessage >= 1) && (typeMessage <= METRICS_TYPES))
+    metrics.received[typeMessage - 1]++;
+}
+
+/* ---- Procedure for adding a value to a histogram ---- */
+/*
+   INPUT : the histogram (int) and the value (uint32_t).
+   OUTPUT : nothing (void).
+*/
+void metricsObserve(int histogram, uint32_t value) {
+  int bucket = (value == 0) ? 0 : 32 - __builtin_clz(value);
+  if (bucket >= METRICS_BUCKETS)
+    bucket = METRICS_BUCKETS - 1;
+  if (metrics.histograms[histogram][bucket] != UINT16_MAX)
+    metrics.histograms[histogram][bucket]++;
+}
+
+/* ---- Procedure for taking a snapshot of the metrics ---- */
+/*
+   INPUT : the snapshot (structMetricsSnapshot), the ESP status (int) and the ID (int) of the board.
+   OUTPUT : nothing (void).
+   DESCRITPION : The registry is copied field by field, the snapshot is packed and its fields may not be aligned.
+*/
+void metricsTakeSnapshot(structMetricsSnapshot *snapshot, int espStatus, int buoyID) {
+  snapshot->format = METRICS_FORMAT;
+  snapshot->espStatus = espStatus;
+  snapshot->buoyID = buoyID;
+  snapshot->uptimeMs = millis();
+  for (int i = 0; i < METRICS_TYPES; i++) {
+    snapshot->sent[i] = metrics.sent[i];
+    snapshot->received[i] = metrics.received[i];
+  }
+  for (int i = 0; i < METRIC_COUNTER_COUNT; i++)
+    snapshot->counters[i] = __atomic_load_n(&metrics.counters[i], __ATOMIC_RELAXED);
+  for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++)
+    for (int b = 0; b < METRICS_BUCKETS; b++)
+      snapshot->histograms[h][b] = metrics.histograms[h][b];
+}
+
+/* ---- Procedure for writing a snapshot on the serial monitor ---- */
+/*
+   INPUT : the snapshot (structMetricsSnapshot), of the board or received in a METRICS message.
+   OUTPUT : nothing (void).
+   DESCRITPION : The snapshot is written in one piece, so that the events of the trace are not mixed with it (see trace.h).
+   NB : Unlike the trace, it waits for the UART : it is only written once per query of the host.
+*/
+void metricsWrite(const structMetricsSnapshot *snapshot) {
+  uint8_t frame[METRICS_FRAME_LENGTH];
+  uint8_t sum = 0;
+  frame[0] = METRICS_SYNC;
+  frame[1] = sizeof(structMetricsSnapshot);
+  memcpy(&frame[2], snapshot, sizeof(structMetricsSnapshot));
+  for (size_t i = 1; i < METRICS_FRAME_LENGTH - 1; i++)
+    sum += frame[i];
+  frame[METRICS_FRAME_LENGTH - 1] = sum;
+  Serial.write(frame, METRICS_FRAME_LENGTH);
+}
+
+/* ---- Procedure for reading a query of the host ---- */
+/*
+   INPUT : nothing (void).
+   OUTPUT : the ID of the buoy asked, -1 for the board itself, or METRICS_NO_QUERY (int).
+   DESCRITPION : The bytes received on the serial monitor are read until a whole query, the bytes before METRICS_SYNC are skipped.
+   Nothing is read while the previous query waits for its answer, unless it is too late : the buoy is then written in the trace.
+*/
+int metricsReadQuery() {
+  if (metricsQueryID != METRICS_NO_QUERY) {
+    if (millis() - metricsQueryAt < METRICS_QUERY_TIMEOUT_MS)
+      return METRICS_NO_QUERY;
+    TRACE(TRACE_METRICS_TIMEOUT, metricsQueryID, 0, 0);
+    metricsQueryID = METRICS_NO_QUERY;
+  }
+  while (Serial.available() > 0) {
+    int c = Serial.read();
+    if ((metricsQueryLength == 0) && (c != METRICS_SYNC))
+      continue;
+    metricsQuery[metricsQueryLength++] = c;
+    if (metricsQueryLength == METRICS_QUERY_LENGTH) {
+      int16_t buoyID;
+      memcpy(&buoyID, &metricsQuery[1], sizeof(buoyID));
+      metricsQueryLength = 0;
+      return buoyID;
+    }
+  }
+  return METRICS_NO_QUERY;
+}
+
+/* ---- Procedures for following the answer to a query ---- */
+/*
+   metricsAsked records the buoy asked by a METRICS message, metricsAnswered is called when its snapshot has been written.
+*/
+void metricsAsked(int buoyID) {
+  metricsQueryID = buoyID;
+  metricsQueryAt = millis();
+}
+
+void metricsAnswered(int buoyID) {
+  if (buoyID == metricsQueryID)
+    metricsQueryID = METRICS_NO_QUERY;
+}
+
+#endif
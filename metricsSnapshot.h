@@ -0,0 +1,98 @@
+#ifndef METRICS_SNAPSHOT_H
+#define METRICS_SNAPSHOT_H
+
+/* ---- Declaration of librairies ---- */
+#include <stdint.h>
+
+/* ---- Declaration of constants ---- */
+/*
+    The snapshot of the metrics (see metrics.h) uses the following constants :
+    - METRICS_FORMAT, the version of the snapshot. A snapshot of another version is not decoded.
+    - METRICS_TYPES, the number of opcodes counted (see message.h), the opcode n is counted at the place n - 1.
+    - METRICS_BUCKETS, the number of buckets of a histogram. The bucket 0 counts the value 0, the bucket k the values from 2^(k-1)
+      to 2^k - 1, and the last bucket every value from 2^(METRICS_BUCKETS - 2).
+    - METRICS_SYNC, the first byte of a snapshot on the serial monitor and of a query of the host. As TRACE_SYNC, it is not an ASCII
+      character, so that a decoder finds the snapshots among the lines printed as text.
+*/
+#define METRICS_FORMAT 4
+#define METRICS_TYPES 12
+#define METRICS_BUCKETS 14
+#define METRICS_SYNC 0xB7
+
+/* ---- Definition of the counters and of the histograms ---- */
+/*
+   Every counter has a name, the way the decoder (sim/metrics_decode.cpp) adds up the counters of several buoys (METRICS_SUM or
+   METRICS_MAX) and a description. Some counters count events, the others are copied from another module when the snapshot is taken.
+   Every histogram has a name, a description and the unit of its values.
+   The lists are only extended at their end, and METRICS_FORMAT is incremented, so that an old snapshot is not misread.
+   NB : A snapshot must fit in a METRICS message relayed to the master (see metrics.h) : a new histogram costs METRICS_BUCKETS * 2 bytes.
+*/
+#define METRICS_SUM 0
+#define METRICS_MAX 1
+
+#define METRICS_COUNTERS(COUNTER)                                                                    \
+  COUNTER(METRIC_SEND_FAILED, METRICS_SUM, "frames not acknowledged by their receiver (OnDataSent)") \
+  COUNTER(METRIC_SEND_ERRORS, METRICS_SUM, "frames refused by esp_now_send()")                       \
+  COUNTER(METRIC_RX_INVALID, METRICS_SUM, "frames ignored, wrong length or protocol version")        \
+  COUNTER(METRIC_RX_DROPS, METRICS_SUM, "frames dropped, receive queue full")                        \
+  COUNTER(METRIC_RX_HIGH_WATER, METRICS_MAX, "receive queue high-water (frames)")                     \
+  COUNTER(METRIC_REGISTRY_SIZE, METRICS_MAX, "buoys in the registry of the master")                  \
+  COUNTER(METRIC_JOIN_RETRIES, METRICS_SUM, "ID_REQUEST sent again during the boot")                 \
+  COUNTER(METRIC_DATA_RETRIES, METRICS_SUM, "DATA sent again (reliable delivery)")                   \
+  COUNTER(METRIC_DATA_FAILED, METRICS_SUM, "DATA given up (reliable delivery)")                      \
+  COUNTER(METRIC_POOL_FAILURES, METRICS_SUM, "messages not sent, frame pool empty")                  \
+  COUNTER(METRIC_PEER_HITS, METRICS_SUM, "replies sent to the MAC address of a cached buoy")         \
+  COUNTER(METRIC_PEER_MISSES, METRICS_SUM, "replies broadcast, buoy not in the peer cache")          \
+  COUNTER(METRIC_PEER_INSERTIONS, METRICS_SUM, "buoys added to the peer cache")                      \
+  COUNTER(METRIC_PEER_EVICTIONS, METRICS_SUM, "idle buoys evicted from the peer cache")              \
+  COUNTER(METRIC_PEER_FULL, METRICS_SUM, "buoys not cached, no idle buoy to evict")                  \
+  COUNTER(METRIC_SEND_STATUS_LOST, METRICS_SUM, "OnDataSent lost, ticket skipped or dropped")        \
+  COUNTER(METRIC_SEND_STATUS_STRAY, METRICS_SUM, "OnDataSent without ticket, ignored")
+
+#define METRICS_HISTOGRAMS(HISTOGRAM)                                                \
+  HISTOGRAM(METRIC_JOIN_MS, "time from the boot to the ID", "ms")                    \
+  HISTOGRAM(METRIC_DATA_RTT_US, "round trip of the DATA acknowledged at once", "us")
+
+#define METRICS_COUNTER_ID(name, kind, description) name,
+#define METRICS_HISTOGRAM_ID(name, description, unit) name,
+
+enum { METRICS_COUNTERS(METRICS_COUNTER_ID) METRIC_COUNTER_COUNT };
+enum { METRICS_HISTOGRAMS(METRICS_HISTOGRAM_ID) METRIC_HISTOGRAM_COUNT };
+
+/* ---- Definition of the snapshot ---- */
+/*
+   A snapshot is the whole registry of the metrics of a buoy, in little-endian : the version of the snapshot, the ESP status and the
+   ID of the buoy, its time since the boot (millis()), the frames sent and received per opcode, the counters and the histograms.
+   The count of a bucket stops at 65535.
+   On the serial monitor, a snapshot is METRICS_SYNC, its length (1 byte), the snapshot, then the sum of its length and of its bytes
+   (METRICS_FRAME_LENGTH bytes).
+*/
+typedef struct __attribute__((packed)) structMetricsSnapshot {
+  uint8_t format;
+  int8_t espStatus;
+  int16_t buoyID;
+  uint32_t uptimeMs;
+  uint32_t sent[METRICS_TYPES];
+  uint32_t received[METRICS_TYPES];
+  uint32_t counters[METRIC_COUNTER_COUNT];
+  uint16_t histograms[METRIC_HISTOGRAM_COUNT][METRICS_BUCKETS];
+} structMetricsSnapshot;
+
+#define METRICS_FRAME_LENGTH (sizeof(structMetricsSnapshot) + 3)
+
+static_assert(sizeof(structMetricsSnapshot) < 256, "the length of a snapshot is written on one byte");
+
+/* ---- Definition of the registry ---- */
+/*
+   The registry is the part of the snapshot that a buoy updates in place. It is not packed : its counters are added atomically (see
+   metricsCount()) and an unaligned atomic faults on the ESP32, whereas a field of the snapshot can be at any offset. It is copied
+   field by field into a snapshot when the snapshot is taken.
+*/
+typedef struct structMetrics {
+  uint32_t sent[METRICS_TYPES];
+  uint32_t received[METRICS_TYPES];
+  uint32_t counters[METRIC_COUNTER_COUNT];
+  uint16_t histograms[METRIC_HISTOGRAM_COUNT][METRICS_BUCKETS];
+} structMetrics;
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef MODULE_STATS_H
+#define MODULE_STATS_H
+
+/* ---- Declaration of librairies ---- */
+#include <stdint.h>
+
+/* ---- Definition of the counters of the modules ---- */
+/*
+   The counters of the receive queue (rxQueue.h), of the reliable delivery (reliable.h), of the telemetry (telemetry.h), of the relay
+   (relay.h) and of the failover (failover.h) are described with their module. Their types are defined here, without any dependency,
+   so that the simulator reads them in every copy of the sketch with the same definitions (see sim/sim.h).
+   structRxQueueCounters is the beginning of structRxQueue, its fields are checked by rxQueue.h.
+*/
+typedef struct structRxQueueCounters {
+  uint32_t head;
+  uint32_t tail;
+  uint32_t highWater;
+  uint32_t drops;
+} structRxQueueCounters;
+
+typedef struct structReliableStats {
+  uint32_t sent;
+  uint32_t retransmissions;
+  uint32_t acked;
+  uint32_t failed;
+  uint32_t windowFull;
+  uint32_t delivered;
+  uint32_t deliveredBytes;
+  uint32_t duplicates;
+  uint32_t acks;
+  uint32_t rttSamples;
+  uint64_t rttSumUs;
+} structReliableStats;
+
+typedef struct structTelemetryStats {
+  uint32_t sampled;
+  uint32_t dropped;
+  uint32_t batchesSent;
+  uint32_t samplesSent;
+  uint32_t batchesReceived;
+  uint32_t stored;
+  uint32_t overwritten;
+  uint32_t exported;
+  uint32_t unstored;
+  uint32_t latencyMaxMs;
+  uint64_t latencySumMs;
+  uint64_t latencySquaresMs;
+} structTelemetryStats;
+
+typedef struct structRelayStats {
+  uint32_t wrapped;
+  uint32_t forwarded;
+  uint32_t beacons;
+  uint32_t duplicates;
+  uint32_t dropped;
+  uint32_t parentChanges;
+} structRelayStats;
+
+typedef struct structFailoverStats {
+  uint32_t heartbeats;
+  uint32_t elections;
+  uint32_t candidacies;
+  uint32_t takeovers;
+  uint32_t stepDowns;
+  uint32_t claims;
+  uint32_t attachments;
+} structFailoverStats;
+
+#endif
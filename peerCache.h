@@ -0,0 +1,147 @@
+#ifndef PEER_CACHE_H
+#define PEER_CACHE_H
+
+/* ---- Declaration of librairies ---- */
+#include <Arduino.h>
+#include <esp_now.h>
+#include <stdint.h>
+#include <string.h>
+#include "buoyRegistry.h"
+#include "metrics.h"
+
+/* ---- Declaration of constants ---- */
+/*
+    The unicast peer cache of the master uses the following constants :
+    - PEER_CACHE_SIZE, the number of buoys registered as ESP-NOW peers by the master. The peer table of ESP-NOW holds 20 peers, the
+      broadcast address and the next hop of the relay take two of them. With 0, every reply of the master is broadcast.
+    - PEER_CACHE_IDLE_MS, the time without message after which a cached buoy may give its place to another one. A buoy which has been
+      heard more recently keeps its place, so that a fleet larger than the cache does not replace a peer at every message.
+*/
+#ifndef PEER_CACHE_SIZE
+#define PEER_CACHE_SIZE 16
+#endif
+#ifndef PEER_CACHE_IDLE_MS
+#define PEER_CACHE_IDLE_MS 500
+#endif
+
+static_assert((PEER_CACHE_SIZE >= 0) && (PEER_CACHE_SIZE <= ESP_NOW_MAX_TOTAL_PEER_NUM - 2), "PEER_CACHE_SIZE must leave room for the broadcast address and the next hop");
+
+/* ---- Definition of the peer cache ---- */
+/*
+   The master sends its replies (MASTER_REPLY, ID_REPLY, DATA_ACK...) to the broadcast address, which has no acknowledgement nor retry
+   of the WiFi : a reply lost is only recovered by the slave repeating its request. A reply sent to an ESP-NOW peer is acknowledged and
+   repeated by the WiFi, but the peer table is too small for the whole fleet.
+   So the master keeps the buoys heard the most recently as peers (least recently used cache) :
+   - every message received from a buoy refreshes its place. An unknown buoy takes a free place, or the place of the least recently heard
+     buoy if it is idle for PEER_CACHE_IDLE_MS (eviction) : the old buoy is removed from the peer table and the new one is added.
+   - a reply to a cached buoy is sent to its MAC address (hit), a reply to another buoy is sent to the broadcast address (miss).
+   The MASTER_REPLY (sent to every new buoy at the start of the fleet), the ID_REPLY_BATCH messages with several buoys, the BEACON and
+   the HEARTBEAT stay broadcast.
+
+   - peerCacheKeys, the key of the MAC address of every cached buoy (see macAddressToKey()), peerCacheHeardAt the time it was last heard.
+   - peerCacheCount, the number of cached buoys.
+   The hits, the misses, the insertions, the evictions and the buoys not cached for want of an idle place are counted in the metrics
+   (see metrics.h).
+*/
+/* one more place, so that the tables exist when PEER_CACHE_SIZE is 0 */
+uint64_t peerCacheKeys[PEER_CACHE_SIZE + 1];
+unsigned long peerCacheHeardAt[PEER_CACHE_SIZE + 1];
+int peerCacheCount = 0;
+
+static const uint8_t peerCacheBroadcastAddress[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+/* ---- Procedure for finding a buoy in the cache ---- */
+/*
+   INPUT : the key of the MAC address of the buoy (uint64_t).
+   OUTPUT : the place of the buoy in the cache, -1 if it is not cached (int).
+*/
+int peerCacheFind(uint64_t key) {
+  for (int i = 0; i < peerCacheCount; i++)
+    if (peerCacheKeys[i] == key)
+      return i;
+  return -1;
+}
+
+/* ---- Procedure for adding a buoy to the peer table ---- */
+bool peerCacheAddPeer(uint64_t key) {
+  esp_now_peer_info_t info = {};
+  keyToMacAddress(info.peer_addr, key);
+  info.channel = 0;
+  info.encrypt = false;
+  return esp_now_add_peer(&info) == ESP_OK;
+}
+
+/* ---- Procedure for emptying the cache ---- */
+/*
+   DESCRITPION : The cached buoys are removed from the peer table, when the board stops being the master (see failover.h).
+*/
+void clearPeerCache() {
+  uint8_t mac[6];
+  for (int i = 0; i < peerCacheCount; i++) {
+    keyToMacAddress(mac, peerCacheKeys[i]);
+    esp_now_del_peer(mac);
+  }
+  peerCacheCount = 0;
+}
+
+/* ---- Procedure for noting a message of a buoy ---- */
+/*
+   INPUT : the MAC address of the sender of a message received by the master (table of uint8_t).
+   OUTPUT : nothing (void).
+   DESCRITPION : The buoy takes a place in the cache or refreshes its own. Without free place, the least recently heard buoy is evicted
+   if it is idle, else the new buoy is not cached (full) and its replies stay broadcast.
+*/
+void peerCacheHeard(const uint8_t mac[]) {
+  if (PEER_CACHE_SIZE == 0)
+    return;
+  uint64_t key = macAddressToKey(mac);
+  if (key == REGISTRY_NO_BUOY)
+    return;
+  unsigned long now = millis();
+  int i = peerCacheFind(key);
+  if (i != -1) {
+    peerCacheHeardAt[i] = now;
+    return;
+  }
+  if (peerCacheCount == PEER_CACHE_SIZE) {
+    int oldest = 0;
+    for (i = 1; i < peerCacheCount; i++)
+      if (now - peerCacheHeardAt[i] > now - peerCacheHeardAt[oldest])
+        oldest = i;
+    if (now - peerCacheHeardAt[oldest] < PEER_CACHE_IDLE_MS) {
+      metricsCount(METRIC_PEER_FULL);
+      return;
+    }
+    uint8_t oldMac[6];
+    keyToMacAddress(oldMac, peerCacheKeys[oldest]);
+    esp_now_del_peer(oldMac);
+    peerCacheKeys[oldest] = peerCacheKeys[--peerCacheCount];
+    peerCacheHeardAt[oldest] = peerCacheHeardAt[peerCacheCount];
+    metricsCount(METRIC_PEER_EVICTIONS);
+  }
+  /*the buoy may already be a peer (the old master after a failover), the cache does not take it.*/
+  if (!peerCacheAddPeer(key))
+    return;
+  peerCacheKeys[peerCacheCount] = key;
+  peerCacheHeardAt[peerCacheCount] = now;
+  peerCacheCount++;
+  metricsCount(METRIC_PEER_INSERTIONS);
+}
+
+/* ---- Procedure for choosing the address of a message ---- */
+/*
+   INPUT : the MAC address of the receiver (table of uint8_t).
+   OUTPUT : its MAC address if it is cached or if it is a peer of the board (the master of a slave), else the broadcast address (table of uint8_t).
+*/
+const uint8_t *peerCacheAddress(const uint8_t mac[]) {
+  if ((PEER_CACHE_SIZE > 0) && (peerCacheFind(macAddressToKey(mac)) != -1)) {
+    metricsCount(METRIC_PEER_HITS);
+    return mac;
+  }
+  if (esp_now_is_peer_exist(mac))
+    return mac;
+  metricsCount(METRIC_PEER_MISSES);
+  return peerCacheBroadcastAddress;
+}
+
+#endif
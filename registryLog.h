@@ -0,0 +1,272 @@
+#ifndef REGISTRY_LOG_H
+#define REGISTRY_LOG_H
+
+/* ---- Declaration of librairies ---- */
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "buoyRegistry.h"
+
+/* ---- Declaration of constants ---- */
+/*
+    The buoy registry of the master is saved in a file of the flash (LittleFS), so that a master which reboots keeps the ID of every buoy :
+    - REGISTRY_LOG_PATH, the file, and REGISTRY_LOG_TMP_PATH, the new file written by a compaction before it replaces the old one.
+    - REGISTRY_LOG_MAGIC ("BREG") and REGISTRY_LOG_VERSION, the beginning of a valid file.
+    - REGISTRY_LOG_COMPACT_RECORDS, the number of records appended after which the file is compacted.
+    - REGISTRY_LOG_CHUNK, the number of MAC addresses read or written at a time.
+    - REGISTRY_LOG_CLAIM_MS, the time without claim after which the IDs claimed after a failover are saved (see claimRegistryLog()).
+*/
+#define REGISTRY_LOG_PATH "/registry.log"
+#define REGISTRY_LOG_TMP_PATH "/registry.tmp"
+#define REGISTRY_LOG_MAGIC 0x47455242UL
+#define REGISTRY_LOG_VERSION 1
+#ifndef REGISTRY_LOG_COMPACT_RECORDS
+#define REGISTRY_LOG_COMPACT_RECORDS 64
+#endif
+#define REGISTRY_LOG_CHUNK 64
+#ifndef REGISTRY_LOG_CLAIM_MS
+#define REGISTRY_LOG_CLAIM_MS 200
+#endif
+
+/* ---- Definition of the file ---- */
+/*
+   The file is a snapshot of the registry followed by the buoys added since then, in little-endian :
+   - the header of the snapshot : magic (4 bytes), version (2 bytes) and number of buoys (2 bytes),
+   - the MAC address of the buoys 0 to count - 1, 6 bytes each (the ID of a buoy is its place),
+   - the checksum of the header and of the MAC addresses (2 bytes),
+   - then one record per buoy added : its ID (2 bytes), its MAC address (6 bytes) and the checksum of both (2 bytes).
+   A record is appended with a single write. If the power is lost during the write, the last record is incomplete or its checksum is wrong :
+   it is ignored at the next boot and the file is compacted. A compaction writes a new snapshot in REGISTRY_LOG_TMP_PATH then renames it,
+   so the old file stays valid until the new one is complete.
+   A registry of 1000 buoys takes 6 KB, loaded with one read per REGISTRY_LOG_CHUNK buoys.
+   A hole of the registry (an ID not claimed yet, see claimBuoy()) is written with the broadcast address (REGISTRY_NO_BUOY).
+*/
+typedef struct __attribute__((packed)) structRegistryLogHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;
+} structRegistryLogHeader;
+
+typedef struct __attribute__((packed)) structRegistryLogRecord {
+  uint16_t buoyID;
+  uint8_t macAddress[6];
+  uint16_t checksum;
+} structRegistryLogRecord;
+
+/*
+   registryLogRecords is the number of records appended since the last snapshot, -1 if the flash is not available.
+   registryLogDirty is set when the registry has changed without being saved, registryLogChangedAt is the time of the last change.
+   registryLogUnsaved is the first new buoy which could not be saved (-1 if none) : this ID and the next ones are not sent before a
+   compaction saves them (see registryLogSaved()).
+*/
+int registryLogRecords = -1;
+bool registryLogDirty = false;
+int registryLogUnsaved = -1;
+unsigned long registryLogChangedAt;
+
+/* ---- Procedure for computing a checksum ---- */
+/*
+   INPUT : the checksum of the previous bytes (0xFFFF at the beginning), the bytes (table of uint8_t) and their number (size_t).
+   OUTPUT : the checksum (uint16_t).
+   DESCRITPION : CRC-16/CCITT, which detects every error of less than 4 bits and every burst of less than 17 bits.
+*/
+uint16_t registryChecksum(uint16_t crc, const uint8_t *data, size_t len) {
+  while (len--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (int i = 0; i < 8; i++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+/* ---- Procedure for writing a snapshot of the registry ---- */
+/*
+   INPUT : the registry (structBuoyRegistry).
+   OUTPUT : true if the new file has replaced the old one (bool).
+   DESCRITPION : The whole registry is written in REGISTRY_LOG_TMP_PATH, which is then renamed REGISTRY_LOG_PATH. The records are dropped.
+*/
+bool compactRegistryLog(const structBuoyRegistry *registry) {
+  if (registryLogRecords < 0)
+    return false;
+  File file = LittleFS.open(REGISTRY_LOG_TMP_PATH, FILE_WRITE);
+  if (!file)
+    return false;
+  structRegistryLogHeader header = {REGISTRY_LOG_MAGIC, REGISTRY_LOG_VERSION, (uint16_t)registry->count};
+  uint16_t crc = registryChecksum(0xFFFF, (const uint8_t *)&header, sizeof(header));
+  bool written = (file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header));
+  uint8_t chunk[6 * REGISTRY_LOG_CHUNK];
+  for (int first = 0; written && (first < registry->count); first += REGISTRY_LOG_CHUNK) {
+    int n = (registry->count - first < REGISTRY_LOG_CHUNK) ? registry->count - first : REGISTRY_LOG_CHUNK;
+    for (int i = 0; i < n; i++)
+      keyToMacAddress(&chunk[6 * i], registry->macAddresses[first + i]);
+    crc = registryChecksum(crc, chunk, 6 * n);
+    written = (file.write(chunk, 6 * n) == (size_t)(6 * n));
+  }
+  written = written && (file.write((const uint8_t *)&crc, sizeof(crc)) == sizeof(crc));
+  file.close();
+  /*the old file is only replaced by a complete snapshot.*/
+  if (!written || !LittleFS.rename(REGISTRY_LOG_TMP_PATH, REGISTRY_LOG_PATH)) {
+    LittleFS.remove(REGISTRY_LOG_TMP_PATH);
+    return false;
+  }
+  registryLogRecords = 0;
+  registryLogDirty = false;
+  registryLogUnsaved = -1;
+  return true;
+}
+
+/* ---- Procedure for mounting the file system ---- */
+/*
+   INPUT : nothing (void).
+   OUTPUT : true if the flash is available (bool).
+   DESCRITPION : The file system is mounted (formatted if it can't be) and the file is not read : a new master which takes over after a
+   failover writes a new registry (see takeOver() in utilities.h). A snapshot which was not complete when the power was lost is dropped.
+   NB : It must be called before appendRegistryLog() and compactRegistryLog(), loadRegistryLog() calls it.
+*/
+bool mountRegistryLog() {
+  registryLogRecords = -1;
+  registryLogDirty = false;
+  registryLogUnsaved = -1;
+  if (!LittleFS.begin(true))
+    return false;
+  registryLogRecords = 0;
+  if (LittleFS.exists(REGISTRY_LOG_TMP_PATH))
+    LittleFS.remove(REGISTRY_LOG_TMP_PATH);
+  return true;
+}
+
+/* ---- Procedure for loading the registry at the boot ---- */
+/*
+   INPUT : the registry to fill (structBuoyRegistry).
+   OUTPUT : true if a valid file has been read (bool).
+   DESCRITPION : The program reads the snapshot, then the records until the end of the file or until an incomplete or corrupted record.
+   If the snapshot is corrupted, the registry stays empty. If the last records are lost, or if there are too many of them, the file is compacted.
+   NB : It mounts the file system (see mountRegistryLog()).
+*/
+bool loadRegistryLog(structBuoyRegistry *registry) {
+  initRegistry(registry);
+  if (!mountRegistryLog())
+    return false;
+  File file = LittleFS.open(REGISTRY_LOG_PATH, FILE_READ);
+  if (!file)
+    return false;
+  size_t fileSize = file.size();
+
+  /*the snapshot is read by chunks, the buoys take the IDs 0 to count - 1.*/
+  structRegistryLogHeader header;
+  if ((file.read((uint8_t *)&header, sizeof(header)) != sizeof(header)) || (header.magic != REGISTRY_LOG_MAGIC)
+      || (header.version != REGISTRY_LOG_VERSION) || (header.count > BUOY_MAX))
+    return false;
+  uint16_t crc = registryChecksum(0xFFFF, (const uint8_t *)&header, sizeof(header));
+  uint8_t chunk[6 * REGISTRY_LOG_CHUNK];
+  bool valid = true;
+  for (int first = 0; valid && (first < header.count); first += REGISTRY_LOG_CHUNK) {
+    int n = (header.count - first < REGISTRY_LOG_CHUNK) ? header.count - first : REGISTRY_LOG_CHUNK;
+    valid = (file.read(chunk, 6 * n) == (size_t)(6 * n));
+    crc = registryChecksum(crc, chunk, 6 * n);
+    for (int i = 0; valid && (i < n); i++)
+      valid = (addNewBuoy(registry, macAddressToKey(&chunk[6 * i])) == first + i);
+  }
+  uint16_t savedCrc;
+  if (!valid || (file.read((uint8_t *)&savedCrc, sizeof(savedCrc)) != sizeof(savedCrc)) || (savedCrc != crc)) {
+    initRegistry(registry);
+    return false;
+  }
+
+  /*then the records, each one must give the next ID.*/
+  structRegistryLogRecord record;
+  size_t validSize = file.position();
+  while (file.read((uint8_t *)&record, sizeof(record)) == sizeof(record)) {
+    if ((record.checksum != registryChecksum(0xFFFF, (const uint8_t *)&record, offsetof(structRegistryLogRecord, checksum)))
+        || (record.buoyID != registry->count) || (addNewBuoy(registry, macAddressToKey(record.macAddress)) != record.buoyID))
+      break;
+    registryLogRecords++;
+    validSize += sizeof(record);
+  }
+  file.close();
+  if ((validSize != fileSize) || (registryLogRecords >= REGISTRY_LOG_COMPACT_RECORDS))
+    compactRegistryLog(registry);
+  return true;
+}
+
+/* ---- Procedure for saving a new buoy ---- */
+/*
+   INPUT : the registry (structBuoyRegistry), the ID of the buoy just added (int).
+   OUTPUT : true if the buoy is saved in the flash (bool).
+   DESCRITPION : The buoy is appended as a record, or the file is compacted once REGISTRY_LOG_COMPACT_RECORDS records have been appended.
+   It must be called before the ID is sent to the buoy, so that a master which reboots never gives this ID to another buoy.
+   While a compaction is pending (see claimRegistryLog()), or after a buoy which could not be saved, the records would not give the next
+   IDs : the registry is compacted at once instead. A buoy which is still not saved is kept in registryLogUnsaved, its ID is not sent
+   (see registryLogSaved()) and the compaction is tried again by serviceRegistryLog().
+*/
+bool appendRegistryLog(const structBuoyRegistry *registry, int buoyID) {
+  if (registryLogRecords < 0)
+    return false;
+  bool saved;
+  if (registryLogDirty || (registryLogUnsaved != -1) || (registryLogRecords >= REGISTRY_LOG_COMPACT_RECORDS)) {
+    saved = compactRegistryLog(registry);
+  } else {
+    structRegistryLogRecord record;
+    record.buoyID = buoyID;
+    keyToMacAddress(record.macAddress, registry->macAddresses[buoyID]);
+    record.checksum = registryChecksum(0xFFFF, (const uint8_t *)&record, offsetof(structRegistryLogRecord, checksum));
+    File file = LittleFS.open(REGISTRY_LOG_PATH, FILE_APPEND);
+    bool written = file && (file.write((const uint8_t *)&record, sizeof(record)) == sizeof(record));
+    if (file)
+      file.close();
+    if (written)
+      registryLogRecords++;
+    /*a record which is not completely written would hide the next ones, the file is rewritten.*/
+    saved = written || compactRegistryLog(registry);
+  }
+  if (!saved) {
+    if ((registryLogUnsaved == -1) || (buoyID < registryLogUnsaved))
+      registryLogUnsaved = buoyID;
+    registryLogDirty = true;
+    registryLogChangedAt = millis();
+  }
+  return saved;
+}
+
+/* ---- Procedure for checking that the ID of a buoy may be sent ---- */
+/*
+   INPUT : the registry (structBuoyRegistry), the ID of the buoy (int).
+   OUTPUT : true if the ID may be sent (bool) : it is saved in the flash, or the flash is not available.
+   DESCRITPION : A new buoy which could not be saved asks its ID again, the registry is then compacted before its ID is sent.
+*/
+bool registryLogSaved(const structBuoyRegistry *registry, int buoyID) {
+  if ((registryLogUnsaved == -1) || (buoyID < registryLogUnsaved))
+    return true;
+  return compactRegistryLog(registry);
+}
+
+/* ---- Procedure for saving a buoy which has claimed its ID ---- */
+/*
+   INPUT : the registry (structBuoyRegistry), the number of buoys before the claim (int), the ID of the buoy (int).
+   OUTPUT : true if the buoy is saved in the flash (bool).
+   DESCRITPION : After a failover, the slaves claim their IDs in any order (see failover.h). A buoy which takes the next ID is appended as a record.
+   A buoy which fills a hole or adds holes can't be appended : the registry will be compacted by serviceRegistryLog() once the claims stop,
+   instead of once per claim.
+   NB : The buoy keeps the ID it already had, so it can be sent before it is saved.
+*/
+bool claimRegistryLog(const structBuoyRegistry *registry, int count, int buoyID) {
+  if ((buoyID == count) && (count + 1 == registry->count))
+    return appendRegistryLog(registry, buoyID);
+  registryLogDirty = (registryLogRecords >= 0);
+  registryLogChangedAt = millis();
+  return false;
+}
+
+/* ---- Procedure for saving the claimed IDs ---- */
+/*
+   DESCRITPION : It must be called regularly by the master, the registry is compacted REGISTRY_LOG_CLAIM_MS milliseconds after the last claim
+   which could not be appended.
+*/
+void serviceRegistryLog(const structBuoyRegistry *registry) {
+  if (registryLogDirty && (millis() - registryLogChangedAt >= REGISTRY_LOG_CLAIM_MS) && !compactRegistryLog(registry))
+    registryLogChangedAt = millis();
+}
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+/* ---- Declaration of librairies ---- */
+#include <Arduino.h>
+#include <stdint.h>
+#include <string.h>
+#include "message.h"
+#include "buoyRegistry.h"
+#include "moduleStats.h"
+
+/* ---- Declaration of constants ---- */
+/*
+    The relay of the messages uses the following constants :
+    - RELAY_MODE, the slaves relay the messages of the buoys which do not hear the master (1), or every buoy must hear the master (0).
+    - RELAY_HOPS_MAX, the maximum number of hops between a buoy and the master. A message which has done more hops is dropped.
+    - RELAY_ROUTES, the number of neighbours kept in the routing table of a slave.
+    - RELAY_ROUTE_TIMEOUT_MS, the time after which a neighbour which has not been heard is no longer a next hop.
+    - RELAY_SEEN, the number of messages relayed remembered to drop their duplicates. It must be a power of 2.
+    - RELAY_HEADER_LENGTH, the length of the header of a RELAY message before the path, and RELAY_DOWN, the flag of the messages sent by the master.
+*/
+#ifndef RELAY_MODE
+#define RELAY_MODE 0
+#endif
+#ifndef RELAY_HOPS_MAX
+#define RELAY_HOPS_MAX 16
+#endif
+#define RELAY_ROUTES 8
+#define RELAY_ROUTE_TIMEOUT_MS 5000
+#define RELAY_SEEN 32
+#define RELAY_HEADER_LENGTH 4
+#define RELAY_DOWN 0x80
+
+static_assert((RELAY_HOPS_MAX >= 2) && (RELAY_HOPS_MAX <= 64), "RELAY_HOPS_MAX must be between 2 and 64");
+static_assert((RELAY_SEEN & (RELAY_SEEN - 1)) == 0, "RELAY_SEEN must be a power of 2");
+
+/* ---- Definition of the relay ---- */
+/*
+   In relay mode, a buoy which does not hear the master joins through a slave which does, or which joined the same way. The messages
+   between this buoy and the master are then relayed by the slaves, hop by hop :
+   - upstream, the buoy sends its ID_REQUEST and DATA messages to its next hop as if it were the master. The next hop wraps them in a RELAY
+     message, which every relay passes to its own next hop until the master.
+   - downstream, the master wraps the ID_REPLY and DATA_ACK messages to a relayed buoy in a RELAY message which carries the IDs of the
+     relays on the path, read in the registry. Every relay passes it to the next one, the last one sends the message relayed to the buoy.
+   The payload of a RELAY message is : the direction and the number of relays left on the path (1 byte, RELAY_DOWN for downstream), the
+   number of hops done, the current one included (1 byte), the ID of the board which wrapped the message (its origin, 2 bytes), the IDs of
+   the relays left (2 bytes each), then the message relayed. Its sequence is the one given by its origin and is kept by every relay :
+   the origin and the sequence identify the duplicates, which are dropped.
+   Upstream, a RELAY message is sent to the MAC address of the next hop and its receiverID is 0 (the master). Downstream, it is sent to the
+   broadcast address and its receiverID is the next relay.
+
+   The routes are learnt from the BEACON (see tdma.h) : a slave sends again the first copy of every BEACON with its own number of hops,
+   and keeps the neighbours it hears in a small routing table. Its next hop is the neighbour with the fewest hops to the master.
+   During the join, a slave answers a MASTER_DETECTION with its MAC address and its number of hops, the buoy joins through the first answer.
+   The master records the origin and the hops of every message relayed in the registry (setBuoyPath()), which gives the path to every buoy.
+
+   - relayHops, the number of hops of the board to the master (0 for the master, -1 if it is unknown).
+   - relayParentAddress, the MAC address of the next hop of the board.
+   - relayRoutes, the routing table : the neighbours heard (hops is -1 if the place is free), their hops and the time they were last heard.
+   - relaySeen, the origins and sequences of the last messages relayed.
+   - relayDetectionHeard, a board without role has heard the MASTER_DETECTION of another board.
+   - relayOrigin and relayPathHops, the origin and the hops of the message handled by the master (0 and 1 if it was not relayed).
+   - relayRegistry, the registry of the master, which gives the path of the messages sent downstream (NULL on a slave).
+   - relayStats, the counters of the relay (see moduleStats.h).
+*/
+typedef struct structRelayRoute {
+  uint8_t address[6];
+  int8_t hops;
+  unsigned long heardAt;
+} structRelayRoute;
+
+int relayHops = -1;
+uint8_t relayParentAddress[6];
+structRelayRoute relayRoutes[RELAY_ROUTES];
+uint32_t relaySeen[RELAY_SEEN];
+uint32_t relaySeenHead = 0;
+bool relayDetectionHeard = false;
+int relayOrigin = 0;
+int relayPathHops = 1;
+const structBuoyRegistry *relayRegistry = NULL;
+structRelayStats relayStats;
+
+static const uint8_t relayBroadcastAddress[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+/* ---- Procedure for initialising the relay ---- */
+void initRelay() {
+  relayHops = -1;
+  memset(relayParentAddress, 0xFF, 6);
+  for (int i = 0; i < RELAY_ROUTES; i++)
+    relayRoutes[i].hops = -1;
+  memset(relaySeen, 0xFF, sizeof(relaySeen));
+  relaySeenHead = 0;
+  relayOrigin = 0;
+  relayPathHops = 1;
+  relayRegistry = NULL;
+  memset(&relayStats, 0, sizeof(relayStats));
+}
+
+/* ---- Procedure for starting the relay of the master ---- */
+void relayStartMaster(const structBuoyRegistry *registry) {
+  relayHops = 0;
+  relayRegistry = registry;
+}
+
+/* ---- Procedure for detecting a duplicate ---- */
+/*
+   INPUT : the origin (int) and the sequence (uint16_t) of a message relayed.
+   OUTPUT : true if the message has already been seen (bool).
+   DESCRITPION : A new message is remembered in place of the oldest one.
+*/
+bool relayIsDuplicate(int origin, uint16_t sequence) {
+  uint32_t key = ((uint32_t)(uint16_t)origin << 16) | sequence;
+  for (int i = 0; i < RELAY_SEEN; i++) {
+    if (relaySeen[i] == key) {
+      relayStats.duplicates++;
+      return true;
+    }
+  }
+  relaySeen[relaySeenHead++ & (RELAY_SEEN - 1)] = key;
+  return false;
+}
+
+/* ---- Procedure for choosing the next hop ---- */
+/*
+   DESCRITPION : The next hop is the neighbour heard for less than RELAY_ROUTE_TIMEOUT_MS with the fewest hops. The current next hop is kept
+   if it is as good as the best one, so that the route does not change at every BEACON. Without any neighbour, the next hop is kept.
+*/
+void relayChooseParent() {
+  unsigned long now = millis();
+  int best = -1;
+  for (int i = 0; i < RELAY_ROUTES; i++) {
+    const structRelayRoute *route = &relayRoutes[i];
+    if ((route->hops < 0) || (route->hops >= RELAY_HOPS_MAX) || (now - route->heardAt > RELAY_ROUTE_TIMEOUT_MS))
+      continue;
+    if ((best == -1) || (route->hops < relayRoutes[best].hops)
+        || ((route->hops == relayRoutes[best].hops) && !memcmp(route->address, relayParentAddress, 6)))
+      best = i;
+  }
+  if (best == -1)
+    return;
+  if (memcmp(relayRoutes[best].address, relayParentAddress, 6)) {
+    memcpy(relayParentAddress, relayRoutes[best].address, 6);
+    relayStats.parentChanges++;
+  }
+  relayHops = relayRoutes[best].hops + 1;
+}
+
+/* ---- Procedure for recording a neighbour ---- */
+/*
+   INPUT : the MAC address of the neighbour (table of uint8_t), its number of hops to the master (int).
+   OUTPUT : nothing (void).
+   DESCRITPION : The neighbour is updated in the routing table, or takes a free place, or the place of the neighbour which has the most hops
+   if it has fewer. Then the next hop is chosen again.
+*/
+void relayHeard(const uint8_t address[], int hops) {
+  unsigned long now = millis();
+  structRelayRoute *route = NULL;
+  for (int i = 0; (i < RELAY_ROUTES) && (route == NULL); i++)
+    if ((relayRoutes[i].hops >= 0) && !memcmp(relayRoutes[i].address, address, 6))
+      route = &relayRoutes[i];
+  for (int i = 0; (i < RELAY_ROUTES) && (route == NULL); i++)
+    if ((relayRoutes[i].hops < 0) || (now - relayRoutes[i].heardAt > RELAY_ROUTE_TIMEOUT_MS))
+      route = &relayRoutes[i];
+  if (route == NULL) {
+    route = &relayRoutes[0];
+    for (int i = 1; i < RELAY_ROUTES; i++)
+      if (relayRoutes[i].hops > route->hops)
+        route = &relayRoutes[i];
+    if (route->hops <= hops)
+      return;
+  }
+  memcpy(route->address, address, 6);
+  route->hops = hops;
+  route->heardAt = now;
+  relayChooseParent();
+}
+
+/* ---- Procedure for receiving a BEACON (slave) ---- */
+/*
+   INPUT : the MAC address of the sender (table of uint8_t), the BEACON (structMessage) and its length (int).
+   OUTPUT : true if it is the first copy of this BEACON (bool).
+   DESCRITPION : The last byte of a BEACON is the number of hops of its sender to the master (0 for the master itself).
+   Every copy updates the routing table, only the first one is used to align the time slots and sent again.
+*/
+bool relayHeardBeacon(const uint8_t address[], const structMessage *msg, int len) {
+  if (len <= (int)MESSAGE_HEADER_LENGTH)
+    return false;
+  relayHeard(address, ((const uint8_t *)msg)[len - 1]);
+  return !relayIsDuplicate(0, msg->sequence);
+}
+
+/* ---- Procedure for wrapping a message in a RELAY message ---- */
+/*
+   INPUT : the message (structMessage) and its length (int), the sender and the receiver of the RELAY message (int), the direction (uint8_t),
+   the relays left on the path (table of int16_t) and their number (int), the hops done (int), the message to fill (structMessage).
+   OUTPUT : the length of the RELAY message, 0 if the message is too long to be wrapped (int).
+*/
+int relayPack(const structMessage *msg, int len, int senderID, int receiverID, uint8_t direction, const int16_t route[], int count, int hops,
+              structMessage *out) {
+  int outLen = MESSAGE_HEADER_LENGTH + RELAY_HEADER_LENGTH + 2 * count + len;
+  if (outLen > MESSAGE_LENGTH_MAX) {
+    relayStats.dropped++;
+    return 0;
+  }
+  prepareMessage(out, RELAY, senderID, receiverID);
+  out->payload[0] = direction | count;
+  out->payload[1] = hops;
+  int16_t origin = senderID;
+  memcpy(&out->payload[2], &origin, sizeof(origin));
+  memcpy(&out->payload[RELAY_HEADER_LENGTH], route, 2 * count);
+  memcpy(&out->payload[RELAY_HEADER_LENGTH + 2 * count], msg, len);
+  relayIsDuplicate(senderID, out->sequence);
+  relayStats.wrapped++;
+  return outLen;
+}
+
+/* ---- Procedure for relaying a message to the master (slave) ---- */
+/*
+   INPUT : the message sent to the board by a buoy for the master (structMessage) and its length (int), the ID of the board (int),
+   the message to fill (structMessage).
+   OUTPUT : the length of the RELAY message to send to relayParentAddress, 0 if the board has no route (int).
+   DESCRITPION : The message has done one hop to the board, the RELAY message does the second one.
+*/
+int relayWrapUp(const structMessage *msg, int len, int myID, structMessage *out) {
+  if (relayHops <= 0) {
+    relayStats.dropped++;
+    return 0;
+  }
+  return relayPack(msg, len, myID, 0, 0, NULL, 0, 2, out);
+}
+
+/* ---- Procedure for relaying a message to a buoy (master) ---- */
+/*
+   INPUT : the message sent by the master (structMessage) and its length (int), the message to fill (structMessage).
+   OUTPUT : the length of the RELAY message to send to the broadcast address, 0 if the message is sent as it is (int).
+   DESCRITPION : The buoy is the receiver of the message, or the buoy whose ID is given in an ID_REPLY. If the registry has a path of one relay
+   at least to this buoy, the message is wrapped for the first relay.
+   NB : It is called by sendTicket() (see reliable.h) for every message sent by the board.
+*/
+int relayOutgoing(const structMessage *msg, int len, structMessage *out) {
+  if (!RELAY_MODE || (relayRegistry == NULL) || (msg->typeMessage == RELAY))
+    return 0;
+  int buoyID = (msg->typeMessage == ID_REPLY) ? getID(msg, MESSAGE_HEADER_LENGTH + 6) : msg->receiverID;
+  int16_t route[RELAY_HOPS_MAX];
+  int count = getBuoyRoute(relayRegistry, buoyID, route, RELAY_HOPS_MAX - 1);
+  if (count <= 0)
+    return 0;
+  return relayPack(msg, len, 0, route[0], RELAY_DOWN, &route[1], count - 1, 1, out);
+}
+
+/* ---- Procedure for reading the header of a RELAY message ---- */
+/*
+   INPUT : the RELAY message (structMessage) and its length (int).
+   OUTPUT : the offset of the message relayed in the payload, 0 if the RELAY message is not valid, a duplicate or has done too many hops (int).
+*/
+int relayCheck(const structMessage *msg, int len) {
+  int offset = RELAY_HEADER_LENGTH + 2 * (msg->payload[0] & ~RELAY_DOWN);
+  if (len < (int)MESSAGE_HEADER_LENGTH + offset + (int)MESSAGE_HEADER_LENGTH)
+    return 0;
+  if (relayIsDuplicate(getID(msg, MESSAGE_HEADER_LENGTH + 2), msg->sequence))
+    return 0;
+  if (msg->payload[1] >= RELAY_HOPS_MAX) {
+    relayStats.dropped++;
+    return 0;
+  }
+  return offset;
+}
+
+/* ---- Procedure for passing a RELAY message to the next hop (slave) ---- */
+/*
+   INPUT : the RELAY message received (structMessage) and its length (int), the ID of the board (int), the message to fill (structMessage)
+   and the address to send it to.
+   OUTPUT : the length of the message to send, 0 if there is none (int).
+   DESCRITPION : Upstream, the RELAY message is sent to the next hop of the board. Downstream, the board removes itself from the path
+   and sends the RELAY message to the next relay, or, if it is the last relay, sends the message relayed to the buoy.
+*/
+int relayForward(const structMessage *msg, int len, int myID, structMessage *out, const uint8_t **address) {
+  bool down = msg->payload[0] & RELAY_DOWN;
+  if ((down && (msg->receiverID != myID)) || (len <= (int)MESSAGE_HEADER_LENGTH + RELAY_HEADER_LENGTH))
+    return 0;
+  int offset = relayCheck(msg, len);
+  if (offset == 0)
+    return 0;
+  if (!down) {
+    if (relayHops <= 0) {
+      relayStats.dropped++;
+      return 0;
+    }
+    memcpy(out, msg, len);
+    out->senderID = myID;
+    out->payload[1]++;
+    *address = relayParentAddress;
+    relayStats.forwarded++;
+    return len;
+  }
+  *address = relayBroadcastAddress;
+  relayStats.forwarded++;
+  /*the last relay sends the message relayed itself.*/
+  if (offset == RELAY_HEADER_LENGTH) {
+    memcpy(out, &msg->payload[offset], len - MESSAGE_HEADER_LENGTH - offset);
+    return len - MESSAGE_HEADER_LENGTH - offset;
+  }
+  /*else the next relay is removed from the path and becomes the receiver.*/
+  memcpy(out, msg, MESSAGE_HEADER_LENGTH + RELAY_HEADER_LENGTH);
+  out->senderID = myID;
+  out->receiverID = getID(msg, MESSAGE_HEADER_LENGTH + RELAY_HEADER_LENGTH);
+  out->payload[0]--;
+  out->payload[1]++;
+  memcpy(&out->payload[RELAY_HEADER_LENGTH], &msg->payload[RELAY_HEADER_LENGTH + 2], len - MESSAGE_HEADER_LENGTH - RELAY_HEADER_LENGTH - 2);
+  return len - 2;
+}
+
+/* ---- Procedure for unwrapping a RELAY message (master) ---- */
+/*
+   INPUT : the RELAY message received (structMessage) and its length (int), the message to fill (structMessage).
+   OUTPUT : the length of the message relayed, 0 if there is none (int).
+   DESCRITPION : The origin and the hops of the message are kept in relayOrigin and relayPathHops while the master handles it.
+*/
+int relayUnwrap(const structMessage *msg, int len, structMessage *out) {
+  if ((msg->payload[0] & RELAY_DOWN) || (len <= (int)MESSAGE_HEADER_LENGTH + RELAY_HEADER_LENGTH))
+    return 0;
+  int offset = relayCheck(msg, len);
+  if ((offset == 0) || (msg->payload[offset + 1] == RELAY))
+    return 0;
+  relayOrigin = getID(msg, MESSAGE_HEADER_LENGTH + 2);
+  relayPathHops = msg->payload[1];
+  memcpy(out, &msg->payload[offset], len - MESSAGE_HEADER_LENGTH - offset);
+  return len - MESSAGE_HEADER_LENGTH - offset;
+}
+
+#endif
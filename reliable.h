@@ -0,0 +1,453 @@
+#ifndef RELIABLE_H
+#define RELIABLE_H
+
+/* ---- Declaration of librairies ---- */
+#include <Arduino.h>
+#include <esp_now.h>
+#include <stdint.h>
+#include <string.h>
+#include "message.h"
+#include "buoyRegistry.h"
+#include "trace.h"
+#include "tdma.h"
+#include "relay.h"
+#include "peerCache.h"
+#include "metrics.h"
+#include "moduleStats.h"
+
+/* ---- Declaration of constants ---- */
+/*
+    The reliable delivery of the DATA messages uses the following constants :
+    - RELIABLE_WINDOW, the number of DATA messages sent and not acknowledged yet (in flight), all peers together (at most 32).
+    - RELIABLE_RTO_MS, the time after which a DATA message without DATA_ACK is sent again. It doubles at every retransmission, up to 8 times RELIABLE_RTO_MS.
+    - RELIABLE_RETRIES_MAX, the number of retransmissions of a DATA message before it is given up. With 0, a message is sent only once.
+    - RELIABLE_PEERS, the number of peers, a peer being the ID of a buoy (the master is the peer 0).
+    - RELIABLE_ACK_QUEUE, the number of peers whose DATA_ACK can wait for the next call of reliableService().
+    - RELIABLE_TICKETS, the number of messages sent whose OnDataSent callback can be awaited. It must be a power of 2 and more than the
+      number of messages the ESP-NOW driver can hold.
+    The duplicates are detected in a window of 32 sequence numbers, the size of the bitmap of a DATA_ACK.
+*/
+#ifndef RELIABLE_WINDOW
+#define RELIABLE_WINDOW 4
+#endif
+#ifndef RELIABLE_RTO_MS
+#define RELIABLE_RTO_MS 40
+#endif
+#ifndef RELIABLE_RETRIES_MAX
+#define RELIABLE_RETRIES_MAX 6
+#endif
+#define RELIABLE_PEERS BUOY_MAX
+#define RELIABLE_ACK_QUEUE 8
+#define RELIABLE_TICKETS 32
+
+static_assert((RELIABLE_WINDOW > 0) && (RELIABLE_WINDOW <= 32), "RELIABLE_WINDOW must be between 1 and 32");
+static_assert((RELIABLE_TICKETS & (RELIABLE_TICKETS - 1)) == 0, "RELIABLE_TICKETS must be a power of 2");
+
+/* ---- Definition of the reliable delivery ---- */
+/*
+   A DATA message carries the sequence number of its sender for this peer. The receiver answers with a DATA_ACK which carries
+   the next sequence number it waits for (2 bytes) and a bitmap of the 32 next ones already received (4 bytes), so that one DATA_ACK
+   acknowledges several messages and the sender only sends again the ones which are missing (selective retransmission).
+   The receiver gives a DATA message to the application only once : a sequence number already received is a duplicate, which is
+   acknowledged again but not handled. A sequence number outside of the 32 numbers around the expected one means that the sender has
+   rebooted, the receiver starts again from it.
+   A DATA message is sent again :
+   - at once, if OnDataSent reports that its receiver has not acknowledged the frame (unicast only, after the retries of the WiFi).
+   - after RELIABLE_RTO_MS milliseconds without DATA_ACK : the frame was acknowledged by the WiFi but lost by the receive queue
+     of the receiver, or the DATA_ACK was lost.
+   The receiver of a message which is not an ESP-NOW peer of the board (the master only keeps the buoys heard recently as peers, see
+   peerCache.h) is reached on the broadcast address, its ID in the header selects it : these frames have no WiFi acknowledgement, only the DATA_ACK.
+   A DATA message to send or to send again is marked as due, and sent once the slot of the board allows it (see tdma.h), unless the
+   messages are held : a slave whose master is silent keeps them until the master or its successor answers (see failover.h).
+
+   Every message of the board is sent with sendMessage(), which keeps the order of the messages sent (tickets) : the n-th call of
+   OnDataSent reports the n-th message sent, the WiFi task writes its status and the address of the receiver in a queue read by the
+   main task. This assumes exactly one call of OnDataSent per message accepted by esp_now_send(), in the order of the messages, so a
+   status is matched with the oldest ticket sent to its address :
+   - the tickets before it, sent to other addresses, have lost their callback. They are skipped, a DATA message among them is sent again
+     by its RTO.
+   - a status without ticket to its address is a late callback whose ticket was dropped : it is ignored.
+   - the frames to the broadcast address cannot be told apart, a lost callback among them gives their statuses to the next ones. These
+     statuses are always a success (a broadcast frame is not acknowledged), so no DATA message is sent again for nothing.
+   Once RELIABLE_TICKETS callbacks are awaited, more than the driver can hold, one of them has been lost : the oldest ticket is dropped.
+   The tickets skipped or dropped and the statuses ignored are counted in the metrics, the retransmissions can be checked against them.
+   - reliableSlots, the DATA messages in flight, with their peer (-1 if the slot is free), their number of transmissions, the time
+     of the last one and whether they are due.
+   - reliablePeers, per peer : the next sequence number to send, and the next sequence number expected with the bitmap of the next ones.
+   - reliableStats, the counters of the reliable delivery (see moduleStats.h).
+     rttSamples and rttSumUs give the mean round-trip time of the DATA messages acknowledged at their first transmission.
+   - reliableHeld, the DATA messages due are not sent while it is set.
+*/
+typedef struct structReliableSlot {
+  structMessage msg;
+  int len;
+  uint8_t address[6];
+  int16_t peer;
+  uint8_t transmissions;
+  bool due;
+  unsigned long sentAt;
+  uint32_t sentAtUs;
+} structReliableSlot;
+
+typedef struct structReliablePeer {
+  uint16_t txNext;
+  uint16_t rxNext;
+  uint32_t rxMask;
+  bool txStarted;
+  bool rxStarted;
+  bool ackPending;
+} structReliablePeer;
+
+typedef struct structReliableAck {
+  int16_t peer;
+  uint8_t address[6];
+} structReliableAck;
+
+structReliableSlot reliableSlots[RELIABLE_WINDOW];
+structReliablePeer reliablePeers[RELIABLE_PEERS];
+structReliableStats reliableStats;
+structReliableAck reliableAcks[RELIABLE_ACK_QUEUE];
+int reliableAckCount = 0;
+int reliableInFlight = 0;
+bool reliableHeld = false;
+
+/* the tickets of the messages sent with the key of their receiver, written by the main task, and their status, written by OnDataSent (WiFi task) */
+int16_t sendTickets[RELIABLE_TICKETS];
+uint64_t sendTicketKeys[RELIABLE_TICKETS];
+uint32_t sendTicketHead = 0;
+uint32_t sendTicketTail = 0;
+uint8_t sendStatuses[RELIABLE_TICKETS];
+uint64_t sendStatusKeys[RELIABLE_TICKETS];
+uint32_t sendStatusHead = 0;
+uint32_t sendStatusTail = 0;
+
+/* ---- Procedure for initialising the reliable delivery ---- */
+void initReliable() {
+  memset(reliableSlots, 0, sizeof(reliableSlots));
+  for (int i = 0; i < RELIABLE_WINDOW; i++)
+    reliableSlots[i].peer = -1;
+  memset(reliablePeers, 0, sizeof(reliablePeers));
+  memset(&reliableStats, 0, sizeof(reliableStats));
+  reliableAckCount = 0;
+  reliableInFlight = 0;
+}
+
+/* ---- Procedure for sending a message ---- */
+/*
+   INPUT : the address of the receiver (table of uint8_t), the message (structMessage) and its length (int), the ticket (int) :
+   a DATA message in flight (see transmitSlot), -1 for the other messages.
+   OUTPUT : the result of esp_now_send() (esp_err_t).
+   DESCRITPION : The message is sent and its ticket is kept until its OnDataSent callback. If the tickets are full while statuses wait for
+   reliableService(), the message is not sent and ESP_ERR_ESPNOW_NO_MEM is returned, as when the queue of the ESP-NOW driver is full.
+   If they are full without status waiting, a callback has been lost and the oldest ticket is dropped.
+   The frames sent are counted per opcode, and the frames refused (see metrics.h).
+   In relay mode, a message of the master to a buoy which does not hear it is wrapped in a RELAY message (see relay.h).
+*/
+esp_err_t sendTicket(const uint8_t *address, const structMessage *msg, int len, int ticket) {
+  if (sendTicketHead - sendTicketTail >= RELIABLE_TICKETS) {
+    if (__atomic_load_n(&sendStatusHead, __ATOMIC_ACQUIRE) != sendStatusTail) {
+      metricsCount(METRIC_SEND_ERRORS);
+      return ESP_ERR_ESPNOW_NO_MEM;
+    }
+    sendTicketTail++;
+    metricsCount(METRIC_SEND_STATUS_LOST);
+  }
+  structMessage relayed;
+  int relayedLen = relayOutgoing(msg, len, &relayed);
+  if (relayedLen > 0) {
+    address = relayBroadcastAddress;
+    msg = &relayed;
+    len = relayedLen;
+  }
+  esp_err_t result = esp_now_send(address, (const uint8_t *) msg, len);
+  TRACE(TRACE_SEND, msg->typeMessage, len, result);
+  if (result != ESP_OK) {
+    metricsCount(METRIC_SEND_ERRORS);
+    return result;
+  }
+  sendTickets[sendTicketHead & (RELIABLE_TICKETS - 1)] = ticket;
+  sendTicketKeys[sendTicketHead++ & (RELIABLE_TICKETS - 1)] = macAddressToKey(address);
+  metricsSent(msg->typeMessage);
+  return result;
+}
+
+esp_err_t sendMessage(const uint8_t *address, const structMessage *msg, int len) {
+  return sendTicket(address, msg, len, -1);
+}
+
+/* ---- Procedure for recording the status of a message sent (OnDataSent, WiFi task) ---- */
+void reliableSendStatus(const uint8_t *address, esp_now_send_status_t status) {
+  uint32_t head = sendStatusHead;
+  /*a callback without message sent (the ring is full) cannot be matched, it is ignored.*/
+  if (head - __atomic_load_n(&sendStatusTail, __ATOMIC_ACQUIRE) >= RELIABLE_TICKETS)
+    return;
+  sendStatuses[head & (RELIABLE_TICKETS - 1)] = (status == ESP_NOW_SEND_SUCCESS);
+  sendStatusKeys[head & (RELIABLE_TICKETS - 1)] = macAddressToKey(address);
+  __atomic_store_n(&sendStatusHead, head + 1, __ATOMIC_RELEASE);
+}
+
+/* ---- Procedure for sending a DATA message in flight ---- */
+/*
+   INPUT : the slot of the message (int).
+   OUTPUT : nothing (void).
+   DESCRITPION : The message is sent to its peer, or on the broadcast address if the peer is not an ESP-NOW peer of the board.
+   Its ticket holds its slot and its number of transmissions, so that a late status does not apply to the next message of the slot.
+   If the sending fails, the message is sent again after RELIABLE_RTO_MS.
+   NB : It is only called by transmitDue(), once the slot of the board allows it.
+*/
+void transmitSlot(int i) {
+  structReliableSlot *slot = &reliableSlots[i];
+  const uint8_t *address = peerCacheAddress(slot->address);
+  if (slot->transmissions++ > 0) {
+    reliableStats.retransmissions++;
+    TRACE(TRACE_RETRANSMIT, slot->peer, slot->msg.sequence, slot->transmissions - 1);
+  } else {
+    reliableStats.sent++;
+  }
+  slot->due = false;
+  slot->sentAt = millis();
+  slot->sentAtUs = micros();
+  sendTicket(address, &slot->msg, slot->len, i | (slot->transmissions << 8));
+}
+
+/* ---- Procedure for sending the DATA messages due ---- */
+/*
+   DESCRITPION : The DATA messages due are sent in the order of the window as long as the slot of the board allows it (tdmaMayTransmit()).
+*/
+void transmitDue() {
+  if (reliableHeld)
+    return;
+  for (int i = 0; i < RELIABLE_WINDOW; i++) {
+    if ((reliableSlots[i].peer == -1) || !reliableSlots[i].due)
+      continue;
+    if (!tdmaMayTransmit())
+      return;
+    transmitSlot(i);
+  }
+}
+
+/* ---- Procedure for freeing a slot ---- */
+void releaseSlot(int i) {
+  reliableSlots[i].peer = -1;
+  reliableInFlight--;
+}
+
+/* ---- Procedure for sending a DATA message ---- */
+/*
+   INPUT : the ID of the board (int), the ID of the peer (int), its MAC address (table of uint8_t), the data (table of uint8_t) and its length (int).
+   OUTPUT : true if the message has been taken, false if the window is full (bool).
+   DESCRITPION : The message takes a free slot of the window and the next sequence number of the peer, and is sent at once if the slot of
+   the board allows it, else at a next call of reliableService().
+   If the window is full, the application keeps its data and tries again later.
+   NB : The first sequence number of a peer is random, so that the peer sees that the board has rebooted.
+*/
+bool reliableSend(int senderID, int peer, const uint8_t address[], const uint8_t *data, int len) {
+  if ((peer < 0) || (peer >= RELIABLE_PEERS) || (len < 0) || (len > (int)(sizeof(structMessage) - MESSAGE_HEADER_LENGTH)))
+    return false;
+  int i = 0;
+  while ((i < RELIABLE_WINDOW) && (reliableSlots[i].peer != -1))
+    i++;
+  if (i == RELIABLE_WINDOW) {
+    reliableStats.windowFull++;
+    return false;
+  }
+  structReliablePeer *state = &reliablePeers[peer];
+  if (!state->txStarted) {
+    state->txNext = random(0, 65536);
+    state->txStarted = true;
+  }
+  structReliableSlot *slot = &reliableSlots[i];
+  slot->len = prepareMessage(&slot->msg, DATA, senderID, peer);
+  slot->msg.sequence = state->txNext++;
+  memcpy(slot->msg.payload, data, len);
+  slot->len += len;
+  memcpy(slot->address, address, 6);
+  slot->peer = peer;
+  slot->transmissions = 0;
+  slot->due = true;
+  reliableInFlight++;
+  transmitDue();
+  return true;
+}
+
+/* ---- Procedure for acknowledging the DATA messages of a peer ---- */
+/*
+   INPUT : the ID of the board (int), the ID of the peer (int), its MAC address (table of uint8_t).
+   OUTPUT : nothing (void).
+   DESCRITPION : The DATA_ACK is not sent at once : the peer is added to the queue of the acknowledgements, sent by reliableService(),
+   so that the DATA messages of a peer handled together get only one DATA_ACK. If the queue is full, the oldest one is sent first.
+*/
+void sendDataAck(int senderID, const structReliableAck *ack) {
+  structReliablePeer *state = &reliablePeers[ack->peer];
+  structMessage msg;
+  int len = prepareMessage(&msg, DATA_ACK, senderID, ack->peer);
+  memcpy((uint8_t *)&msg + len, &state->rxNext, sizeof(state->rxNext));
+  len += sizeof(state->rxNext);
+  memcpy((uint8_t *)&msg + len, &state->rxMask, sizeof(state->rxMask));
+  len += sizeof(state->rxMask);
+  state->ackPending = false;
+  reliableStats.acks++;
+  sendMessage(peerCacheAddress(ack->address), &msg, len);
+}
+
+void scheduleDataAck(int senderID, int peer, const uint8_t address[]) {
+  if (reliablePeers[peer].ackPending)
+    return;
+  if (reliableAckCount == RELIABLE_ACK_QUEUE) {
+    sendDataAck(senderID, &reliableAcks[0]);
+    memmove(&reliableAcks[0], &reliableAcks[1], (RELIABLE_ACK_QUEUE - 1) * sizeof(structReliableAck));
+    reliableAckCount--;
+  }
+  reliableAcks[reliableAckCount].peer = peer;
+  memcpy(reliableAcks[reliableAckCount].address, address, 6);
+  reliableAckCount++;
+  reliablePeers[peer].ackPending = true;
+}
+
+/* ---- Procedure for receiving a DATA message ---- */
+/*
+   INPUT : the MAC address of the sender (table of uint8_t), the message (structMessage) and its length (int).
+   OUTPUT : true if the message is new and must be handled by the application, false if it is a duplicate (bool).
+   DESCRITPION : The sequence number of the message is compared with the next one expected from its sender (d) :
+   - 0 <= d < 32 and not received yet : the message is new, the bitmap keeps it and the expected number moves after the received ones.
+   - -32 <= d < 0, or already in the bitmap : the message is a duplicate (its DATA_ACK was lost or late).
+   - else, or first message of the peer : the peer has rebooted, the reception starts again from this message.
+   In all cases, a DATA_ACK is scheduled.
+*/
+bool reliableReceive(const uint8_t mac[], const structMessage *msg, int len) {
+  int peer = msg->senderID;
+  if ((peer < 0) || (peer >= RELIABLE_PEERS))
+    return false;
+  structReliablePeer *state = &reliablePeers[peer];
+  int d = (int16_t)(msg->sequence - state->rxNext);
+  if (!state->rxStarted || (d >= 32) || (d < -32)) {
+    state->rxStarted = true;
+    state->rxNext = msg->sequence;
+    state->rxMask = 0;
+    d = 0;
+  } else if ((d < 0) || ((state->rxMask >> d) & 1)) {
+    reliableStats.duplicates++;
+    scheduleDataAck(msg->receiverID, peer, mac);
+    return false;
+  }
+  state->rxMask |= (uint32_t)1 << d;
+  while (state->rxMask & 1) {
+    state->rxMask >>= 1;
+    state->rxNext++;
+  }
+  reliableStats.delivered++;
+  reliableStats.deliveredBytes += len - MESSAGE_HEADER_LENGTH;
+  scheduleDataAck(msg->receiverID, peer, mac);
+  return true;
+}
+
+/* ---- Procedure for receiving a DATA_ACK message ---- */
+/*
+   INPUT : the message (structMessage) and its length (int).
+   OUTPUT : nothing (void).
+   DESCRITPION : Every DATA message in flight to the sender of the DATA_ACK is acknowledged if its sequence number is before the next one expected
+   by the peer, or in its bitmap. Its slot is freed. The other ones stay in flight and will be sent again.
+*/
+void reliableAck(const structMessage *msg, int len) {
+  int peer = msg->senderID;
+  if (len < (int)(MESSAGE_HEADER_LENGTH + sizeof(uint16_t) + sizeof(uint32_t)))
+    return;
+  uint16_t next;
+  uint32_t mask;
+  memcpy(&next, msg->payload, sizeof(next));
+  memcpy(&mask, msg->payload + sizeof(next), sizeof(mask));
+  for (int i = 0; i < RELIABLE_WINDOW; i++) {
+    if (reliableSlots[i].peer != peer)
+      continue;
+    int d = (int16_t)(reliableSlots[i].msg.sequence - next);
+    if ((d < 0) || ((d < 32) && ((mask >> d) & 1))) {
+      reliableStats.acked++;
+      /*the round-trip time of a message sent again is ambiguous, it is not measured.*/
+      if (reliableSlots[i].transmissions == 1) {
+        uint32_t rttUs = micros() - reliableSlots[i].sentAtUs;
+        reliableStats.rttSamples++;
+        reliableStats.rttSumUs += rttUs;
+        metricsObserve(METRIC_DATA_RTT_US, rttUs);
+      }
+      releaseSlot(i);
+    }
+  }
+}
+
+/* ---- Procedure for giving up a DATA message or marking it as due ---- */
+void retransmitSlot(int i) {
+  if (reliableSlots[i].transmissions > RELIABLE_RETRIES_MAX) {
+    reliableStats.failed++;
+    TRACE(TRACE_DATA_FAILED, reliableSlots[i].peer, reliableSlots[i].msg.sequence, reliableSlots[i].transmissions);
+    releaseSlot(i);
+    return;
+  }
+  reliableSlots[i].due = true;
+}
+
+/* ---- Procedure for servicing the reliable delivery ---- */
+/*
+   INPUT : the ID of the board (int).
+   OUTPUT : nothing (void).
+   DESCRITPION : It must be called regularly by the main task (loop()) :
+   - the status of every message sent is matched with its ticket, a DATA message which has not been acknowledged by the WiFi is due again at once.
+     A status without ticket to its address (its ticket was dropped, see sendTicket()) is ignored.
+   - a DATA message without DATA_ACK since its RTO is due again, the RTO doubles at every transmission.
+   - the DATA messages due are sent if the slot of the board allows it.
+   - the DATA_ACK scheduled are sent.
+   NB : Without message in flight nor status nor DATA_ACK waiting, it costs three loads and does not read the clock.
+*/
+void reliableService(int senderID) {
+  uint32_t head = __atomic_load_n(&sendStatusHead, __ATOMIC_ACQUIRE);
+  while (sendStatusTail != head) {
+    bool success = sendStatuses[sendStatusTail & (RELIABLE_TICKETS - 1)];
+    uint64_t key = sendStatusKeys[sendStatusTail & (RELIABLE_TICKETS - 1)];
+    __atomic_store_n(&sendStatusTail, sendStatusTail + 1, __ATOMIC_RELEASE);
+    uint32_t t = sendTicketTail;
+    while ((t != sendTicketHead) && (sendTicketKeys[t & (RELIABLE_TICKETS - 1)] != key))
+      t++;
+    if (t == sendTicketHead) {
+      metricsCount(METRIC_SEND_STATUS_STRAY);
+      continue;
+    }
+    for (; sendTicketTail != t; sendTicketTail++)
+      metricsCount(METRIC_SEND_STATUS_LOST);
+    int ticket = sendTickets[sendTicketTail++ & (RELIABLE_TICKETS - 1)];
+    if ((ticket < 0) || success)
+      continue;
+    int i = ticket & 0xFF;
+    if ((reliableSlots[i].peer != -1) && !reliableSlots[i].due && (reliableSlots[i].transmissions == (ticket >> 8)))
+      retransmitSlot(i);
+  }
+  if (reliableInFlight > 0) {
+    unsigned long now = millis();
+    for (int i = 0; i < RELIABLE_WINDOW; i++) {
+      structReliableSlot *slot = &reliableSlots[i];
+      if ((slot->peer == -1) || slot->due)
+        continue;
+      /*a slot in flight has been sent once at least, its RTO is at most 8 times RELIABLE_RTO_MS.*/
+      int shift = (slot->transmissions > 0) ? ((slot->transmissions < 4) ? slot->transmissions - 1 : 3) : 0;
+      if (now - slot->sentAt >= ((unsigned long)RELIABLE_RTO_MS << shift))
+        retransmitSlot(i);
+    }
+    transmitDue();
+  }
+  for (int i = 0; i < reliableAckCount; i++)
+    sendDataAck(senderID, &reliableAcks[i]);
+  reliableAckCount = 0;
+}
+
+/* ---- Procedure for giving up the DATA messages of a peer ---- */
+/*
+   INPUT : the ID of the peer (int).
+   OUTPUT : nothing (void).
+   DESCRITPION : After a failover the master (the peer 0) is another board (see failover.h) : the DATA messages in flight to the old master
+   are given up. Sent again to the new master, the held messages of the whole fleet would collide with the claims of the IDs.
+*/
+void reliableForget(int peer) {
+  for (int i = 0; i < RELIABLE_WINDOW; i++)
+    if (reliableSlots[i].peer == peer)
+      releaseSlot(i);
+}
+
+#endif
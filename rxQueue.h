@@ -0,0 +1,104 @@
+#ifndef RX_QUEUE_H
+#define RX_QUEUE_H
+
+/* ---- Declaration of librairies ---- */
+#include <stdint.h>
+#include <string.h>
+#include "message.h"
+#include "moduleStats.h"
+
+/* ---- Declaration of constants ---- */
+/*
+    The receive queue uses two constants :
+    - RX_QUEUE_LENGTH, the number of frames the queue can hold. It must be a power of 2.
+    - RX_BATCH_MAX, the maximum number of frames handled by one call of the dispatcher, so that loop() is never blocked too long.
+*/
+#ifndef RX_QUEUE_LENGTH
+#define RX_QUEUE_LENGTH 32
+#endif
+#ifndef RX_BATCH_MAX
+#define RX_BATCH_MAX 8
+#endif
+
+static_assert((RX_QUEUE_LENGTH & (RX_QUEUE_LENGTH - 1)) == 0, "RX_QUEUE_LENGTH must be a power of 2");
+
+/* ---- Definition of the receive queue ---- */
+/*
+   The frames received by OnDataRecv (WiFi task) are handled later by loop() (main task). Between them, the frames wait in a ring buffer
+   with one producer (the WiFi task) and one consumer (the main task), which needs no lock :
+   - head, the number of frames pushed since the boot. Only written by the producer.
+   - tail, the number of frames handled since the boot. Only written by the consumer.
+   The frame n is stored in frames[n % RX_QUEUE_LENGTH]. The queue is full when head - tail == RX_QUEUE_LENGTH.
+   head and tail are written with a release store and read with an acquire load, so that a frame is completely copied before it is seen
+   by the other task (the two tasks can run on the two cores of the ESP32).
+   Every frame keeps the time of its reception (receivedAt, micros()), the time spent in the queue is not seen by the handling.
+   Two counters help to size the queue :
+   - highWater, the maximum number of frames which have been waiting at the same time.
+   - drops, the number of frames lost because the queue was full.
+*/
+typedef struct structRxFrame {
+  uint32_t receivedAt;
+  uint8_t macAddress[6];
+  uint8_t len;
+  uint8_t data[MESSAGE_LENGTH_MAX];
+} structRxFrame;
+
+typedef struct structRxQueue {
+  uint32_t head;
+  uint32_t tail;
+  uint32_t highWater;
+  uint32_t drops;
+  structRxFrame frames[RX_QUEUE_LENGTH];
+} structRxQueue;
+
+/* the simulator reads the beginning of the queue as a structRxQueueCounters (see moduleStats.h) */
+static_assert((offsetof(structRxQueue, head) == offsetof(structRxQueueCounters, head)) &&
+                  (offsetof(structRxQueue, tail) == offsetof(structRxQueueCounters, tail)) &&
+                  (offsetof(structRxQueue, highWater) == offsetof(structRxQueueCounters, highWater)) &&
+                  (offsetof(structRxQueue, drops) == offsetof(structRxQueueCounters, drops)),
+              "structRxQueue must begin with the fields of structRxQueueCounters");
+
+/* ---- Procedure for pushing a frame in the queue (producer) ---- */
+/*
+   INPUT : the queue (structRxQueue), the MAC address of the sender (table of uint8_t), the frame (table of uint8_t), its length (int)
+   and the time of its reception (uint32_t, micros()).
+   OUTPUT : true if the frame has been queued, false if it has been dropped (bool).
+   DESCRITPION : The frame is copied in the next free place and then published by incrementing head.
+*/
+bool rxQueuePush(structRxQueue *queue, const uint8_t macAddress[], const uint8_t *data, int len, uint32_t receivedAt) {
+  uint32_t head = queue->head;
+  uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+  /*if the queue is full or the frame too long...*/
+  if (head - tail == RX_QUEUE_LENGTH || len > MESSAGE_LENGTH_MAX) {
+    /*...then the frame is dropped.*/
+    __atomic_store_n(&queue->drops, queue->drops + 1, __ATOMIC_RELAXED);
+    return false;
+  }
+  structRxFrame *frame = &queue->frames[head & (RX_QUEUE_LENGTH - 1)];
+  frame->receivedAt = receivedAt;
+  memcpy(frame->macAddress, macAddress, 6);
+  frame->len = len;
+  memcpy(frame->data, data, len);
+  __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+  if (head + 1 - tail > queue->highWater)
+    __atomic_store_n(&queue->highWater, head + 1 - tail, __ATOMIC_RELAXED);
+  return true;
+}
+
+/* ---- Procedures for reading the oldest frame of the queue (consumer) ---- */
+/*
+   rxQueuePeek returns the oldest frame of the queue, or NULL if the queue is empty. The frame stays in the queue, so that it is read without any copy.
+   rxQueueRelease gives the place of this frame back to the producer, once it has been handled.
+*/
+const structRxFrame *rxQueuePeek(structRxQueue *queue) {
+  uint32_t tail = queue->tail;
+  if (__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == tail)
+    return NULL;
+  return &queue->frames[tail & (RX_QUEUE_LENGTH - 1)];
+}
+
+void rxQueueRelease(structRxQueue *queue) {
+  __atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELEASE);
+}
+
+#endif
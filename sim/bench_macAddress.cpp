@@ -0,0 +1,153 @@
+/* ---- Benchmark of the MAC address codec ---- */
+/*
+   Compares the conversions between a MAC address and its text, per address :
+   - legacy : modifMacAddress() and macAddressToString() of the first version of the sketch (reproduced below), which build the text
+     from a dozen temporary Strings and decode the digits with "- 55" / "- 48".
+   - codec : formatMacAddress(), formatMacKey() and parseMacAddress() of macAddress.h, with the tables computed at the compilation.
+   Then the codec is checked on 1000000 random MAC addresses : key -> text -> key and bytes -> text -> bytes in upper and lower case,
+   and the invalid texts must be rejected. The legacy decoder is shown to mis-decode the lower case.
+*/
+#include "shim/Arduino.h"
+#include "../buoyRegistry.h"
+#include "../macAddress.h"
+
+#include <chrono>
+#include <ctype.h>
+#include <random>
+#include <vector>
+
+/* ---- Conversions of the first version ---- */
+static void legacyModifMacAddress(uint8_t addressMac[], String stringMacAddress) {
+  int hex1, hex0;
+  for (int i = 0; i < 6; i++) {
+    hex1 = (int)stringMacAddress.charAt(3 * i) > 63 ? (int)stringMacAddress.charAt(3 * i) - 55 : (int)stringMacAddress.charAt(3 * i) - 48;
+    hex0 = (int)stringMacAddress.charAt(3 * i + 1) > 63 ? (int)stringMacAddress.charAt(3 * i + 1) - 55 : (int)stringMacAddress.charAt(3 * i + 1) - 48;
+    addressMac[i] = 16 * hex1 + hex0;
+  }
+}
+
+static String legacyMacAddressToString(uint8_t addressMac[]) {
+  String stringMacAddress = "";
+  String hex1, hex0;
+  for (int i = 0; i < 6; i++) {
+    hex0 = String(addressMac[i] % 16, HEX);
+    if (addressMac[i] % 16 > 9)
+      hex0.toUpperCase();
+    hex1 = String((addressMac[i] - addressMac[i] % 16) / 16, HEX);
+    if ((addressMac[i] - addressMac[i] % 16) / 16 > 9)
+      hex1.toUpperCase();
+    stringMacAddress += hex1 + hex0;
+    if (i != 5)
+      stringMacAddress += ":";
+  }
+  return stringMacAddress;
+}
+
+/* ---- Measurement ---- */
+static volatile uint64_t sink;
+
+template <typename F> static double nsPerOp(int ops, F run) {
+  /* the run is repeated until it lasts 50 ms at least */
+  int repeat = 0;
+  auto start = std::chrono::steady_clock::now();
+  double elapsed;
+  do {
+    run();
+    repeat++;
+    elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  } while (elapsed < 50e6);
+  return elapsed / repeat / ops;
+}
+
+static bool rejected(const char *str) {
+  uint64_t key = 0x123456;
+  return !parseMacAddress(str, &key) && key == 0x123456;
+}
+
+int main() {
+  const int n = 1000;
+  std::mt19937_64 rng(1);
+  std::vector<uint8_t> macs(6 * n);
+  std::vector<uint64_t> keys(n);
+  std::vector<String> strings;
+  std::vector<char> texts(MAC_STRING_LENGTH * n);
+  for (int i = 0; i < n; i++) {
+    keys[i] = rng() & 0xFFFFFFFFFFFFULL;
+    keyToMacAddress(&macs[6 * i], keys[i]);
+    strings.push_back(legacyMacAddressToString(&macs[6 * i]));
+    formatMacKey(&texts[MAC_STRING_LENGTH * i], keys[i]);
+  }
+
+  double legacyFormat = nsPerOp(n, [&]() {
+    for (int i = 0; i < n; i++)
+      sink = legacyMacAddressToString(&macs[6 * i]).length();
+  });
+  double legacyParse = nsPerOp(n, [&]() {
+    uint8_t mac[6];
+    for (int i = 0; i < n; i++) {
+      legacyModifMacAddress(mac, strings[i]);
+      sink = mac[5];
+    }
+  });
+  double codecFormat = nsPerOp(n, [&]() {
+    char str[MAC_STRING_LENGTH];
+    for (int i = 0; i < n; i++) {
+      formatMacAddress(str, &macs[6 * i]);
+      sink = str[16];
+    }
+  });
+  double codecFormatKey = nsPerOp(n, [&]() {
+    char str[MAC_STRING_LENGTH];
+    for (int i = 0; i < n; i++) {
+      formatMacKey(str, keys[i]);
+      sink = str[16];
+    }
+  });
+  double codecParse = nsPerOp(n, [&]() {
+    uint64_t key = 0;
+    for (int i = 0; i < n; i++)
+      sink = parseMacAddress(&texts[MAC_STRING_LENGTH * i], &key) ? key : 0;
+  });
+  printf("%-10s %12s %12s\n", "", "format_ns", "parse_ns");
+  printf("%-10s %12.1f %12.1f\n", "legacy", legacyFormat, legacyParse);
+  printf("%-10s %12.1f %12.1f\n", "codec", codecFormat, codecParse);
+  printf("%-10s %12.1f %12s\n", "codec key", codecFormatKey, "");
+  printf("%-10s %12.0f %12.0f\n", "speedup", legacyFormat / codecFormat, legacyParse / codecParse);
+
+  /* round trips over random MAC addresses, the text must be the one of the legacy formatter */
+  int failures = 0;
+  const int rounds = 1000000;
+  for (int i = 0; i < rounds; i++) {
+    uint64_t key = rng() & 0xFFFFFFFFFFFFULL, parsed = 0;
+    uint8_t mac[6], back[6];
+    char str[MAC_STRING_LENGTH], fromBytes[MAC_STRING_LENGTH];
+    keyToMacAddress(mac, key);
+    formatMacKey(str, key);
+    formatMacAddress(fromBytes, mac);
+    bool ok = strcmp(str, fromBytes) == 0 && parseMacAddress(str, &parsed) && parsed == key;
+    keyToMacAddress(back, parsed);
+    ok = ok && memcmp(mac, back, 6) == 0;
+    /* the lower case and the "-" separator give the same key */
+    for (char &c : str)
+      c = (c == ':') ? '-' : tolower(c);
+    parsed = 0;
+    ok = ok && parseMacAddress(str, &parsed) && parsed == key;
+    if (i < 10000)
+      ok = ok && legacyMacAddressToString(mac) == String(fromBytes);
+    failures += !ok;
+  }
+  printf("round trips : %d / %d failed\n", failures, rounds);
+
+  const char *invalid[] = {"", "24:0A:C4:00:00", "24:0A:C4:00:00:0", "24:0A:C4:00:00:01:", "24:0A:C4:00:00:011", "24:0A:C4:00:00:0G",
+                           "240A:C4:00:00:01:", "24:0A:C4 00:00:01", "24:0A:C4:00:00:\xff\xff", "g4:0A:C4:00:00:01"};
+  int accepted = 0;
+  for (const char *str : invalid)
+    accepted += !rejected(str);
+  printf("invalid texts : %d / %d accepted\n", accepted, (int)(sizeof(invalid) / sizeof(invalid[0])));
+
+  uint8_t legacyMac[6], mac[6] = {0x24, 0x0a, 0xc4, 0xab, 0xcd, 0xef};
+  legacyModifMacAddress(legacyMac, "24:0a:c4:ab:cd:ef");
+  printf("lower case \"24:0a:c4:ab:cd:ef\" : legacy %s, codec %s\n", memcmp(legacyMac, mac, 6) ? "wrong" : "right",
+         rejected("24:0a:c4:ab:cd:ef") ? "wrong" : "right");
+  return failures || accepted ? 1 : 0;
+}
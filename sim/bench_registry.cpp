@@ -0,0 +1,157 @@
+/* ---- Benchmark of the buoy registry ---- */
+/*
+   Compares the cost of the master bookkeeping on an ID_REQUEST for 10, 100 and 1000 buoys :
+   - list : the linked list of the first version of the sketch (reproduced below). A lookup builds the String of every MAC address
+     of the list, an insertion walks the list again and counts it recursively twice.
+   - registry : the hash table of buoyRegistry.h, with the MAC addresses already converted into keys.
+   insert is the cost of the join of a new buoy (lookup which fails, then insertion), lookup the cost of a request from a known buoy.
+*/
+#include "shim/Arduino.h"
+#include "../buoyRegistry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+/* ---- Linked list of the first version ---- */
+typedef struct legacyBuoy {
+  int buoyID;
+  char buoyName[40];
+  uint8_t buoyMacAddress[6];
+  struct legacyBuoy *nxt;
+} legacyBuoy;
+
+static int legacyNbBuoys(legacyBuoy *myList) {
+  if (myList == NULL)
+    return 0;
+  return legacyNbBuoys(myList->nxt) + 1;
+}
+
+static void legacyModifMacAddress(uint8_t addressMac[], String stringMacAddress) {
+  int hex1, hex0;
+  for (int i = 0; i < 6; i++) {
+    hex1 = (int)stringMacAddress.charAt(3 * i) > 63 ? (int)stringMacAddress.charAt(3 * i) - 55 : (int)stringMacAddress.charAt(3 * i) - 48;
+    hex0 = (int)stringMacAddress.charAt(3 * i + 1) > 63 ? (int)stringMacAddress.charAt(3 * i + 1) - 55 : (int)stringMacAddress.charAt(3 * i + 1) - 48;
+    addressMac[i] = 16 * hex1 + hex0;
+  }
+}
+
+static String legacyMacAddressToString(uint8_t addressMac[]) {
+  String stringMacAddress = "";
+  String hex1, hex0;
+  for (int i = 0; i < 6; i++) {
+    hex0 = String(addressMac[i] % 16, HEX);
+    if (addressMac[i] % 16 > 9)
+      hex0.toUpperCase();
+    hex1 = String((addressMac[i] - addressMac[i] % 16) / 16, HEX);
+    if ((addressMac[i] - addressMac[i] % 16) / 16 > 9)
+      hex1.toUpperCase();
+    stringMacAddress += hex1 + hex0;
+    if (i != 5)
+      stringMacAddress += ":";
+  }
+  return stringMacAddress;
+}
+
+static legacyBuoy *legacyAddNewBuoy(legacyBuoy *myList, String macAddressBuoy) {
+  legacyBuoy *newBuoy = (legacyBuoy *)malloc(sizeof(legacyBuoy));
+  newBuoy->buoyID = legacyNbBuoys(myList);
+  String nameBuoy = "Buoy n°" + String(legacyNbBuoys(myList));
+  nameBuoy.toCharArray(newBuoy->buoyName, 40);
+  legacyModifMacAddress(newBuoy->buoyMacAddress, macAddressBuoy);
+  newBuoy->nxt = NULL;
+  if (myList == NULL)
+    return newBuoy;
+  legacyBuoy *temp = myList;
+  while (temp->nxt != NULL)
+    temp = temp->nxt;
+  temp->nxt = newBuoy;
+  return myList;
+}
+
+static int legacyIsBuoyExists(legacyBuoy *myList, String addressMac) {
+  int place = 0;
+  for (legacyBuoy *temp = myList; temp != NULL; temp = temp->nxt, place++)
+    if (legacyMacAddressToString(temp->buoyMacAddress).compareTo(addressMac) == 0)
+      return place;
+  return -1;
+}
+
+static void legacyFree(legacyBuoy *myList) {
+  while (myList) {
+    legacyBuoy *next = myList->nxt;
+    free(myList);
+    myList = next;
+  }
+}
+
+/* ---- Measurement ---- */
+static volatile int sink;
+
+template <typename F> static double nsPerOp(int ops, F run) {
+  /* the run is repeated until it lasts 50 ms at least */
+  int repeat = 0;
+  auto start = std::chrono::steady_clock::now();
+  double elapsed;
+  do {
+    run();
+    repeat++;
+    elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  } while (elapsed < 50e6);
+  return elapsed / repeat / ops;
+}
+
+static structBuoyRegistry registry;
+
+int main() {
+  printf("%6s %16s %16s %16s %16s %10s %10s\n", "buoys", "list_insert_ns", "list_lookup_ns", "reg_insert_ns", "reg_lookup_ns",
+         "x_insert", "x_lookup");
+  std::mt19937_64 rng(1);
+  for (int n : {10, 100, 1000}) {
+    std::vector<uint8_t> macs(6 * n);
+    std::vector<String> strings;
+    std::vector<uint64_t> keys;
+    for (int i = 0; i < n; i++) {
+      uint64_t key = rng() & 0xFFFFFFFFFFFFULL;
+      keyToMacAddress(&macs[6 * i], key);
+      keys.push_back(key);
+      strings.push_back(legacyMacAddressToString(&macs[6 * i]));
+    }
+    std::vector<int> order(n);
+    for (int i = 0; i < n; i++)
+      order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+
+    double listInsert = nsPerOp(n, [&]() {
+      legacyBuoy *list = NULL;
+      for (int i = 0; i < n; i++)
+        if (legacyIsBuoyExists(list, strings[i]) == -1)
+          list = legacyAddNewBuoy(list, strings[i]);
+      sink = legacyNbBuoys(list) - 1;
+      legacyFree(list);
+    });
+    legacyBuoy *list = NULL;
+    for (int i = 0; i < n; i++)
+      list = legacyAddNewBuoy(list, strings[i]);
+    double listLookup = nsPerOp(n, [&]() {
+      for (int i : order)
+        sink = legacyIsBuoyExists(list, strings[i]);
+    });
+    legacyFree(list);
+
+    double registryInsert = nsPerOp(n, [&]() {
+      initRegistry(&registry);
+      for (int i = 0; i < n; i++)
+        if (isBuoyExists(&registry, keys[i]) == -1)
+          sink = addNewBuoy(&registry, keys[i]);
+    });
+    double registryLookup = nsPerOp(n, [&]() {
+      for (int i : order)
+        sink = isBuoyExists(&registry, keys[i]);
+    });
+    printf("%6d %16.1f %16.1f %16.1f %16.1f %10.0f %10.0f\n", n, listInsert, listLookup, registryInsert, registryLookup,
+           listInsert / registryInsert, listLookup / registryLookup);
+  }
+  return 0;
+}
@@ -0,0 +1,142 @@
+/* ---- Benchmark of the registry log ---- */
+/*
+   Measures the time the master needs to restore its registry at the boot, for 10, 100 and 1000 buoys (files in a temporary directory) :
+   - snapshot : a compacted file, the MAC addresses are read by chunks.
+   - log : the worst case, a snapshot of the master followed by one record per buoy (REGISTRY_LOG_COMPACT_RECORDS never reached).
+   - append and compact : the cost of saving a new buoy, and of rewriting the whole file.
+   The file sizes are printed in bytes. Then the recovery of a file damaged by a power loss is checked :
+   an incomplete last record is dropped (and the file compacted), a corrupted snapshot is rejected. Last, a new buoy which could not be
+   saved does not get its ID before a compaction saves it.
+*/
+#define REGISTRY_LOG_COMPACT_RECORDS 100000
+#include "shim/Arduino.h"
+#include "../registryLog.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <unistd.h>
+
+static std::string flashDir;
+
+const char *simFlashDir() {
+  return flashDir.c_str();
+}
+
+unsigned long millis() {
+  return 0;
+}
+
+/* ---- Measurement ---- */
+static volatile int sink;
+
+template <typename F> static double nsPerOp(int ops, F run) {
+  /* the run is repeated until it lasts 50 ms at least */
+  int repeat = 0;
+  auto start = std::chrono::steady_clock::now();
+  double elapsed;
+  do {
+    run();
+    repeat++;
+    elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  } while (elapsed < 50e6);
+  return elapsed / repeat / ops;
+}
+
+static size_t fileSize() {
+  File file = LittleFS.open(REGISTRY_LOG_PATH, FILE_READ);
+  return file.size();
+}
+
+static structBuoyRegistry registry, loaded;
+
+/* writes the file of a registry : a snapshot of the first buoys, then one record per remaining buoy */
+static void writeLog(int snapshotCount) {
+  structBuoyRegistry *snapshot = new structBuoyRegistry;
+  initRegistry(snapshot);
+  for (int i = 0; i < snapshotCount; i++)
+    addNewBuoy(snapshot, registry.macAddresses[i]);
+  compactRegistryLog(snapshot);
+  for (int i = snapshotCount; i < registry.count; i++) {
+    addNewBuoy(snapshot, registry.macAddresses[i]);
+    appendRegistryLog(snapshot, i);
+  }
+  delete snapshot;
+}
+
+static bool sameRegistry(const structBuoyRegistry *a, const structBuoyRegistry *b, int count) {
+  if (a->count != count || b->count < count)
+    return false;
+  for (int i = 0; i < count; i++)
+    if (a->macAddresses[i] != b->macAddresses[i] || isBuoyExists(a, b->macAddresses[i]) != i)
+      return false;
+  return true;
+}
+
+int main() {
+  char dir[] = "/tmp/bench_registryLog.XXXXXX";
+  if (!mkdtemp(dir))
+    return 1;
+  flashDir = dir;
+  loadRegistryLog(&loaded);
+
+  printf("%6s %12s %12s %12s %12s %12s %12s\n", "buoys", "snap_bytes", "snap_load_us", "log_bytes", "log_load_us", "append_us",
+         "compact_us");
+  std::mt19937_64 rng(1);
+  int failures = 0;
+  for (int n : {10, 100, 1000}) {
+    initRegistry(&registry);
+    while (registry.count < n)
+      addNewBuoy(&registry, rng() & 0xFFFFFFFFFFFFULL);
+
+    double compact = nsPerOp(1, [&]() { sink = compactRegistryLog(&registry); });
+    size_t snapshotBytes = fileSize();
+    double snapshotLoad = nsPerOp(1, [&]() { sink = loadRegistryLog(&loaded); });
+    failures += !sameRegistry(&loaded, &registry, n);
+
+    writeLog(1);
+    size_t logBytes = fileSize();
+    double logLoad = nsPerOp(1, [&]() { sink = loadRegistryLog(&loaded); });
+    failures += !sameRegistry(&loaded, &registry, n);
+
+    double append = n > 1 ? nsPerOp(n - 1, [&]() { writeLog(1); }) : 0;
+    printf("%6d %12zu %12.1f %12zu %12.1f %12.1f %12.1f\n", n, snapshotBytes, snapshotLoad / 1000, logBytes, logLoad / 1000,
+           append / 1000, compact / 1000);
+  }
+
+  /* power loss during the append of the buoy 999 : the file ends with 4 bytes of its record */
+  writeLog(1);
+  std::string path = flashDir + REGISTRY_LOG_PATH;
+  if (truncate(path.c_str(), fileSize() - sizeof(structRegistryLogRecord) + 4) != 0)
+    return 1;
+  bool torn = loadRegistryLog(&loaded) && sameRegistry(&loaded, &registry, 999) && registryLogRecords == 0
+              && fileSize() == sizeof(structRegistryLogHeader) + 6 * 999 + 2;
+  printf("incomplete last record : %s\n", torn ? "dropped, file compacted" : "FAILED");
+  failures += !torn;
+
+  /* one bit flipped in the snapshot */
+  compactRegistryLog(&registry);
+  FILE *file = fopen(path.c_str(), "r+b");
+  fseek(file, sizeof(structRegistryLogHeader) + 6 * 500, SEEK_SET);
+  int c = fgetc(file);
+  fseek(file, -1, SEEK_CUR);
+  fputc(c ^ 0x10, file);
+  fclose(file);
+  bool corrupted = !loadRegistryLog(&loaded) && nbBuoys(&loaded) == 0;
+  printf("corrupted snapshot : %s\n", corrupted ? "rejected" : "FAILED");
+  failures += !corrupted;
+
+  /* the flash fails while the buoy 1000 is added, then comes back when it asks its ID again */
+  compactRegistryLog(&registry);
+  int buoyID = addNewBuoy(&registry, rng() & 0xFFFFFFFFFFFFULL);
+  flashDir = std::string(dir) + "/missing";
+  bool withheld = !appendRegistryLog(&registry, buoyID) && !registryLogSaved(&registry, buoyID) && registryLogSaved(&registry, buoyID - 1);
+  flashDir = dir;
+  bool saved = registryLogSaved(&registry, buoyID) && loadRegistryLog(&loaded) && sameRegistry(&loaded, &registry, buoyID + 1);
+  printf("flash failure : %s\n", withheld && saved ? "ID withheld until saved" : "FAILED");
+  failures += !(withheld && saved);
+
+  std::string command = std::string("rm -rf ") + dir;
+  sink = system(command.c_str());
+  return failures ? 1 : 0;
+}
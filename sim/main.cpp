@@ -0,0 +1,347 @@
+/* ---- Command line of the simulator ---- */
+/*
+   USAGE : espnow_sim [--option value]...
+   - every field of simConfig can be given as --name value, for example --nodes 100 --lossRate 0.1 --traceNode 0.
+   - --sweep 2,10,100 runs one simulation per fleet size (each one in its own process) and prints one line per run.
+   - --runs R repeats every simulation with the seeds seed, seed + 1... seed + R - 1.
+   - --traceNode N --serialFile F writes the raw Serial output of the buoy N in F, decoded by build/trace_decode F (see trace.h).
+   - --metricsFile F queries the metrics of every buoy on the Serial of the master at the end of the simulation (after settleMs) and
+     writes its output in F, decoded by build/metrics_decode F (see metrics.h).
+   - --brownout 1 follows every simulation by a brownout : the whole fleet reboots at the same time (in bootSpreadMs) with the NVS
+     written during the first boot (see nvsDir), and a second line (boot "warm") is printed.
+   - --brownout 1 --demoteMaster 1 changes the warm boot : the buoy 1 boots first without its NVS and becomes the master, the master of
+     the first boot boots with the fleet without its NVS and joins it as a slave. The other buoys warm start towards a former master which
+     acknowledges their ID_REQUEST but no longer answers them (see BOOT_WARM_START in ESP-NOW_Final.ino).
+   - --requireJoin 1 makes the simulation fail (exit status 1) if a buoy has no ID at the end, --requireDelivery 1 if a DATA message
+     sent was neither delivered nor still in flight at the end (given up, see RELIABLE_RETRIES_MAX, or never sent again).
+   - --lateNodes N with --killMasterMs boots the last N buoys at the power loss of the master instead of with the fleet : they ask
+     their ID during the claims of the slaves, --requireSameID 1 makes the simulation fail if a slave does not get its own ID back.
+   - --sendCbLossRate P drops the OnDataSent callback of a frame with the probability P : the DATA messages whose status is lost are
+     only sent again by their RTO (see reliable.h).
+   The results are the ones of the join protocol : how many masters were elected, how many buoys received an ID,
+   the time between the boot of the fleet and the last ID assigned, the time-to-ID of the master (master_ms) and the join latency
+   (time-to-ID) of the slaves, median and 99th percentile, and the channel counters
+   (bytes_join is the number of payload bytes put on the air per slave which received an ID, coll_pct the percentage of frames
+   corrupted by a collision). rx_drop counts the frames dropped by
+   the ESP-NOW driver, rxq_hw and rxq_drop are the high-water mark (maximum over the buoys) and the drops (sum) of the receive queue of the sketch.
+   cb_max_ms is the longest time a frame or a send status waited for the end of its WiFi callback (a callback which writes on a full
+   UART blocks the WiFi task), hdl_p99_ms and hdl_max_ms the time between the arrival of a frame and its handling by the main task.
+   heap_hw is the high-water mark of the heap of the sketch in bytes (maximum over the buoys), allocs the number of heap allocations
+   made by the buoys after their setup() (sum), which should stay at 0 once the fleet runs.
+   The DATA messages of the reliable delivery (see reliable.h and DATA_PERIOD_MS) are counted over the buoys : dlv_pct is the percentage
+   of the DATA messages sent which were delivered, retx_pct the number of retransmissions per DATA message sent (in percent), dups the
+   duplicates received and dropped, goodput_Bps the DATA bytes delivered per second during the settle phase (-1 without settleMs).
+   The telemetry (see telemetry.h and TELEMETRY_PERIOD_MS) is measured during the settle phase : tlm_sps is the number of samples stored
+   by the master per second, tlm_sps_buoy the same per slave, and tlm_drop the samples dropped by the slaves because their batch was full.
+   set_coll_pct is coll_pct during the settle phase. lat_ms and jit_ms are the mean and the standard deviation of the latency of the batches
+   received by the master during the settle phase (the age of their last sample), lat_max_ms its maximum over the whole simulation.
+   The relay (see relay.h, and --topology line or grid with --range) is measured over the buoys : hops_max is the largest number of hops
+   between a slave and the master, hop_ms the round-trip time of the DATA messages acknowledged at their first transmission divided by
+   twice the hops of their sender, fwd_pct the frames put on the air by the relays (messages wrapped or passed on, BEACON sent again) in
+   percent of all the frames, and rly_dups the relayed messages dropped as duplicates.
+   The failover (see failover.h, and --killMasterMs with --settleMs) is measured from the power loss of the master : fo_elect_ms is the
+   time until a new master is elected, fo_ms the time until every buoy alive is reattached (the new master, a slave which got its ID back
+   from it or a late buoy which got an ID, -1 if some are not), and fo_reid the number of slaves which got another ID than their own.
+   masters only counts the buoys alive.
+   The peer cache (see peerCache.h) is measured over the buoys, from their metrics (see metrics.h) : pc_hit_pct is the percentage of the
+   messages to a buoy which was not a peer sent to its MAC address instead of the broadcast address, pc_evict the buoys evicted from the
+   cache, and mac_retx the link-layer retries of the unicast frames.
+   cb_skip counts the tickets whose OnDataSent callback was lost and the statuses which had no ticket (see reliable.h) : once it is not 0,
+   some failures may have been matched with another DATA message and retx_pct holds retransmissions sent for nothing.
+   tdma_slots is the number of slaves alive which hold a time slot at the end (see tdma.h), 0 without time slots.
+*/
+#include "sim.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct simOption {
+  const char *name;
+  char kind;
+  void *value;
+};
+
+static const simOption options[] = {
+  {"nodes", 'i', &simCfg.nodes},
+  {"topology", 's', &simCfg.topology},
+  {"range", 'd', &simCfg.range},
+  {"seed", 'u', &simCfg.seed},
+  {"fleetStartMs", 'd', &simCfg.fleetStartMs},
+  {"bootSpreadMs", 'd', &simCfg.bootSpreadMs},
+  {"maxTimeMs", 'd', &simCfg.maxTimeMs},
+  {"settleMs", 'd', &simCfg.settleMs},
+  {"killMasterMs", 'd', &simCfg.killMasterMs},
+  {"lateNodes", 'i', &simCfg.lateNodes},
+  {"demoteMaster", 'i', &simCfg.demoteMaster},
+  {"requireJoin", 'i', &simCfg.requireJoin},
+  {"requireDelivery", 'i', &simCfg.requireDelivery},
+  {"requireSameID", 'i', &simCfg.requireSameID},
+  {"bitrateMbps", 'd', &simCfg.bitrateMbps},
+  {"preambleUs", 'd', &simCfg.preambleUs},
+  {"overheadBytes", 'i', &simCfg.overheadBytes},
+  {"txLatencyUs", 'd', &simCfg.txLatencyUs},
+  {"rxLatencyUs", 'd', &simCfg.rxLatencyUs},
+  {"lossRate", 'd', &simCfg.lossRate},
+  {"sendCbLossRate", 'd', &simCfg.sendCbLossRate},
+  {"collisionWindowUs", 'd', &simCfg.collisionWindowUs},
+  {"difsUs", 'd', &simCfg.difsUs},
+  {"slotUs", 'd', &simCfg.slotUs},
+  {"cwMin", 'i', &simCfg.cwMin},
+  {"cwMax", 'i', &simCfg.cwMax},
+  {"macRetries", 'i', &simCfg.macRetries},
+  {"ackUs", 'd', &simCfg.ackUs},
+  {"txQueueDepth", 'i', &simCfg.txQueueDepth},
+  {"rxQueueDepth", 'i', &simCfg.rxQueueDepth},
+  {"loopTickUs", 'd', &simCfg.loopTickUs},
+  {"uartFifoBytes", 'i', &simCfg.uartFifoBytes},
+  {"heapBytes", 'i', &simCfg.heapBytes},
+  {"traceNode", 'i', &simCfg.traceNode},
+  {"serialFile", 's', &simCfg.serialFile},
+  {"metricsFile", 's', &simCfg.metricsFile},
+  {"sketch", 's', &simCfg.sketchPath},
+  {"nvsDir", 's', &simCfg.nvsDir},
+};
+
+static bool setOption(const char *name, const char *value) {
+  for (const simOption &option : options) {
+    if (strcmp(option.name, name))
+      continue;
+    switch (option.kind) {
+      case 'i': *(int *)option.value = atoi(value); break;
+      case 'u': *(uint64_t *)option.value = strtoull(value, nullptr, 10); break;
+      case 'd': *(double *)option.value = atof(value); break;
+      case 's': *(std::string *)option.value = value; break;
+    }
+    return true;
+  }
+  return false;
+}
+
+static double percentile(std::vector<double> values, double p) {
+  if (values.empty())
+    return -1;
+  std::sort(values.begin(), values.end());
+  size_t index = (size_t)(p * (values.size() - 1) + 0.5);
+  return values[index];
+}
+
+static void printHeader() {
+  printf("%5s %6s %6s %7s %8s %10s %10s %10s %10s %8s %10s %10s %10s %8s %8s %6s %8s %7s %6s %8s %9s %10s %10s %8s %8s %8s %8s %6s %11s %8s %12s %8s %12s %8s %8s %10s %8s %8s %8s %8s %11s %8s %7s %10s %8s %8s %8s %10s %9s\n", "boot", "nodes", "seed", "masters", "assigned",
+         "t_full_ms", "master_ms", "join_p50", "join_p99", "frames", "bytes_air", "bytes_join", "airtime_ms", "collide", "coll_pct", "lost", "rx_drop", "tx_fail", "rxq_hw", "rxq_drop", "cb_max_ms", "hdl_p99_ms", "hdl_max_ms", "heap_hw", "allocs", "dlv_pct", "retx_pct", "dups", "goodput_Bps", "tlm_sps", "tlm_sps_buoy", "tlm_drop", "set_coll_pct", "lat_ms", "jit_ms", "lat_max_ms", "hops_max", "hop_ms", "fwd_pct", "rly_dups", "fo_elect_ms", "fo_ms", "fo_reid", "pc_hit_pct", "pc_evict", "mac_retx", "cb_skip", "tdma_slots", "wall_ms");
+}
+
+/* ---- One simulation ---- */
+static int runOne(const char *boot) {
+  auto wallStart = std::chrono::steady_clock::now();
+  if (!simLoad())
+    return 1;
+  simRun();
+  double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+
+  int masters = 0, assigned = 0;
+  unsigned rxQueueHighWater = 0, rxQueueDrops = 0;
+  uint64_t heapHighWater = 0, loopAllocs = 0;
+  uint64_t dataSent = 0, dataRetransmissions = 0, dataDelivered = 0, dataDuplicates = 0, dataBytes = 0, dataInFlight = 0;
+  uint64_t samplesStored = 0, samplesDropped = 0, batchesReceived = 0, latencySum = 0, latencySquares = 0, latencyMax = 0;
+  uint64_t relayFrames = 0, relayDuplicates = 0, rttSum = 0, rttHops = 0;
+  int hopsMax = 0, slotsHeld = 0;
+  int alive = 0, reattached = 0, reassigned = 0;
+  uint64_t cacheHits = 0, cacheMisses = 0, cacheEvictions = 0, statusSkipped = 0;
+  double electMs = -1, failoverMs = -1;
+  uint64_t last = 0;
+  double masterMs = -1;
+  std::vector<double> joins;
+  for (simNode *node : simNodes) {
+    if (node->ESPstatus && *node->ESPstatus == 1 && !node->dead)
+      masters++;
+    if (simStat.killUs && !node->dead) {
+      alive++;
+      if (node->reattached) {
+        reattached++;
+        failoverMs = std::max(failoverMs, (node->reattachedUs - simStat.killUs) / 1000.0);
+        if (*node->ESPstatus == 1)
+          electMs = (node->reattachedUs - simStat.killUs) / 1000.0;
+        else if ((node->idBeforeKill != -1) && (*node->myID != node->idBeforeKill))
+          reassigned++;
+      }
+    }
+    if (node->sketchRxQueue) {
+      rxQueueHighWater = std::max(rxQueueHighWater, node->sketchRxQueue->highWater);
+      rxQueueDrops += node->sketchRxQueue->drops;
+    }
+    heapHighWater = std::max(heapHighWater, node->heapHighWater);
+    if (node->sketchReliable) {
+      dataSent += node->sketchReliable->sent;
+      dataRetransmissions += node->sketchReliable->retransmissions;
+      dataDelivered += node->sketchReliable->delivered;
+      dataDuplicates += node->sketchReliable->duplicates;
+      dataInFlight += node->reliableInFlight ? *node->reliableInFlight : 0;
+      dataBytes += node->sketchReliable->deliveredBytes;
+      int hops = node->relayHops ? std::max(1, *node->relayHops) : 1;
+      rttSum += node->sketchReliable->rttSumUs;
+      rttHops += 2ull * hops * node->sketchReliable->rttSamples;
+    }
+    if (node->sketchRelay) {
+      relayFrames += node->sketchRelay->wrapped + node->sketchRelay->forwarded + node->sketchRelay->beacons;
+      relayDuplicates += node->sketchRelay->duplicates;
+    }
+    if (node->sketchMetrics) {
+      cacheHits += node->sketchMetrics->counters[METRIC_PEER_HITS];
+      cacheMisses += node->sketchMetrics->counters[METRIC_PEER_MISSES];
+      cacheEvictions += node->sketchMetrics->counters[METRIC_PEER_EVICTIONS];
+      statusSkipped += node->sketchMetrics->counters[METRIC_SEND_STATUS_LOST] + node->sketchMetrics->counters[METRIC_SEND_STATUS_STRAY];
+    }
+    if (node->relayHops && node->ESPstatus && *node->ESPstatus == -1)
+      hopsMax = std::max(hopsMax, *node->relayHops);
+    if (node->tdmaSlot && node->ESPstatus && *node->ESPstatus == -1 && !node->dead && *node->tdmaSlot > 0)
+      slotsHeld++;
+    if (node->sketchTelemetry) {
+      samplesStored += node->sketchTelemetry->stored;
+      samplesDropped += node->sketchTelemetry->dropped;
+      batchesReceived += node->sketchTelemetry->batchesReceived;
+      latencySum += node->sketchTelemetry->latencySumMs;
+      latencySquares += node->sketchTelemetry->latencySquaresMs;
+      latencyMax = std::max<uint64_t>(latencyMax, node->sketchTelemetry->latencyMaxMs);
+    }
+    if (node->setupDone)
+      loopAllocs += node->heapAllocs - node->heapAllocsSetup;
+    if (!node->assigned)
+      continue;
+    assigned++;
+    last = std::max(last, node->assignedUs);
+    if (node->ESPstatus && *node->ESPstatus == 1)
+      masterMs = std::max(masterMs, (node->assignedUs - node->bootUs) / 1000.0);
+    else
+      joins.push_back((node->assignedUs - node->bootUs) / 1000.0);
+  }
+  std::vector<double> handles(simStat.handleUs.begin(), simStat.handleUs.end());
+  for (double &handle : handles)
+    handle /= 1000;
+  double tFull = assigned == simCfg.nodes ? last / 1000.0 - simCfg.fleetStartMs : -1;
+  double settleS = (simStat.settleStartUs > 0 && simStat.endUs > simStat.settleStartUs) ? (simStat.endUs - simStat.settleStartUs) / 1e6 : 0;
+  double goodput = settleS > 0 ? (dataBytes - simStat.settleBytesStart) / settleS : -1;
+  double samplesPerS = settleS > 0 ? (samplesStored - simStat.settleSamplesStart) / settleS : -1;
+  uint64_t settleFrames = simStat.frames - simStat.settleFramesStart, settleBatches = batchesReceived - simStat.settleBatchesStart;
+  double settleCollisions = settleS > 0 ? 100.0 * (simStat.collisions - simStat.settleCollisionsStart) / std::max<uint64_t>(1, settleFrames) : -1;
+  double latency = -1, jitter = -1;
+  if (settleS > 0 && settleBatches > 0) {
+    latency = (double)(latencySum - simStat.settleLatencySumStart) / settleBatches;
+    jitter = sqrt(std::max(0.0, (double)(latencySquares - simStat.settleLatencySquaresStart) / settleBatches - latency * latency));
+  }
+  printf("%5s %6d %6llu %7d %8d %10.1f %10.1f %10.1f %10.1f %8llu %10llu %10.0f %10.1f %8llu %8.1f %6llu %8llu %7llu %6u %8u %9.2f %10.2f %10.2f %8llu %8llu %8.1f %8.1f %6llu %11.0f %8.0f %12.2f %8llu %12.2f %8.1f %8.1f %10llu %8d %8.2f %8.1f %8llu %11.1f %8.1f %7d %10.1f %8llu %8llu %8llu %10d %9.0f\n", boot, simCfg.nodes,
+         (unsigned long long)simCfg.seed, masters, assigned, tFull, masterMs, percentile(joins, 0.5), percentile(joins, 0.99),
+         (unsigned long long)simStat.frames, (unsigned long long)simStat.bytes, (double)simStat.bytes / std::max(1, assigned - 1),
+         simStat.airtimeUs / 1000.0,
+         (unsigned long long)simStat.collisions, 100.0 * simStat.collisions / std::max<uint64_t>(1, simStat.frames),
+         (unsigned long long)simStat.lost, (unsigned long long)simStat.rxDrops,
+         (unsigned long long)simStat.txFail, rxQueueHighWater, rxQueueDrops,
+         simStat.callbackMaxUs / 1000.0, percentile(handles, 0.99), handles.empty() ? -1 : *std::max_element(handles.begin(), handles.end()),
+         (unsigned long long)heapHighWater, (unsigned long long)loopAllocs,
+         dataSent ? 100.0 * dataDelivered / dataSent : -1, dataSent ? 100.0 * dataRetransmissions / dataSent : -1,
+         (unsigned long long)dataDuplicates, goodput, samplesPerS, settleS > 0 ? samplesPerS / std::max(1, simCfg.nodes - 1) : -1,
+         (unsigned long long)samplesDropped, settleCollisions, latency, jitter, (unsigned long long)latencyMax,
+         hopsMax, rttHops ? rttSum / 1000.0 / rttHops : -1, 100.0 * relayFrames / std::max<uint64_t>(1, simStat.frames),
+         (unsigned long long)relayDuplicates, electMs, reattached == alive ? failoverMs : -1, reassigned,
+         cacheHits + cacheMisses ? 100.0 * cacheHits / (cacheHits + cacheMisses) : -1, (unsigned long long)cacheEvictions,
+         (unsigned long long)simStat.macRetries, (unsigned long long)statusSkipped, slotsHeld, wallMs);
+  fflush(stdout);
+  if (simCfg.requireJoin && assigned < simCfg.nodes) {
+    fprintf(stderr, "%d buoys of %d have no ID\n", simCfg.nodes - assigned, simCfg.nodes);
+    return 1;
+  }
+  if (simCfg.requireSameID && (reassigned > 0 || reattached < alive)) {
+    fprintf(stderr, "%d slaves reassigned, %d buoys of %d alive not reattached\n", reassigned, alive - reattached, alive);
+    return 1;
+  }
+  if (simCfg.requireDelivery && (dataSent == 0 || dataDelivered + dataInFlight < dataSent)) {
+    fprintf(stderr, "%llu DATA messages of %llu lost\n", (unsigned long long)(dataSent - dataDelivered - dataInFlight),
+            (unsigned long long)dataSent);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  std::vector<int> sweep;
+  int runs = 1;
+  bool brownout = false;
+
+  char exe[PATH_MAX];
+  ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  exe[n > 0 ? n : 0] = 0;
+  std::string dir(exe);
+  simCfg.sketchPath = dir.substr(0, dir.rfind('/') + 1) + "buoy.so";
+
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2) || i + 1 >= argc) {
+      fprintf(stderr, "usage: %s [--option value]...\n", argv[0]);
+      return 2;
+    }
+    const char *name = argv[i] + 2;
+    const char *value = argv[++i];
+    if (!strcmp(name, "sweep")) {
+      for (const char *p = value; *p; p = strchr(p, ',') ? strchr(p, ',') + 1 : p + strlen(p))
+        sweep.push_back(atoi(p));
+    } else if (!strcmp(name, "runs")) {
+      runs = atoi(value);
+    } else if (!strcmp(name, "brownout")) {
+      brownout = atoi(value) != 0;
+    } else if (!setOption(name, value)) {
+      fprintf(stderr, "unknown option --%s\n", name);
+      return 2;
+    }
+  }
+  if (sweep.empty())
+    sweep.push_back(simCfg.nodes);
+
+  printHeader();
+  fflush(stdout);
+  uint64_t firstSeed = simCfg.seed;
+  int status = 0;
+  for (int nodes : sweep) {
+    for (int run = 0; run < runs; run++) {
+      /* the NVS written by the first boot is kept in a temporary directory for the brownout */
+      char nvsDir[] = "/tmp/espnow_sim_nvs.XXXXXX";
+      if (brownout && !mkdtemp(nvsDir)) {
+        perror("mkdtemp");
+        return 1;
+      }
+      for (int boot = 0; boot < (brownout ? 2 : 1); boot++) {
+        /* every simulation loads its own copies of the sketch, so it runs in a child process */
+        pid_t pid = fork();
+        if (pid == 0) {
+          simCfg.nodes = nodes;
+          simCfg.seed = firstSeed + run;
+          /* the buoys write their NVS once they have their ID, the first boot leaves them the time to do it */
+          if (brownout) {
+            simCfg.nvsDir = nvsDir;
+            simCfg.settleMs = std::max(simCfg.settleMs, 1000.0);
+          }
+          /* the fleet boots at once, unless the buoy 1 must become the master first (demoteMaster) */
+          if (boot == 0)
+            simCfg.demoteMaster = 0;
+          else if (!simCfg.demoteMaster)
+            simCfg.fleetStartMs = 0;
+          exit(runOne(boot == 0 ? "cold" : "warm"));
+        }
+        int childStatus = 0;
+        waitpid(pid, &childStatus, 0);
+        if (!WIFEXITED(childStatus) || WEXITSTATUS(childStatus))
+          status = 1;
+      }
+      if (brownout) {
+        std::string command = std::string("rm -rf ") + nvsDir;
+        if (system(command.c_str()) != 0)
+          status = 1;
+      }
+    }
+  }
+  return status;
+}
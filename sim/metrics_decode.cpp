@@ -0,0 +1,162 @@
+/* ---- Decoder of the metrics of the sketch ---- */
+/*
+   USAGE : metrics_decode [--sum] [file]
+   Reads the raw output of the serial monitor of a buoy (a file written by espnow_sim --metricsFile F, or a capture of the UART of a
+   board queried by the host) and prints the snapshots of the metrics found in it (see metrics.h) :
+   - the ID, the role and the time since the boot of the buoy, the frames sent and received per opcode, the counters and the histograms.
+     A histogram is printed as its buckets which are not empty, with the bucket of its median and of its 99th percentile.
+   - with --sum, only the metrics of all the buoys together are printed (the counters of METRICS_MAX are the maximum over the buoys).
+   The text printed by the sketch and the events of the trace are skipped. A snapshot whose checksum is wrong is counted and skipped.
+*/
+#include "../metricsSnapshot.h"
+#include "../message.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#define METRICS_COUNTER_KIND(name, kind, description) kind,
+#define METRICS_COUNTER_DESCRIPTION(name, kind, description) description,
+#define METRICS_HISTOGRAM_DESCRIPTION(name, description, unit) description,
+#define METRICS_HISTOGRAM_UNIT(name, description, unit) unit,
+
+static const int counterKinds[] = {METRICS_COUNTERS(METRICS_COUNTER_KIND)};
+static const char *const counterDescriptions[] = {METRICS_COUNTERS(METRICS_COUNTER_DESCRIPTION)};
+static const char *const histogramDescriptions[] = {METRICS_HISTOGRAMS(METRICS_HISTOGRAM_DESCRIPTION)};
+static const char *const histogramUnits[] = {METRICS_HISTOGRAMS(METRICS_HISTOGRAM_UNIT)};
+static const char *const typeNames[METRICS_TYPES] = {"MASTER_DETECTION", "MASTER_REPLY", "ID_REQUEST", "ID_REPLY", "ID_REPLY_BATCH", "DATA",
+                                                     "DATA_ACK", "BEACON", "RELAY", "HEARTBEAT", "ELECTION", "METRICS"};
+
+static_assert(METRICS == METRICS_TYPES, "every opcode of message.h has a name");
+
+/* ---- The metrics of one buoy or of several buoys added up ---- */
+struct metricsTotal {
+  uint64_t sent[METRICS_TYPES] = {};
+  uint64_t received[METRICS_TYPES] = {};
+  uint64_t counters[METRIC_COUNTER_COUNT] = {};
+  uint64_t histograms[METRIC_HISTOGRAM_COUNT][METRICS_BUCKETS] = {};
+};
+
+static void add(metricsTotal &total, const structMetricsSnapshot &snapshot) {
+  for (int i = 0; i < METRICS_TYPES; i++) {
+    total.sent[i] += snapshot.sent[i];
+    total.received[i] += snapshot.received[i];
+  }
+  for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+    if (counterKinds[i] == METRICS_MAX)
+      total.counters[i] = snapshot.counters[i] > total.counters[i] ? snapshot.counters[i] : total.counters[i];
+    else
+      total.counters[i] += snapshot.counters[i];
+  }
+  for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++)
+    for (int b = 0; b < METRICS_BUCKETS; b++)
+      total.histograms[h][b] += snapshot.histograms[h][b];
+}
+
+/* ---- Formatting of the bounds of a bucket ---- */
+static const char *bucketName(char *buf, size_t size, int bucket, const char *unit) {
+  if (bucket <= 1)
+    snprintf(buf, size, "%d %s", bucket, unit);
+  else if (bucket == METRICS_BUCKETS - 1)
+    snprintf(buf, size, ">= %u %s", 1u << (bucket - 1), unit);
+  else
+    snprintf(buf, size, "%u-%u %s", 1u << (bucket - 1), (1u << bucket) - 1, unit);
+  return buf;
+}
+
+/* ---- Printing of the metrics ---- */
+static void printMetrics(const metricsTotal &total) {
+  printf("  %-18s %10s %10s\n", "frames", "sent", "received");
+  for (int i = 0; i < METRICS_TYPES; i++)
+    if (total.sent[i] || total.received[i])
+      printf("  %-18s %10llu %10llu\n", typeNames[i], (unsigned long long)total.sent[i], (unsigned long long)total.received[i]);
+  for (int i = 0; i < METRIC_COUNTER_COUNT; i++)
+    printf("  %-58s %10llu\n", counterDescriptions[i], (unsigned long long)total.counters[i]);
+  for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+    uint64_t count = 0;
+    for (int b = 0; b < METRICS_BUCKETS; b++)
+      count += total.histograms[h][b];
+    printf("  %s (%s), %llu values", histogramDescriptions[h], histogramUnits[h], (unsigned long long)count);
+    if (!count) {
+      printf("\n");
+      continue;
+    }
+    /* the percentiles are given as the bucket which holds them */
+    uint64_t seen = 0;
+    int median = -1, p99 = -1;
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+      seen += total.histograms[h][b];
+      if (median == -1 && 2 * seen >= count)
+        median = b;
+      if (p99 == -1 && 100 * seen >= 99 * count)
+        p99 = b;
+    }
+    char name[32];
+    printf(", p50 in %s", bucketName(name, sizeof(name), median, histogramUnits[h]));
+    printf(", p99 in %s\n", bucketName(name, sizeof(name), p99, histogramUnits[h]));
+    for (int b = 0; b < METRICS_BUCKETS; b++)
+      if (total.histograms[h][b])
+        printf("    %-24s %10llu\n", bucketName(name, sizeof(name), b, histogramUnits[h]), (unsigned long long)total.histograms[h][b]);
+  }
+}
+
+int main(int argc, char **argv) {
+  bool sum = false;
+  const char *path = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--sum"))
+      sum = true;
+    else
+      path = argv[i];
+  }
+  FILE *file = path ? fopen(path, "rb") : stdin;
+  if (!file) {
+    perror(path);
+    return 1;
+  }
+  std::vector<uint8_t> data;
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+    data.insert(data.end(), buf, buf + n);
+  if (path)
+    fclose(file);
+
+  /* a snapshot can start anywhere, the sketch writes it in one piece between the text and the events of the trace */
+  uint64_t snapshots = 0, corrupted = 0, unknown = 0;
+  metricsTotal fleet;
+  for (size_t i = 0; i + METRICS_FRAME_LENGTH <= data.size(); i++) {
+    if (data[i] != METRICS_SYNC || data[i + 1] != sizeof(structMetricsSnapshot))
+      continue;
+    uint8_t checksum = 0;
+    for (size_t k = 1; k < METRICS_FRAME_LENGTH - 1; k++)
+      checksum += data[i + k];
+    if (checksum != data[i + METRICS_FRAME_LENGTH - 1]) {
+      corrupted++;
+      continue;
+    }
+    structMetricsSnapshot snapshot;
+    memcpy(&snapshot, &data[i + 2], sizeof(snapshot));
+    i += METRICS_FRAME_LENGTH - 1;
+    if (snapshot.format != METRICS_FORMAT) {
+      unknown++;
+      continue;
+    }
+    snapshots++;
+    add(fleet, snapshot);
+    if (sum)
+      continue;
+    printf("== buoy %d (%s), %.3f s since the boot\n", snapshot.buoyID,
+           snapshot.espStatus == 1 ? "master" : snapshot.espStatus == -1 ? "slave" : "no role", snapshot.uptimeMs / 1000.0);
+    metricsTotal one;
+    add(one, snapshot);
+    printMetrics(one);
+  }
+  if (sum && snapshots) {
+    printf("== %llu buoys\n", (unsigned long long)snapshots);
+    printMetrics(fleet);
+  }
+  fprintf(stderr, "%llu snapshots, %llu of another format, %llu corrupted\n", (unsigned long long)snapshots, (unsigned long long)unknown,
+          (unsigned long long)corrupted);
+  return 0;
+}
@@ -0,0 +1,432 @@
+/* ---- Implementation of the Arduino, WiFi and ESP-NOW stand-ins ---- */
+/*
+   Every function works on the buoy which is currently running (simCur) and counts as an API call for the loop() parking (see sim.cpp).
+*/
+#include "sim.h"
+#include "shim/Arduino.h"
+#include "shim/WiFi.h"
+#include "shim/Preferences.h"
+#include "../traceEvents.h"
+#include "../metricsSnapshot.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+#include <sys/stat.h>
+
+HardwareSerial Serial;
+WiFiClass WiFi;
+
+/* ---- Time and random functions ---- */
+unsigned long millis() {
+  if (simCur)
+    simCur->apiCalls++;
+  return simNow() / 1000;
+}
+
+unsigned long micros() {
+  if (simCur)
+    simCur->apiCalls++;
+  return simNow();
+}
+
+void delay(unsigned long ms) {
+  simCur->apiCalls++;
+  simSleep((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  simCur->apiCalls++;
+  simSleep(us);
+}
+
+void yield() {
+  simCur->apiCalls++;
+}
+
+long random(long howBig) {
+  return random(0, howBig);
+}
+
+long random(long howSmall, long howBig) {
+  simCur->apiCalls++;
+  if (howSmall >= howBig)
+    return howSmall;
+  return std::uniform_int_distribution<long>(howSmall, howBig - 1)(simCur->rng);
+}
+
+void randomSeed(unsigned long seed) {
+  simCur->rng.seed(seed);
+}
+
+/* ---- FreeRTOS ---- */
+/* A task handle is the buoy itself, only its main task can wait for a notification. */
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+  return simCurTask == SIM_TASK_MAIN ? (TaskHandle_t)simCur : nullptr;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  simCur->apiCalls++;
+  if (task)
+    simNotify((simNode *)task);
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait) {
+  simCur->apiCalls++;
+  uint64_t us = ticksToWait == portMAX_DELAY ? (uint64_t)(simCfg.maxTimeMs * 1000) : (uint64_t)ticksToWait * 1000;
+  return simWaitNotify(us, clearCountOnExit);
+}
+
+/* ---- Serial monitor ---- */
+void HardwareSerial::begin(unsigned long baud) {
+  simCur->baud = baud;
+}
+
+/*
+   The bytes are written in the UART FIFO, which is emptied at baud / 10 bytes per second.
+   When the FIFO is full, the task which writes waits for it, as with the Arduino core of the ESP32 (no TX buffer).
+*/
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+  simNode *node = simCur;
+  node->apiCalls++;
+  if (simSerialFile && simCfg.traceNode == node->index)
+    fwrite(buffer, 1, size, simSerialFile);
+  if (simMetricsFile && node->metricsHost)
+    fwrite(buffer, 1, size, simMetricsFile);
+  if (simCfg.traceNode == node->index || simCfg.traceNode == -2) {
+    for (size_t i = 0; i < size; i++) {
+      /* the events of the trace (see trace.h) and the snapshots of the metrics (see metrics.h) are binary, only the text is printed */
+      if (node->traceSkip == 0 && buffer[i] == TRACE_SYNC) {
+        node->traceSkip = TRACE_FRAME_LENGTH - 1;
+      } else if (node->traceSkip == 0 && buffer[i] == METRICS_SYNC) {
+        node->traceSkip = METRICS_FRAME_LENGTH - 1;
+      } else if (node->traceSkip > 0) {
+        node->traceSkip--;
+      } else if (buffer[i] == '\n') {
+        fprintf(stderr, "[%10.3f ms] #%d: %s\n", simNow() / 1000.0, node->index, node->line.c_str());
+        node->line.clear();
+      } else if (buffer[i] != '\r') {
+        node->line += (char)buffer[i];
+      }
+    }
+  }
+  if (!node->baud)
+    return size;
+  double byteUs = 10e6 / node->baud;
+  double t = (double)simNow();
+  node->uartEmptyAt = std::max(node->uartEmptyAt, t) + size * byteUs;
+  simConsume(node->uartEmptyAt - simCfg.uartFifoBytes * byteUs - t);
+  return size;
+}
+
+int HardwareSerial::available() {
+  simCur->apiCalls++;
+  return (int)simCur->serialRx.size();
+}
+
+int HardwareSerial::read() {
+  simNode *node = simCur;
+  node->apiCalls++;
+  if (node->serialRx.empty())
+    return -1;
+  int c = node->serialRx.front();
+  node->serialRx.pop_front();
+  return c;
+}
+
+int HardwareSerial::availableForWrite() {
+  simNode *node = simCur;
+  node->apiCalls++;
+  if (!node->baud)
+    return simCfg.uartFifoBytes;
+  double pending = (node->uartEmptyAt - (double)simNow()) * node->baud / 10e6;
+  return std::max(0, simCfg.uartFifoBytes - (int)std::ceil(std::max(0.0, pending)));
+}
+
+/* ---- WiFi ---- */
+bool WiFiClass::mode(wifi_mode_t /*mode*/) {
+  simCur->apiCalls++;
+  return true;
+}
+
+String WiFiClass::macAddress() {
+  char buf[18];
+  const uint8_t *mac = simCur->mac;
+  snprintf(buf, sizeof(buf), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  return String(buf);
+}
+
+uint8_t *WiFiClass::macAddress(uint8_t *mac) {
+  memcpy(mac, simCur->mac, ESP_NOW_ETH_ALEN);
+  return mac;
+}
+
+/* ---- ESP-NOW ---- */
+static esp_now_peer_info_t *findPeer(simNode *node, const uint8_t *mac) {
+  for (esp_now_peer_info_t &peer : node->peers)
+    if (!memcmp(peer.peer_addr, mac, ESP_NOW_ETH_ALEN))
+      return &peer;
+  return nullptr;
+}
+
+esp_err_t esp_now_init(void) {
+  simCur->apiCalls++;
+  simCur->espnowInit = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_deinit(void) {
+  simCur->apiCalls++;
+  simCur->espnowInit = false;
+  simCur->peers.clear();
+  return ESP_OK;
+}
+
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb) {
+  if (!simCur->espnowInit)
+    return ESP_ERR_ESPNOW_NOT_INIT;
+  simCur->sendCb = cb;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb) {
+  if (!simCur->espnowInit)
+    return ESP_ERR_ESPNOW_NOT_INIT;
+  simCur->recvCb = cb;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer) {
+  simNode *node = simCur;
+  node->apiCalls++;
+  if (!node->espnowInit)
+    return ESP_ERR_ESPNOW_NOT_INIT;
+  if (!peer)
+    return ESP_ERR_ESPNOW_ARG;
+  if (findPeer(node, peer->peer_addr))
+    return ESP_ERR_ESPNOW_EXIST;
+  if (node->peers.size() >= ESP_NOW_MAX_TOTAL_PEER_NUM)
+    return ESP_ERR_ESPNOW_FULL;
+  node->peers.push_back(*peer);
+  return ESP_OK;
+}
+
+esp_err_t esp_now_del_peer(const uint8_t *peer_addr) {
+  simNode *node = simCur;
+  node->apiCalls++;
+  if (!node->espnowInit)
+    return ESP_ERR_ESPNOW_NOT_INIT;
+  esp_now_peer_info_t *peer = findPeer(node, peer_addr);
+  if (!peer)
+    return ESP_ERR_ESPNOW_NOT_FOUND;
+  node->peers.erase(node->peers.begin() + (peer - node->peers.data()));
+  return ESP_OK;
+}
+
+bool esp_now_is_peer_exist(const uint8_t *peer_addr) {
+  simCur->apiCalls++;
+  return findPeer(simCur, peer_addr) != nullptr;
+}
+
+/*
+   As with the ESP-IDF, the destination must have been added as a peer (the broadcast address included)
+   and a NULL address sends the frame to every unicast peer.
+*/
+esp_err_t esp_now_send(const uint8_t *peer_addr, const uint8_t *data, size_t len) {
+  simNode *node = simCur;
+  node->apiCalls++;
+  esp_err_t result = ESP_OK;
+  if (!node->espnowInit)
+    result = ESP_ERR_ESPNOW_NOT_INIT;
+  else if (!data || len == 0 || len > ESP_NOW_MAX_DATA_LEN)
+    result = ESP_ERR_ESPNOW_ARG;
+  else if (peer_addr && !findPeer(node, peer_addr))
+    result = ESP_ERR_ESPNOW_NOT_FOUND;
+  else if (peer_addr)
+    result = simSend(node, peer_addr, data, len);
+  else {
+    for (const esp_now_peer_info_t &peer : node->peers) {
+      static const uint8_t broadcast[ESP_NOW_ETH_ALEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+      if (memcmp(peer.peer_addr, broadcast, ESP_NOW_ETH_ALEN) && (result = simSend(node, peer.peer_addr, data, len)) != ESP_OK)
+        break;
+    }
+  }
+  if (result != ESP_OK)
+    simStat.sendErrors++;
+  return result;
+}
+
+/* ---- Preferences (NVS) and LittleFS ---- */
+static std::string flashPath(const simNode *node, const char *extension) {
+  char buf[32];
+  const uint8_t *mac = node->mac;
+  snprintf(buf, sizeof(buf), "/%02X%02X%02X%02X%02X%02X%s", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], extension);
+  return simCfg.nvsDir + buf;
+}
+
+static std::string nvsPath(const simNode *node) {
+  return flashPath(node, ".nvs");
+}
+
+/* directory of the LittleFS files of the current buoy (see shim/LittleFS.h) */
+const char *simFlashDir() {
+  simNode *node = simCur;
+  node->apiCalls++;
+  if (simCfg.nvsDir.empty())
+    return NULL;
+  if (node->flashDir.empty()) {
+    node->flashDir = flashPath(node, ".fs");
+    mkdir(node->flashDir.c_str(), 0755);
+  }
+  return node->flashDir.c_str();
+}
+
+/* The file holds one line per key : the key, a space and the value in hexadecimal. */
+static void nvsLoad(simNode *node) {
+  node->nvsLoaded = true;
+  if (simCfg.nvsDir.empty())
+    return;
+  FILE *file = fopen(nvsPath(node).c_str(), "r");
+  if (!file)
+    return;
+  char key[64], hex[2 * ESP_NOW_MAX_DATA_LEN + 1];
+  while (fscanf(file, "%63s %500s", key, hex) == 2) {
+    std::string value;
+    for (size_t i = 0; hex[2 * i] && hex[2 * i + 1]; i++) {
+      unsigned byte;
+      sscanf(hex + 2 * i, "%2x", &byte);
+      value += (char)byte;
+    }
+    node->nvs[key] = value;
+  }
+  fclose(file);
+}
+
+static void nvsSave(const simNode *node) {
+  if (simCfg.nvsDir.empty())
+    return;
+  FILE *file = fopen(nvsPath(node).c_str(), "w");
+  if (!file)
+    return;
+  for (const auto &entry : node->nvs) {
+    fprintf(file, "%s ", entry.first.c_str());
+    for (unsigned char c : entry.second)
+      fprintf(file, "%02x", c);
+    fprintf(file, "\n");
+  }
+  fclose(file);
+}
+
+bool Preferences::begin(const char *name, bool readOnly, const char * /*partitionLabel*/) {
+  simCur->apiCalls++;
+  if (!name || strlen(name) >= sizeof(nameSpace))
+    return false;
+  if (!simCur->nvsLoaded)
+    nvsLoad(simCur);
+  strcpy(nameSpace, name);
+  this->readOnly = readOnly;
+  started = true;
+  return true;
+}
+
+void Preferences::end() {
+  started = false;
+}
+
+bool Preferences::clear() {
+  if (!started || readOnly)
+    return false;
+  std::string prefix = std::string(nameSpace) + "/";
+  auto &nvs = simCur->nvs;
+  for (auto it = nvs.lower_bound(prefix); it != nvs.end() && !it->first.compare(0, prefix.size(), prefix);)
+    it = nvs.erase(it);
+  nvsSave(simCur);
+  return true;
+}
+
+bool Preferences::remove(const char *key) {
+  if (!started || readOnly || !simCur->nvs.erase(std::string(nameSpace) + "/" + key))
+    return false;
+  nvsSave(simCur);
+  return true;
+}
+
+bool Preferences::isKey(const char *key) {
+  return started && simCur->nvs.count(std::string(nameSpace) + "/" + key);
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len) {
+  simCur->apiCalls++;
+  if (!started || readOnly || !key || strlen(key) > 15 || len > ESP_NOW_MAX_DATA_LEN)
+    return 0;
+  simCur->nvs[std::string(nameSpace) + "/" + key] = std::string((const char *)value, len);
+  nvsSave(simCur);
+  return len;
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+  if (!started)
+    return 0;
+  auto it = simCur->nvs.find(std::string(nameSpace) + "/" + key);
+  return it == simCur->nvs.end() ? 0 : it->second.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen) {
+  simCur->apiCalls++;
+  size_t len = getBytesLength(key);
+  if (len == 0 || len > maxLen)
+    return 0;
+  memcpy(buf, simCur->nvs[std::string(nameSpace) + "/" + key].data(), len);
+  return len;
+}
+
+size_t Preferences::putShort(const char *key, int16_t value) {
+  return putBytes(key, &value, sizeof(value));
+}
+
+int16_t Preferences::getShort(const char *key, int16_t defaultValue) {
+  int16_t value;
+  return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+}
+
+/* ---- Heap of the sketch ---- */
+/*
+   Every allocation is charged to the buoy which is running. The size of a block is known at its release (simAllocator),
+   so the simulator keeps the bytes in use, their high-water mark and the number of allocations.
+*/
+extern "C" void *simHeapAlloc(size_t size) {
+  simNode *node = simCur;
+  if (node) {
+    node->heapAllocs++;
+    node->heapInUse += size;
+    node->heapHighWater = std::max(node->heapHighWater, node->heapInUse);
+  }
+  return malloc(size);
+}
+
+extern "C" void simHeapFree(void *ptr, size_t size) {
+  if (simCur)
+    simCur->heapInUse -= std::min<uint64_t>(size, simCur->heapInUse);
+  free(ptr);
+}
+
+EspClass ESP;
+
+uint32_t EspClass::getHeapSize() {
+  return simCfg.heapBytes;
+}
+
+uint32_t EspClass::getFreeHeap() {
+  simCur->apiCalls++;
+  return simCfg.heapBytes - std::min<uint64_t>(simCur->heapInUse, simCfg.heapBytes);
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+  simCur->apiCalls++;
+  return simCfg.heapBytes - std::min<uint64_t>(simCur->heapHighWater, simCfg.heapBytes);
+}
+
+uint32_t EspClass::getMaxAllocHeap() {
+  return getFreeHeap();
+}
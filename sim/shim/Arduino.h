@@ -0,0 +1,251 @@
+/* ---- Host stand-in for the Arduino core ---- */
+/*
+   This header replaces <Arduino.h> when the sketch is compiled for the simulator (see sim/Makefile).
+   It only provides the part of the Arduino API used by the sketch : String, Serial, delay(), millis(), random()...
+   Everything that depends on the time or on the board is forwarded to the simulator (sim/shim.cpp).
+*/
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <string>
+
+#define HEX 16
+#define DEC 10
+#define F(string_literal) (string_literal)
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+/* setup() and loop() are declared with a C linkage so that the simulator can find them in every copy of the sketch. */
+extern "C" void setup(void);
+extern "C" void loop(void);
+
+/* ---- Time and random functions (implemented by the simulator) ---- */
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+long random(long howBig);
+long random(long howSmall, long howBig);
+void randomSeed(unsigned long seed);
+void yield();
+
+/* ---- FreeRTOS ---- */
+/*
+   The Arduino core of the ESP32 runs on FreeRTOS. Only the direct-to-task notifications of the main task are simulated.
+   A tick lasts 1 ms, as with the Arduino core.
+*/
+typedef void *TaskHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define portMAX_DELAY 0xFFFFFFFFUL
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait);
+
+/* ---- Heap of the sketch ---- */
+/*
+   The memory of the Strings is allocated through simHeapAlloc() and simHeapFree(), which count it in the heap of the buoy
+   (see ESP.getFreeHeap() and the heap columns of the simulator). Without the simulator (microbenchmarks), malloc() is used.
+*/
+extern "C" void *simHeapAlloc(size_t size) __attribute__((weak));
+extern "C" void simHeapFree(void *ptr, size_t size) __attribute__((weak));
+
+/* in the simulator itself both functions are defined, the test of their address is only needed by the microbenchmarks */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Waddress"
+template <typename T> struct simAllocator {
+  typedef T value_type;
+  simAllocator() = default;
+  template <typename U> simAllocator(const simAllocator<U> &) {}
+  T *allocate(size_t n) { return (T *)(simHeapAlloc ? simHeapAlloc(n * sizeof(T)) : malloc(n * sizeof(T))); }
+  void deallocate(T *p, size_t n) {
+    if (simHeapFree)
+      simHeapFree(p, n * sizeof(T));
+    else
+      free(p);
+  }
+  bool operator==(const simAllocator &) const { return true; }
+  bool operator!=(const simAllocator &) const { return false; }
+};
+#pragma GCC diagnostic pop
+
+typedef std::basic_string<char, std::char_traits<char>, simAllocator<char>> simString;
+
+/* ---- ESP32 specific functions (heap of the buoy, implemented by the simulator) ---- */
+class EspClass {
+  public:
+    uint32_t getHeapSize();
+    uint32_t getFreeHeap();
+    uint32_t getMinFreeHeap();
+    uint32_t getMaxAllocHeap();
+};
+
+extern EspClass ESP;
+
+/* ---- Arduino String ---- */
+/*
+   Minimal String class on top of std::basic_string. The behaviour follows the Arduino one :
+   numbers are converted in lower case with String(n, HEX), substring() clamps its bounds, toInt() returns 0 on error.
+*/
+class String {
+  public:
+    String(const char *cstr = "") : s(cstr ? cstr : "") {}
+    String(const std::string &str) : s(str.data(), str.size()) {}
+    String(const simString &str) : s(str) {}
+    String(char c) : s(1, c) {}
+    String(int value, unsigned char base = DEC) { fromSigned(value, base); }
+    String(long value, unsigned char base = DEC) { fromSigned(value, base); }
+    String(unsigned char value, unsigned char base = DEC) { fromUnsigned(value, base); }
+    String(unsigned int value, unsigned char base = DEC) { fromUnsigned(value, base); }
+    String(unsigned long value, unsigned char base = DEC) { fromUnsigned(value, base); }
+    String(double value, unsigned int decimalPlaces = 2) {
+      char buf[64];
+      snprintf(buf, sizeof(buf), "%.*f", (int)decimalPlaces, value);
+      s = buf;
+    }
+
+    unsigned int length() const { return s.size(); }
+    const char *c_str() const { return s.c_str(); }
+    char charAt(unsigned int index) const { return index < s.size() ? s[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+
+    int compareTo(const String &other) const { return s.compare(other.s); }
+    bool equals(const String &other) const { return s == other.s; }
+    bool operator==(const String &other) const { return s == other.s; }
+    bool operator!=(const String &other) const { return s != other.s; }
+
+    int indexOf(const String &str, unsigned int fromIndex = 0) const {
+      size_t pos = s.find(str.s, fromIndex);
+      return pos == simString::npos ? -1 : (int)pos;
+    }
+    int indexOf(char c, unsigned int fromIndex = 0) const {
+      size_t pos = s.find(c, fromIndex);
+      return pos == simString::npos ? -1 : (int)pos;
+    }
+    String substring(unsigned int beginIndex) const { return substring(beginIndex, s.size()); }
+    String substring(unsigned int beginIndex, unsigned int endIndex) const {
+      if (beginIndex > endIndex) {
+        unsigned int temp = beginIndex;
+        beginIndex = endIndex;
+        endIndex = temp;
+      }
+      if (beginIndex >= s.size())
+        return String();
+      if (endIndex > s.size())
+        endIndex = s.size();
+      return String(s.substr(beginIndex, endIndex - beginIndex));
+    }
+
+    long toInt() const { return atol(s.c_str()); }
+    void toUpperCase() { for (auto &c : s) c = toupper((unsigned char)c); }
+    void toLowerCase() { for (auto &c : s) c = tolower((unsigned char)c); }
+    void toCharArray(char *buf, unsigned int bufsize, unsigned int index = 0) const {
+      if (!bufsize || !buf)
+        return;
+      size_t n = index < s.size() ? s.size() - index : 0;
+      if (n > bufsize - 1)
+        n = bufsize - 1;
+      memcpy(buf, s.data() + (index < s.size() ? index : 0), n);
+      buf[n] = 0;
+    }
+
+    String &operator+=(const String &rhs) { s += rhs.s; return *this; }
+    String &operator+=(const char *rhs) { s += rhs; return *this; }
+    String &operator+=(char rhs) { s += rhs; return *this; }
+    friend String operator+(const String &lhs, const String &rhs) { return String(lhs.s + rhs.s); }
+    friend String operator+(const String &lhs, const char *rhs) { return String(lhs.s + rhs); }
+    friend String operator+(const char *lhs, const String &rhs) { return String(lhs + rhs.s); }
+
+  private:
+    simString s;
+
+    void fromUnsigned(unsigned long value, unsigned char base) {
+      char buf[8 * sizeof(long) + 1];
+      char *p = buf + sizeof(buf) - 1;
+      *p = 0;
+      do {
+        unsigned digit = value % base;
+        *--p = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        value /= base;
+      } while (value);
+      s = p;
+    }
+    void fromSigned(long value, unsigned char base) {
+      if (base == DEC && value < 0) {
+        fromUnsigned((unsigned long)(-value), base);
+        s.insert(s.begin(), '-');
+      } else {
+        fromUnsigned((unsigned long)value, base);
+      }
+    }
+};
+
+/* ---- Serial monitor ---- */
+/*
+   The simulator charges every byte written at the baud rate given to begin(), as the UART of the ESP32 does.
+   The output itself is discarded unless the simulator is asked to trace the board or to query its metrics.
+   available() and read() give the bytes written by the host which queries the metrics (see metricsFile in sim.h).
+   availableForWrite() returns the free room of the UART FIFO, as with the Arduino core of the ESP32 (without TX buffer).
+*/
+class HardwareSerial {
+  public:
+    void begin(unsigned long baud);
+    void end() {}
+    void flush() {}
+    int available();
+    int read();
+    int availableForWrite();
+    operator bool() const { return true; }
+    size_t write(const uint8_t *buffer, size_t size);
+    size_t write(uint8_t c) { return write(&c, 1); }
+
+    size_t print(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+    size_t print(const String &str) { return write((const uint8_t *)str.c_str(), str.length()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char value, int base = DEC) { return printNumber(value, base); }
+    size_t print(int value, int base = DEC) { return printSigned(value, base); }
+    size_t print(unsigned int value, int base = DEC) { return printNumber(value, base); }
+    size_t print(long value, int base = DEC) { return printSigned(value, base); }
+    size_t print(unsigned long value, int base = DEC) { return printNumber(value, base); }
+    size_t print(double value, int digits = 2) { return print(String(value, (unsigned int)digits)); }
+
+    size_t println() { return write((const uint8_t *)"\r\n", 2); }
+    template <typename T> size_t println(const T &value) { size_t n = print(value); return n + println(); }
+    template <typename T> size_t println(const T &value, int base) { size_t n = print(value, base); return n + println(); }
+
+  private:
+    /* Print::print() writes the digits of a number in upper case, from a buffer on the stack. */
+    size_t printNumber(unsigned long value, int base, bool negative = false) {
+      char buf[8 * sizeof(long) + 2];
+      char *p = buf + sizeof(buf);
+      do {
+        unsigned digit = value % base;
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        value /= base;
+      } while (value);
+      if (negative)
+        *--p = '-';
+      return write((const uint8_t *)p, buf + sizeof(buf) - p);
+    }
+    size_t printSigned(long value, int base) {
+      if (base == DEC && value < 0)
+        return printNumber(-(unsigned long)value, base, true);
+      return printNumber((unsigned long)value, base);
+    }
+};
+
+extern HardwareSerial Serial;
+
+#endif
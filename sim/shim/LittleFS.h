@@ -0,0 +1,76 @@
+/* ---- Host stand-in for the LittleFS library ---- */
+/*
+   On the ESP32, LittleFS is a file system in a partition of the flash, which survives a reboot and a power loss.
+   In the simulator the files of a buoy are plain files in its own directory, given by simFlashDir() : <nvsDir>/<MAC address>.fs
+   (see shim/Preferences.h). Without nvsDir the buoys have no flash and begin() fails, as with a board without LittleFS partition.
+   Only the part of the FS and File API used by the sketch is provided.
+*/
+#ifndef SIM_LITTLEFS_H
+#define SIM_LITTLEFS_H
+
+#include "Arduino.h"
+
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+/* the directory of the files of the current buoy, NULL if it has no flash (implemented by the simulator) */
+const char *simFlashDir();
+
+class File {
+  public:
+    File() {}
+    explicit File(FILE *file) {
+      if (file)
+        this->file = std::shared_ptr<FILE>(file, fclose);
+    }
+    size_t write(const uint8_t *buf, size_t size) { return file ? fwrite(buf, 1, size, file.get()) : 0; }
+    size_t read(uint8_t *buf, size_t size) { return file ? fread(buf, 1, size, file.get()) : 0; }
+    bool seek(uint32_t pos) { return file && fseek(file.get(), pos, SEEK_SET) == 0; }
+    size_t position() { return file ? ftell(file.get()) : 0; }
+    size_t size() {
+      struct stat st;
+      if (!file)
+        return 0;
+      fflush(file.get());
+      return fstat(fileno(file.get()), &st) == 0 ? st.st_size : 0;
+    }
+    void flush() {
+      if (file)
+        fflush(file.get());
+    }
+    void close() { file.reset(); }
+    operator bool() const { return file != nullptr; }
+
+  private:
+    std::shared_ptr<FILE> file;
+};
+
+class LittleFSFS {
+  public:
+    bool begin(bool /*formatOnFail*/ = false) { return simFlashDir() != NULL; }
+    void end() {}
+    File open(const char *path, const char *mode = FILE_READ) {
+      return simFlashDir() ? File(fopen(fullPath(path).c_str(), mode)) : File();
+    }
+    bool exists(const char *path) {
+      struct stat st;
+      return simFlashDir() && stat(fullPath(path).c_str(), &st) == 0;
+    }
+    bool remove(const char *path) { return simFlashDir() && ::remove(fullPath(path).c_str()) == 0; }
+    bool rename(const char *pathFrom, const char *pathTo) {
+      return simFlashDir() && ::rename(fullPath(pathFrom).c_str(), fullPath(pathTo).c_str()) == 0;
+    }
+
+  private:
+    static std::string fullPath(const char *path) { return std::string(simFlashDir()) + path; }
+};
+
+/* the file system holds no state, the buoy is found by simFlashDir() at every call */
+static LittleFSFS LittleFS;
+
+#endif
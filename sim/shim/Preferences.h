@@ -0,0 +1,33 @@
+/* ---- Host stand-in for the Preferences library ---- */
+/*
+   On the ESP32, Preferences stores small key-value pairs in the NVS partition of the flash, which survives a reboot.
+   In the simulator every buoy has its own NVS. It is kept in memory, so every simulation starts with an empty NVS,
+   unless the option nvsDir is given : the NVS of a buoy is then the file <nvsDir>/<MAC address>.nvs, read at the first
+   begin() and rewritten at every change, so that a second simulation with the same nvsDir reboots the same fleet.
+*/
+#ifndef SIM_PREFERENCES_H
+#define SIM_PREFERENCES_H
+
+#include "Arduino.h"
+
+class Preferences {
+  public:
+    bool begin(const char *name, bool readOnly = false, const char *partitionLabel = NULL);
+    void end();
+    bool clear();
+    bool remove(const char *key);
+    bool isKey(const char *key);
+
+    size_t putShort(const char *key, int16_t value);
+    int16_t getShort(const char *key, int16_t defaultValue = 0);
+    size_t putBytes(const char *key, const void *value, size_t len);
+    size_t getBytesLength(const char *key);
+    size_t getBytes(const char *key, void *buf, size_t maxLen);
+
+  private:
+    char nameSpace[16] = "";
+    bool started = false;
+    bool readOnly = false;
+};
+
+#endif
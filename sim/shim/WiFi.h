@@ -0,0 +1,28 @@
+/* ---- Host stand-in for the WiFi library ---- */
+/*
+   Only the station mode and the MAC address of the board are used by the sketch.
+   The MAC address returned is the one given by the simulator to the virtual buoy.
+*/
+#ifndef SIM_WIFI_H
+#define SIM_WIFI_H
+
+#include "Arduino.h"
+
+typedef enum {
+  WIFI_OFF = 0,
+  WIFI_STA = 1,
+  WIFI_AP = 2,
+  WIFI_AP_STA = 3
+} wifi_mode_t;
+
+class WiFiClass {
+  public:
+    bool mode(wifi_mode_t mode);
+    String macAddress();
+    uint8_t *macAddress(uint8_t *mac);
+    int channel() { return 1; }
+};
+
+extern WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,65 @@
+/* ---- Host stand-in for the ESP-NOW API of the ESP-IDF ---- */
+/*
+   Same types, constants and functions as <esp_now.h>. The frames are given to the simulated radio (sim/sim.cpp)
+   and the callbacks are called by the simulator in the context of the WiFi task of the virtual buoy.
+*/
+#ifndef SIM_ESP_NOW_H
+#define SIM_ESP_NOW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#define ESP_ERR_ESPNOW_BASE 0x3000
+#define ESP_ERR_ESPNOW_NOT_INIT (ESP_ERR_ESPNOW_BASE + 1)
+#define ESP_ERR_ESPNOW_ARG (ESP_ERR_ESPNOW_BASE + 2)
+#define ESP_ERR_ESPNOW_NO_MEM (ESP_ERR_ESPNOW_BASE + 3)
+#define ESP_ERR_ESPNOW_FULL (ESP_ERR_ESPNOW_BASE + 4)
+#define ESP_ERR_ESPNOW_NOT_FOUND (ESP_ERR_ESPNOW_BASE + 5)
+#define ESP_ERR_ESPNOW_INTERNAL (ESP_ERR_ESPNOW_BASE + 6)
+#define ESP_ERR_ESPNOW_EXIST (ESP_ERR_ESPNOW_BASE + 7)
+#define ESP_ERR_ESPNOW_IF (ESP_ERR_ESPNOW_BASE + 8)
+
+#define ESP_NOW_ETH_ALEN 6
+#define ESP_NOW_KEY_LEN 16
+#define ESP_NOW_MAX_TOTAL_PEER_NUM 20
+#define ESP_NOW_MAX_ENCRYPT_PEER_NUM 6
+#define ESP_NOW_MAX_DATA_LEN 250
+
+typedef enum {
+  WIFI_IF_STA = 0,
+  WIFI_IF_AP = 1
+} wifi_interface_t;
+
+typedef struct esp_now_peer_info {
+  uint8_t peer_addr[ESP_NOW_ETH_ALEN];
+  uint8_t lmk[ESP_NOW_KEY_LEN];
+  uint8_t channel;
+  wifi_interface_t ifidx;
+  bool encrypt;
+  void *priv;
+} esp_now_peer_info_t;
+
+typedef enum {
+  ESP_NOW_SEND_SUCCESS = 0,
+  ESP_NOW_SEND_FAIL
+} esp_now_send_status_t;
+
+typedef void (*esp_now_send_cb_t)(const uint8_t *mac_addr, esp_now_send_status_t status);
+typedef void (*esp_now_recv_cb_t)(const uint8_t *mac_addr, const uint8_t *data, int data_len);
+
+esp_err_t esp_now_init(void);
+esp_err_t esp_now_deinit(void);
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb);
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb);
+esp_err_t esp_now_send(const uint8_t *peer_addr, const uint8_t *data, size_t len);
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer);
+esp_err_t esp_now_del_peer(const uint8_t *peer_addr);
+bool esp_now_is_peer_exist(const uint8_t *peer_addr);
+
+#endif
@@ -0,0 +1,658 @@
+/* ---- Discrete-event engine and radio model of the simulator ---- */
+/*
+   The radio model is a single 802.11b-like channel :
+   - a buoy hears every other buoy, or in a line or grid topology only the buoys within range. Out of range, a frame is neither
+     received nor sensed, so two buoys which do not hear each other can corrupt the frames of a buoy between them (hidden terminals).
+   - a buoy senses the channel before sending. If a frame it can hear started more than collisionWindowUs ago, it defers
+     until the end of this frame plus DIFS and a random backoff of [0, cw] slots.
+   - two frames which overlap in time are both corrupted for every receiver which hears both of them (and a buoy which transmits
+     receives nothing).
+   - every correct reception is then lost with the probability lossRate.
+   - a unicast frame waits for an ACK. Without ACK it is sent again up to macRetries times, doubling cw each time.
+     OnDataSent reports the final result. A broadcast frame is always reported as sent.
+   - the ACK of a unicast frame is lost with the probability lossRate too. The receiver drops the retries of a frame it already has,
+     as the sequence control of 802.11 does, but if every ACK is lost OnDataSent reports a failure for a frame which was received.
+   - OnDataSent is not called at all with the probability sendCbLossRate, as if the WiFi task lost the status of the frame.
+*/
+#include "sim.h"
+#include "../metricsSnapshot.h"
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <math.h>
+#include <queue>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <unordered_map>
+
+simConfig simCfg;
+simStats simStat;
+std::vector<simNode *> simNodes;
+simNode *simCur = nullptr;
+simTask simCurTask = SIM_TASK_MAIN;
+FILE *simSerialFile = nullptr;
+FILE *simMetricsFile = nullptr;
+
+enum simEventType { EV_BOOT, EV_WAKE, EV_TX_TRY, EV_FRAME_END, EV_RX_RUN, EV_KILL };
+
+struct simEvent {
+  uint64_t time;
+  uint64_t seq;
+  int type;
+  int node;
+  uint64_t ref;
+  bool operator>(const simEvent &other) const {
+    return time != other.time ? time > other.time : seq > other.seq;
+  }
+};
+
+static std::priority_queue<simEvent, std::vector<simEvent>, std::greater<simEvent>> events;
+static uint64_t eventSeq = 0;
+static uint64_t now = 0;
+static ucontext_t schedCtx;
+static std::deque<simFrame> onAir;
+static uint64_t frameSeq = 0;
+static std::unordered_map<uint64_t, int> macIndex;
+static int assignedCount = 0;
+static std::mt19937_64 radioRng;
+
+static const size_t STACK_SIZE = 256 * 1024;
+
+static void schedule(uint64_t time, int type, int node, uint64_t ref = 0) {
+  events.push({time, eventSeq++, type, node, ref});
+}
+
+static uint64_t macKey(const uint8_t *mac) {
+  uint64_t key = 0;
+  for (int i = 0; i < ESP_NOW_ETH_ALEN; i++)
+    key = (key << 8) | mac[i];
+  return key;
+}
+
+static bool isBroadcast(const uint8_t *mac) {
+  for (int i = 0; i < ESP_NOW_ETH_ALEN; i++)
+    if (mac[i] != 0xFF)
+      return false;
+  return true;
+}
+
+static uint64_t airtime(int len) {
+  return (uint64_t)(simCfg.preambleUs + (len + simCfg.overheadBytes) * 8 / simCfg.bitrateMbps);
+}
+
+static double uniform(std::mt19937_64 &rng) {
+  return std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+}
+
+uint64_t simNow() {
+  if (!simCur)
+    return now;
+  return simCurTask == SIM_TASK_MAIN ? simCur->mainTime : simCur->wifiTime;
+}
+
+bool simInRange(int a, int b) {
+  if (a == b)
+    return false;
+  if (simCfg.topology == "full")
+    return true;
+  double dx = simNodes[a]->x - simNodes[b]->x, dy = simNodes[a]->y - simNodes[b]->y;
+  return dx * dx + dy * dy <= simCfg.range * simCfg.range;
+}
+
+simNode *simFindNode(const uint8_t *mac) {
+  auto it = macIndex.find(macKey(mac));
+  return it == macIndex.end() ? nullptr : simNodes[it->second];
+}
+
+/* ---- Loading one copy of the sketch per buoy ---- */
+/*
+   dlopen() returns the same handle for the same file, so the library is copied in an anonymous memory file for each buoy.
+   The files stay open until every copy is loaded : the paths /proc/self/fd/N must all be different.
+   The static constructors of the sketch (for example myMacAddress = WiFi.macAddress()) run during dlopen(), with simCur set.
+*/
+bool simLoad() {
+  FILE *file = fopen(simCfg.sketchPath.c_str(), "rb");
+  if (!file) {
+    fprintf(stderr, "cannot open %s\n", simCfg.sketchPath.c_str());
+    return false;
+  }
+  std::vector<char> image;
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+    image.insert(image.end(), buf, buf + n);
+  fclose(file);
+
+  struct rlimit limit;
+  if (!getrlimit(RLIMIT_NOFILE, &limit)) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+  std::vector<int> fds;
+
+  if (simCfg.topology != "full" && simCfg.topology != "line" && simCfg.topology != "grid") {
+    fprintf(stderr, "unknown topology %s\n", simCfg.topology.c_str());
+    return false;
+  }
+  int side = (int)ceil(sqrt((double)simCfg.nodes));
+
+  std::mt19937_64 seeder(simCfg.seed);
+  radioRng.seed(seeder());
+  for (int i = 0; i < simCfg.nodes; i++) {
+    simNode *node = new simNode();
+    node->index = i;
+    if (simCfg.topology == "line")
+      node->x = i;
+    else if (simCfg.topology == "grid")
+      node->x = i % side, node->y = i / side;
+    /* Espressif OUI, then the index of the buoy */
+    uint8_t mac[ESP_NOW_ETH_ALEN] = {0x24, 0x0A, 0xC4, 0x00, (uint8_t)(i >> 8), (uint8_t)i};
+    memcpy(node->mac, mac, ESP_NOW_ETH_ALEN);
+    node->rng.seed(seeder());
+    node->cw = simCfg.cwMin;
+    simNodes.push_back(node);
+    macIndex[macKey(node->mac)] = i;
+
+    int fd = memfd_create("buoy", 0);
+    if (fd < 0 || write(fd, image.data(), image.size()) != (ssize_t)image.size()) {
+      perror("memfd");
+      return false;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    simCur = node;
+    node->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    simCur = nullptr;
+    fds.push_back(fd);
+    if (!node->handle) {
+      fprintf(stderr, "dlopen: %s\n", dlerror());
+      return false;
+    }
+    node->setupFn = (void (*)())dlsym(node->handle, "setup");
+    node->loopFn = (void (*)())dlsym(node->handle, "loop");
+    node->myID = (int *)dlsym(node->handle, "myID");
+    node->ESPstatus = (int *)dlsym(node->handle, "ESPstatus");
+    node->sketchRxQueue = (const structRxQueueCounters *)dlsym(node->handle, "rxQueue");
+    node->sketchReliable = (const structReliableStats *)dlsym(node->handle, "reliableStats");
+    node->sketchTelemetry = (const structTelemetryStats *)dlsym(node->handle, "telemetryStats");
+    node->sketchRelay = (const structRelayStats *)dlsym(node->handle, "relayStats");
+    node->sketchFailover = (const structFailoverStats *)dlsym(node->handle, "failoverStats");
+    node->sketchMetrics = (const structMetrics *)dlsym(node->handle, "metrics");
+    node->relayHops = (const int *)dlsym(node->handle, "relayHops");
+    node->tdmaSlot = (const int *)dlsym(node->handle, "tdmaSlot");
+    node->reliableInFlight = (const int *)dlsym(node->handle, "reliableInFlight");
+    if (!node->setupFn || !node->loopFn) {
+      fprintf(stderr, "setup() or loop() not found in %s\n", simCfg.sketchPath.c_str());
+      return false;
+    }
+
+    /* a former master which is alive but no longer the master : the buoys 0 and 1 lose their NVS, the buoy 1 boots first and becomes the master */
+    int first = simCfg.demoteMaster ? 1 : 0;
+    if (simCfg.demoteMaster && i <= 1)
+      node->nvsLoaded = true;
+    node->bootUs = i == first ? 0 : (uint64_t)((simCfg.fleetStartMs + uniform(node->rng) * simCfg.bootSpreadMs) * 1000);
+  }
+  for (int fd : fds)
+    close(fd);
+  if (!simCfg.serialFile.empty() && !(simSerialFile = fopen(simCfg.serialFile.c_str(), "wb"))) {
+    perror(simCfg.serialFile.c_str());
+    return false;
+  }
+  if (!simCfg.metricsFile.empty() && !(simMetricsFile = fopen(simCfg.metricsFile.c_str(), "wb"))) {
+    perror(simCfg.metricsFile.c_str());
+    return false;
+  }
+  return true;
+}
+
+/* ---- Main task of a buoy ---- */
+/*
+   setup() then loop() forever. A loop() which did not call the Arduino or ESP-NOW API at all cannot change anything by itself,
+   so the main task is parked until the next callback instead of spinning every loopTickUs.
+*/
+static void nodeEntry() {
+  simNode *node = simCur;
+  node->setupFn();
+  node->setupDone = true;
+  node->heapAllocsSetup = node->heapAllocs;
+  for (;;) {
+    node->apiCalls = 0;
+    node->loopFn();
+    if (node->apiCalls == 0) {
+      node->parked = true;
+      swapcontext(&node->ctx, &schedCtx);
+    } else {
+      simSleep((uint64_t)simCfg.loopTickUs);
+    }
+  }
+}
+
+static void checkAssigned(simNode *node, uint64_t time) {
+  if (!node->assigned && node->myID && *node->myID != -1) {
+    node->assigned = true;
+    node->assignedUs = time;
+    assignedCount++;
+  }
+}
+
+static void checkReattached(simNode *node, uint64_t time) {
+  if (!simStat.killUs || node->reattached || !node->sketchFailover || !node->ESPstatus)
+    return;
+  if (*node->ESPstatus == 1 || node->sketchFailover->attachments > 0 || (node->idBeforeKill == -1 && *node->myID != -1)) {
+    node->reattached = true;
+    node->reattachedUs = time;
+  }
+}
+
+static void resumeMain(simNode *node) {
+  simCur = node;
+  simCurTask = SIM_TASK_MAIN;
+  node->mainTime = now;
+  swapcontext(&schedCtx, &node->ctx);
+  simCur = nullptr;
+  /* the frames released by the sketch during this run of the main task have been handled now */
+  if (node->sketchRxQueue) {
+    uint32_t tail = node->sketchRxQueue->tail;
+    while (!node->rxArrivals.empty() && (int32_t)(tail - node->rxArrivals.front().first) >= 0) {
+      simStat.handleUs.push_back((uint32_t)(now - node->rxArrivals.front().second));
+      node->rxArrivals.pop_front();
+    }
+  }
+  checkAssigned(node, node->mainTime);
+  checkReattached(node, node->mainTime);
+  if (!node->parked)
+    schedule(node->wakeAt, EV_WAKE, node->index, ++node->wakeGen);
+}
+
+void simSleep(uint64_t us) {
+  simNode *node = simCur;
+  if (simCurTask == SIM_TASK_WIFI) {
+    /* delay() in a callback blocks the WiFi task */
+    node->wifiTime += us;
+    return;
+  }
+  node->mainTime += us;
+  node->wakeAt = node->mainTime;
+  swapcontext(&node->ctx, &schedCtx);
+  simCur = node;
+  simCurTask = SIM_TASK_MAIN;
+}
+
+void simConsume(double us) {
+  if (us <= 0)
+    return;
+  simSleep((uint64_t)(us + 0.5));
+}
+
+/* ---- Direct-to-task notifications ---- */
+/*
+   The main task can wait for a notification with a timeout. A notification given by the WiFi task wakes it up at once,
+   the wake-up of the timeout is then ignored thanks to wakeGen.
+*/
+void simNotify(simNode *node) {
+  node->notifyCount++;
+  if (node->waitingNotify) {
+    node->waitingNotify = false;
+    schedule(simNow(), EV_WAKE, node->index, ++node->wakeGen);
+  }
+}
+
+uint32_t simWaitNotify(uint64_t us, bool clear) {
+  simNode *node = simCur;
+  if (node->notifyCount == 0 && us > 0 && simCurTask == SIM_TASK_MAIN) {
+    node->waitingNotify = true;
+    simSleep(us);
+    node->waitingNotify = false;
+  }
+  uint32_t count = node->notifyCount;
+  if (clear)
+    node->notifyCount = 0;
+  else if (count)
+    node->notifyCount--;
+  return count;
+}
+
+static void boot(simNode *node) {
+  node->booted = true;
+  node->stack.resize(STACK_SIZE);
+  getcontext(&node->ctx);
+  node->ctx.uc_stack.ss_sp = node->stack.data();
+  node->ctx.uc_stack.ss_size = node->stack.size();
+  node->ctx.uc_link = nullptr;
+  simCur = node;
+  makecontext(&node->ctx, nodeEntry, 0);
+  node->wifiBusyUntil = now;
+  resumeMain(node);
+}
+
+/* ---- WiFi task of a buoy ---- */
+static void wakeWifi(simNode *node) {
+  if (!node->rxScheduled && !node->rxQueue.empty()) {
+    node->rxScheduled = true;
+    schedule(std::max(node->rxQueue.front().availableAt, node->wifiBusyUntil), EV_RX_RUN, node->index);
+  }
+}
+
+static void pushRx(simNode *node, const simRxItem &item) {
+  if (!item.sendStatus) {
+    if (node->rxFrames >= simCfg.rxQueueDepth) {
+      simStat.rxDrops++;
+      return;
+    }
+    node->rxFrames++;
+  }
+  node->rxQueue.push_back(item);
+  wakeWifi(node);
+}
+
+static void runWifi(simNode *node) {
+  node->rxScheduled = false;
+  if (node->rxQueue.empty())
+    return;
+  if (node->rxQueue.front().availableAt > now) {
+    wakeWifi(node);
+    return;
+  }
+  simRxItem item = node->rxQueue.front();
+  node->rxQueue.pop_front();
+  simCur = node;
+  simCurTask = SIM_TASK_WIFI;
+  node->wifiTime = now;
+  node->apiCalls++;
+  if (item.sendStatus) {
+    if (node->sendCb)
+      node->sendCb(item.mac, item.status);
+  } else {
+    node->rxFrames--;
+    simStat.delivered++;
+    uint32_t head = node->sketchRxQueue ? node->sketchRxQueue->head : 0;
+    if (node->recvCb)
+      node->recvCb(item.mac, item.data, item.len);
+    if (node->sketchRxQueue && node->sketchRxQueue->head != head)
+      node->rxArrivals.push_back({node->sketchRxQueue->head, item.availableAt});
+  }
+  simStat.callbackMaxUs = std::max(simStat.callbackMaxUs, node->wifiTime - item.availableAt);
+  simCur = nullptr;
+  node->wifiBusyUntil = node->wifiTime;
+  checkAssigned(node, node->wifiTime);
+  checkReattached(node, node->wifiTime);
+  /* a callback may have changed the state read by loop() */
+  if (node->parked) {
+    node->parked = false;
+    schedule(node->wifiBusyUntil, EV_WAKE, node->index, ++node->wakeGen);
+  }
+  wakeWifi(node);
+}
+
+/* ---- Radio ---- */
+esp_err_t simSend(simNode *node, const uint8_t *dst, const uint8_t *data, size_t len) {
+  if ((int)node->txQueue.size() >= simCfg.txQueueDepth)
+    return ESP_ERR_ESPNOW_NO_MEM;
+  simFrame frame;
+  frame.id = 0;
+  frame.tx = node->index;
+  memcpy(frame.dst, dst, ESP_NOW_ETH_ALEN);
+  frame.broadcast = isBroadcast(dst);
+  frame.len = len;
+  memcpy(frame.data, data, len);
+  frame.attempt = 0;
+  frame.delivered = false;
+  node->txQueue.push_back(frame);
+  if (!node->radioBusy) {
+    node->radioBusy = true;
+    schedule(simNow() + (uint64_t)simCfg.txLatencyUs, EV_TX_TRY, node->index);
+  }
+  return ESP_OK;
+}
+
+static uint64_t backoff(simNode *node) {
+  return (uint64_t)(simCfg.difsUs + std::uniform_int_distribution<int>(0, node->cw)(node->rng) * simCfg.slotUs);
+}
+
+static void tryTransmit(simNode *node) {
+  /* the buoy defers if it hears a frame which started long enough ago to be detected */
+  uint64_t busyEnd = 0;
+  for (const simFrame &other : onAir) {
+    if (other.end > now && simInRange(other.tx, node->index) && now - other.start >= simCfg.collisionWindowUs)
+      busyEnd = std::max(busyEnd, other.end);
+  }
+  if (busyEnd > now) {
+    schedule(busyEnd + backoff(node), EV_TX_TRY, node->index);
+    return;
+  }
+  simFrame frame = node->txQueue.front();
+  frame.id = ++frameSeq;
+  frame.start = now;
+  frame.end = now + airtime(frame.len);
+  onAir.push_back(frame);
+  simStat.frames++;
+  simStat.bytes += frame.len;
+  simStat.airtimeUs += frame.end - frame.start;
+  schedule(frame.end, EV_FRAME_END, node->index, frame.id);
+}
+
+static bool corruptedAt(const simFrame &frame, int receiver) {
+  for (const simFrame &other : onAir) {
+    if (other.id == frame.id || other.start >= frame.end || other.end <= frame.start)
+      continue;
+    if (other.tx == receiver || simInRange(other.tx, receiver))
+      return true;
+  }
+  return false;
+}
+
+static bool receive(const simFrame &frame, simNode *receiver, bool &collided, bool duplicate = false) {
+  if (!receiver->booted || !receiver->espnowInit || !simInRange(frame.tx, receiver->index))
+    return false;
+  if (corruptedAt(frame, receiver->index)) {
+    collided = true;
+    return false;
+  }
+  if (simCfg.lossRate > 0 && uniform(radioRng) < simCfg.lossRate) {
+    simStat.lost++;
+    return false;
+  }
+  if (duplicate)
+    return true;
+  simRxItem item;
+  item.sendStatus = false;
+  memcpy(item.mac, simNodes[frame.tx]->mac, ESP_NOW_ETH_ALEN);
+  item.len = frame.len;
+  memcpy(item.data, frame.data, frame.len);
+  item.availableAt = now + (uint64_t)simCfg.rxLatencyUs;
+  pushRx(receiver, item);
+  return true;
+}
+
+static void finishTransmit(simNode *node, bool success, uint64_t time) {
+  simFrame &frame = node->txQueue.front();
+  simRxItem item;
+  item.sendStatus = true;
+  item.status = success ? ESP_NOW_SEND_SUCCESS : ESP_NOW_SEND_FAIL;
+  memcpy(item.mac, frame.dst, ESP_NOW_ETH_ALEN);
+  item.len = 0;
+  item.availableAt = time;
+  if (!success)
+    simStat.txFail++;
+  node->txQueue.pop_front();
+  node->cw = simCfg.cwMin;
+  if (simCfg.sendCbLossRate > 0 && uniform(radioRng) < simCfg.sendCbLossRate)
+    simStat.sendCbLost++;
+  else
+    pushRx(node, item);
+  if (node->txQueue.empty())
+    node->radioBusy = false;
+  else
+    schedule(time, EV_TX_TRY, node->index);
+}
+
+static void endFrame(simNode *node, uint64_t id) {
+  const simFrame *frame = nullptr;
+  for (const simFrame &candidate : onAir)
+    if (candidate.id == id)
+      frame = &candidate;
+  bool collided = false;
+  bool acked = false;
+  if (frame->broadcast) {
+    for (simNode *receiver : simNodes)
+      if (receiver != node)
+        receive(*frame, receiver, collided);
+  } else {
+    simNode *receiver = simFindNode(frame->dst);
+    if (receiver && receiver != node && receive(*frame, receiver, collided, frame->delivered)) {
+      node->txQueue.front().delivered = true;
+      acked = !(simCfg.lossRate > 0 && uniform(radioRng) < simCfg.lossRate);
+      if (!acked)
+        simStat.lost++;
+    }
+  }
+  if (collided)
+    simStat.collisions++;
+
+  if (frame->broadcast) {
+    finishTransmit(node, true, now);
+  } else if (acked) {
+    finishTransmit(node, true, now + (uint64_t)simCfg.ackUs);
+  } else if (node->txQueue.front().attempt < simCfg.macRetries) {
+    node->txQueue.front().attempt++;
+    simStat.macRetries++;
+    node->cw = std::min(2 * node->cw + 1, simCfg.cwMax);
+    schedule(now + (uint64_t)simCfg.ackUs + backoff(node), EV_TX_TRY, node->index);
+  } else {
+    finishTransmit(node, false, now + (uint64_t)simCfg.ackUs);
+  }
+
+  /* frames which can no longer overlap a frame on the air are forgotten */
+  uint64_t horizon = airtime(ESP_NOW_MAX_DATA_LEN);
+  while (!onAir.empty() && onAir.front().end + horizon < now)
+    onAir.pop_front();
+}
+
+/* ---- Power loss of the master ---- */
+/*
+   The master stops at once : it neither sends nor receives anything, its pending events are ignored. The ID of every buoy is kept
+   to check that the new master gives them back. The late buoys (lateNodes) boot now, they ask their ID while the slaves claim theirs.
+*/
+static void killMaster() {
+  for (simNode *node : simNodes) {
+    node->idBeforeKill = node->myID ? *node->myID : -1;
+    if (node->ESPstatus && *node->ESPstatus == 1 && !node->dead) {
+      node->dead = true;
+      node->booted = false;
+    }
+    if (node->index >= simCfg.nodes - simCfg.lateNodes) {
+      node->bootUs = now + (uint64_t)(uniform(node->rng) * simCfg.bootSpreadMs * 1000);
+      schedule(node->bootUs, EV_BOOT, node->index);
+    }
+  }
+  simStat.killUs = now;
+}
+
+/* ---- Query of the metrics (metricsFile) ---- */
+/*
+   The host connected to the Serial of the master asks the metrics of every ID, from 0 to nodes - 1 (see metrics.h). The queries are all
+   written at once, the sketch reads the next one once the previous one is answered. The time given to the queries is returned :
+   60 ms per buoy, more than the timeout of a query which is not answered (METRICS_QUERY_TIMEOUT_MS).
+*/
+static uint64_t queryMetrics() {
+  simNode *host = nullptr;
+  for (simNode *node : simNodes)
+    if (!node->dead && node->ESPstatus && *node->ESPstatus == 1)
+      host = node;
+  if (!host)
+    return 0;
+  host->metricsHost = true;
+  for (int id = 0; id < (int)simNodes.size(); id++) {
+    host->serialRx.push_back(METRICS_SYNC);
+    host->serialRx.push_back(id & 0xFF);
+    host->serialRx.push_back((id >> 8) & 0xFF);
+  }
+  if (host->parked) {
+    host->parked = false;
+    schedule(now, EV_WAKE, host->index, ++host->wakeGen);
+  }
+  return (uint64_t)simNodes.size() * 60000;
+}
+
+/* ---- Event loop ---- */
+void simRun() {
+  for (simNode *node : simNodes)
+    if (node->index < simCfg.nodes - simCfg.lateNodes)
+      schedule(node->bootUs, EV_BOOT, node->index);
+  uint64_t maxTime = (uint64_t)(simCfg.maxTimeMs * 1000);
+  uint64_t settleUntil = UINT64_MAX;
+  bool metricsQueried = false;
+  while (!events.empty()) {
+    /* once the fleet is fully assigned (the late buoys apart), the buoys still run for settleMs */
+    if (assignedCount >= (int)simNodes.size() - simCfg.lateNodes) {
+      if (simCfg.settleMs <= 0 && !simMetricsFile)
+        break;
+      if (settleUntil == UINT64_MAX) {
+        settleUntil = now + (uint64_t)(simCfg.settleMs * 1000);
+        simStat.settleStartUs = now;
+        simStat.settleFramesStart = simStat.frames;
+        simStat.settleCollisionsStart = simStat.collisions;
+        if (simCfg.killMasterMs >= 0)
+          schedule(now + (uint64_t)(simCfg.killMasterMs * 1000), EV_KILL, 0);
+        for (simNode *node : simNodes) {
+          if (node->sketchReliable)
+            simStat.settleBytesStart += node->sketchReliable->deliveredBytes;
+          if (node->sketchTelemetry) {
+            simStat.settleSamplesStart += node->sketchTelemetry->stored;
+            simStat.settleBatchesStart += node->sketchTelemetry->batchesReceived;
+            simStat.settleLatencySumStart += node->sketchTelemetry->latencySumMs;
+            simStat.settleLatencySquaresStart += node->sketchTelemetry->latencySquaresMs;
+          }
+        }
+      }
+    }
+    simEvent event = events.top();
+    /* the metrics are queried once the settle phase is over */
+    if (event.time > settleUntil && simMetricsFile && !metricsQueried) {
+      metricsQueried = true;
+      now = settleUntil;
+      settleUntil += queryMetrics();
+      continue;
+    }
+    if (event.time > maxTime || event.time > settleUntil)
+      break;
+    events.pop();
+    now = event.time;
+    simNode *node = simNodes[event.node];
+    if (node->dead)
+      continue;
+    switch (event.type) {
+      case EV_BOOT:
+        boot(node);
+        break;
+      case EV_WAKE:
+        if (event.ref == node->wakeGen)
+          resumeMain(node);
+        break;
+      case EV_TX_TRY:
+        tryTransmit(node);
+        break;
+      case EV_FRAME_END:
+        endFrame(node, event.ref);
+        break;
+      case EV_RX_RUN:
+        runWifi(node);
+        break;
+      case EV_KILL:
+        killMaster();
+        break;
+    }
+  }
+  simStat.endUs = now;
+  if (simSerialFile) {
+    fclose(simSerialFile);
+    simSerialFile = nullptr;
+  }
+  if (simMetricsFile) {
+    fclose(simMetricsFile);
+    simMetricsFile = nullptr;
+  }
+}
@@ -0,0 +1,228 @@
+/* ---- Host-side ESP-NOW simulator ---- */
+/*
+   The simulator runs N virtual buoys in a single Linux process. Every buoy executes its own copy of the sketch
+   (ESP-NOW_Final.ino compiled as a shared library, see sim/Makefile), so the global variables of utilities.h are not shared.
+   The time is virtual : a discrete-event scheduler orders the boots, the delay(), the radio frames and the callbacks.
+   Each buoy has two tasks, as on the ESP32 :
+   - the main task, which runs setup() then loop() in a coroutine. delay() and the Serial writes suspend it.
+   - the WiFi task, which runs OnDataRecv/OnDataSent one at a time when a frame is received or sent.
+   The radio is a shared channel with configurable latency, loss, carrier-sense window and CSMA backoff (see sim.cpp).
+*/
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <ucontext.h>
+
+#include "shim/esp_now.h"
+#include "../metricsSnapshot.h"
+#include "../moduleStats.h"
+
+/* ---- Configuration of a simulation ---- */
+/*
+   All the durations are in microseconds unless the name says otherwise. Every field can be set from the command line (see main.cpp).
+*/
+struct simConfig {
+  int nodes = 10;                   /* number of buoys, the buoy 0 boots first and becomes the master */
+  std::string topology = "full";    /* "full" : every buoy hears every other one, "line" or "grid" : the buoys hear each other within range */
+  double range = 1;                 /* radio range in spacings of the line or the grid, the buoy 0 is at one end of the line or in a corner */
+  uint64_t seed = 1;
+  double fleetStartMs = 8000;       /* boot time of the other buoys, after the master has finished its MASTER_DETECTION */
+  double bootSpreadMs = 100;        /* the other buoys boot uniformly in [fleetStartMs, fleetStartMs + bootSpreadMs] */
+  double maxTimeMs = 600000;        /* the simulation stops there if the fleet is not fully assigned */
+  double settleMs = 0;              /* the simulation goes on for this time once the fleet is fully assigned */
+  double killMasterMs = -1;         /* the master is powered off this time after the fleet is fully assigned (-1 : never), see failover.h */
+  int lateNodes = 0;                /* the last lateNodes buoys only boot at the power loss of the master (in bootSpreadMs), during the claims */
+  int demoteMaster = 0;             /* warm boot of --brownout 1 : the master of the first boot is alive but no longer the master (see main.cpp) */
+  int requireJoin = 0;              /* the simulation fails (exit status 1) if a buoy has no ID at the end */
+  int requireDelivery = 0;          /* the simulation fails (exit status 1) if a DATA message was neither delivered nor in flight at the end */
+  int requireSameID = 0;            /* the simulation fails (exit status 1) if a slave has another ID after the failover (fo_reid) */
+  double bitrateMbps = 1;           /* ESP-NOW default rate (802.11b, 1 Mbps) */
+  double preambleUs = 192;          /* long PLCP preamble and header */
+  int overheadBytes = 43;           /* MAC header, vendor action frame header and FCS around the ESP-NOW payload */
+  double txLatencyUs = 100;         /* between esp_now_send() and the first channel access */
+  double rxLatencyUs = 50;          /* between the end of a frame and the receive callback */
+  double lossRate = 0;              /* independent loss probability per receiver and per frame */
+  double sendCbLossRate = 0;        /* probability that OnDataSent is never called for a frame sent */
+  double collisionWindowUs = 20;    /* a frame started less than this ago is not sensed by the others (CCA time) */
+  double difsUs = 50;
+  double slotUs = 20;
+  int cwMin = 31;
+  int cwMax = 1023;
+  int macRetries = 7;               /* link-layer retries of a unicast frame without ACK */
+  double ackUs = 314;               /* SIFS + ACK frame */
+  int txQueueDepth = 8;             /* frames waiting in the ESP-NOW driver of a buoy */
+  int rxQueueDepth = 16;            /* received frames waiting for the WiFi task of a buoy */
+  double loopTickUs = 1000;         /* virtual duration of one loop() call */
+  int uartFifoBytes = 128;          /* the Serial writes only block once the UART FIFO is full */
+  int heapBytes = 327680;           /* heap given to the sketch, only the Strings are allocated there (see shim/Arduino.h) */
+  int traceNode = -1;               /* prints the Serial output of this buoy on stderr (-2 : all the buoys) */
+  std::string serialFile;           /* writes the raw Serial output of traceNode in this file, for build/trace_decode */
+  std::string metricsFile;          /* at the end, queries the metrics of every buoy on the Serial of the master and writes its output in this file */
+  std::string sketchPath;           /* the sketch compiled for the host, build/buoy.so by default */
+  std::string nvsDir;               /* directory of the NVS and LittleFS files of the buoys (see shim/Preferences.h), in memory if empty */
+};
+
+/* ---- Counters of a simulation ---- */
+struct simStats {
+  uint64_t frames = 0;              /* frames put on the air, link-layer retries included */
+  uint64_t bytes = 0;               /* ESP-NOW payload bytes put on the air */
+  uint64_t airtimeUs = 0;
+  uint64_t collisions = 0;          /* frames corrupted by another overlapping frame at one of their receivers at least */
+  uint64_t lost = 0;                /* receptions and unicast ACKs lost by the loss model */
+  uint64_t delivered = 0;           /* receptions given to a receive callback */
+  uint64_t rxDrops = 0;             /* receptions dropped because the WiFi task queue was full */
+  uint64_t txFail = 0;              /* OnDataSent called with ESP_NOW_SEND_FAIL */
+  uint64_t sendCbLost = 0;          /* OnDataSent not called (sendCbLossRate) */
+  uint64_t sendErrors = 0;          /* esp_now_send() did not return ESP_OK */
+  uint64_t callbackMaxUs = 0;       /* longest time between a frame or a send status given to the WiFi task and the end of its callback */
+  std::vector<uint32_t> handleUs;   /* time between every frame given to the WiFi task and its handling by the main task of the sketch */
+  uint64_t settleStartUs = 0;       /* time when the fleet was fully assigned, the settle phase starts */
+  uint64_t endUs = 0;               /* time of the end of the simulation */
+  uint64_t settleBytesStart = 0;    /* DATA bytes delivered by the reliable delivery of all the buoys at settleStartUs */
+  uint64_t settleSamplesStart = 0;  /* samples of the telemetry stored by the master at settleStartUs */
+  uint64_t settleFramesStart = 0;   /* frames and collisions at settleStartUs */
+  uint64_t settleCollisionsStart = 0;
+  uint64_t settleBatchesStart = 0;  /* batches of the telemetry received by the master, and the sums of their latencies, at settleStartUs */
+  uint64_t settleLatencySumStart = 0;
+  uint64_t settleLatencySquaresStart = 0;
+  uint64_t killUs = 0;              /* time when the master was powered off (0 if it was not) */
+  uint64_t macRetries = 0;          /* link-layer retries of the unicast frames without ACK */
+};
+
+/* ---- A frame waiting in the ESP-NOW driver or on the air ---- */
+struct simFrame {
+  uint64_t id;
+  int tx;
+  uint8_t dst[ESP_NOW_ETH_ALEN];
+  bool broadcast;
+  uint16_t len;
+  uint8_t data[ESP_NOW_MAX_DATA_LEN];
+  int attempt;
+  bool delivered;                   /* the receiver already has the frame : an ACK was lost, its MAC layer drops the retry */
+  uint64_t start;
+  uint64_t end;
+};
+
+/* ---- An item for the WiFi task : a received frame or a send status ---- */
+struct simRxItem {
+  bool sendStatus;
+  esp_now_send_status_t status;
+  uint8_t mac[ESP_NOW_ETH_ALEN];
+  uint16_t len;
+  uint8_t data[ESP_NOW_MAX_DATA_LEN];
+  uint64_t availableAt;
+};
+
+/* ---- A virtual buoy ---- */
+struct simNode {
+  int index;
+  uint8_t mac[ESP_NOW_ETH_ALEN];
+  double x = 0;                     /* position in the line or the grid */
+  double y = 0;
+  std::mt19937_64 rng;
+
+  /* the copy of the sketch loaded for this buoy */
+  void *handle = nullptr;
+  void (*setupFn)() = nullptr;
+  void (*loopFn)() = nullptr;
+  int *myID = nullptr;
+  int *ESPstatus = nullptr;
+  const structRxQueueCounters *sketchRxQueue = nullptr;
+  const structReliableStats *sketchReliable = nullptr;
+  const structTelemetryStats *sketchTelemetry = nullptr;
+  const structRelayStats *sketchRelay = nullptr;
+  const structFailoverStats *sketchFailover = nullptr;
+  const structMetrics *sketchMetrics = nullptr;
+  const int *relayHops = nullptr;
+  const int *tdmaSlot = nullptr;
+  const int *reliableInFlight = nullptr;
+
+  /* main task */
+  ucontext_t ctx;
+  std::vector<char> stack;
+  uint64_t bootUs = 0;
+  bool booted = false;
+  uint64_t mainTime = 0;
+  uint64_t wakeAt = 0;
+  bool parked = false;
+  uint64_t wakeGen = 0;             /* a wake-up event is ignored if another one has been scheduled since */
+  bool waitingNotify = false;
+  uint32_t notifyCount = 0;         /* FreeRTOS notification value of the main task */
+  uint64_t apiCalls = 0;
+
+  /* WiFi task */
+  uint64_t wifiTime = 0;
+  uint64_t wifiBusyUntil = 0;
+  std::deque<simRxItem> rxQueue;
+  int rxFrames = 0;
+  bool rxScheduled = false;
+  std::deque<std::pair<uint32_t, uint64_t>> rxArrivals; /* head of the receive queue of the sketch after a frame, and its arrival */
+
+  /* ESP-NOW driver */
+  bool espnowInit = false;
+  esp_now_send_cb_t sendCb = nullptr;
+  esp_now_recv_cb_t recvCb = nullptr;
+  std::vector<esp_now_peer_info_t> peers;
+  std::deque<simFrame> txQueue;
+  bool radioBusy = false;
+  int cw = 0;
+
+  /* Serial monitor */
+  unsigned long baud = 0;
+  double uartEmptyAt = 0;
+  std::string line;
+  int traceSkip = 0;                /* bytes of an event of the trace still to skip in line */
+  std::deque<uint8_t> serialRx;     /* bytes written by the host, read by Serial.read() (see metricsFile) */
+  bool metricsHost = false;         /* the host of metricsFile is connected to this buoy */
+
+  /* NVS, the key is "<namespace>/<key>", and directory of the LittleFS files */
+  std::map<std::string, std::string> nvs;
+  bool nvsLoaded = false;
+  std::string flashDir;
+
+  /* heap of the sketch */
+  uint64_t heapInUse = 0;
+  uint64_t heapHighWater = 0;
+  uint64_t heapAllocs = 0;          /* allocations since the boot */
+  uint64_t heapAllocsSetup = 0;     /* allocations made before the end of setup() */
+  bool setupDone = false;
+
+  uint64_t assignedUs = 0;
+  bool assigned = false;
+
+  /* failover (killMasterMs) : the master is dead, the others are reattached once they are the new master or have their ID from it */
+  bool dead = false;
+  int idBeforeKill = -1;
+  uint64_t reattachedUs = 0;
+  bool reattached = false;
+};
+
+enum simTask { SIM_TASK_MAIN, SIM_TASK_WIFI };
+
+extern simConfig simCfg;
+extern simStats simStat;
+extern std::vector<simNode *> simNodes;
+extern simNode *simCur;
+extern simTask simCurTask;
+extern FILE *simSerialFile;
+extern FILE *simMetricsFile;
+
+/* ---- Engine (sim.cpp) ---- */
+bool simLoad();
+void simRun();
+uint64_t simNow();
+void simSleep(uint64_t us);
+void simConsume(double us);
+void simNotify(simNode *node);
+uint32_t simWaitNotify(uint64_t us, bool clear);
+bool simInRange(int a, int b);
+esp_err_t simSend(simNode *node, const uint8_t *dst, const uint8_t *data, size_t len);
+simNode *simFindNode(const uint8_t *mac);
+
+#endif
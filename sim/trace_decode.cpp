@@ -0,0 +1,121 @@
+/* ---- Decoder of the trace of the sketch ---- */
+/*
+   USAGE : trace_decode [--events] [file]
+   Reads the raw output of the serial monitor of a buoy (a file written by espnow_sim --traceNode N --serialFile F, or a capture of the
+   UART of a board) and prints it with the events of the trace (see trace.h) decoded :
+   - an event is printed as its time in milliseconds, its level and its message (the formats of traceEvents.h).
+   - the text printed by the sketch is copied as it is, unless --events is given.
+   An event whose checksum is wrong is counted and skipped. The number of events and of events lost by the sketch is printed at the end.
+   The snapshots of the metrics (see metrics.h) are skipped, they are decoded by metrics_decode.
+*/
+#include "../traceEvents.h"
+#include "../metricsSnapshot.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#define TRACE_EVENT_NAME(name, level, format) #name,
+#define TRACE_EVENT_FORMAT(name, level, format) format,
+
+static const char *const eventNames[] = {"TRACE_EVENT_NONE", TRACE_EVENTS(TRACE_EVENT_NAME)};
+static const char *const eventFormats[] = {"", TRACE_EVENTS(TRACE_EVENT_FORMAT)};
+static const char *const levelNames[] = {"", "ERROR", "INFO", "DEBUG"};
+
+/* ---- Printing of an event ---- */
+static void printEvent(const structTraceRecord &record) {
+  printf("[%10.3f ms] ", record.time / 1000.0);
+  if (record.event == TRACE_EVENT_NONE || record.event >= TRACE_EVENT_COUNT) {
+    printf("unknown event %u : %u %u %u\n", record.event, record.a, record.b, record.c);
+    return;
+  }
+  printf("%-5s ", levelNames[traceEventLevel[record.event]]);
+  for (const char *p = eventFormats[record.event]; *p; p++) {
+    if (*p != '%' || !p[1]) {
+      putchar(*p);
+      continue;
+    }
+    switch (*++p) {
+      case 'a': printf("%u", record.a); break;
+      case 'b': printf("%u", record.b); break;
+      case 'c': printf("%u", record.c); break;
+      case 'm':
+        printf("%02X:%02X:%02X:%02X:%02X:%02X", record.b & 0xFF, (record.b >> 8) & 0xFF, (record.b >> 16) & 0xFF, record.b >> 24,
+               record.c & 0xFF, (record.c >> 8) & 0xFF);
+        break;
+      default: putchar(*p); break;
+    }
+  }
+  printf("  (%s)\n", eventNames[record.event] + strlen("TRACE_"));
+}
+
+int main(int argc, char **argv) {
+  bool eventsOnly = false;
+  const char *path = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--events"))
+      eventsOnly = true;
+    else
+      path = argv[i];
+  }
+  FILE *file = path ? fopen(path, "rb") : stdin;
+  if (!file) {
+    perror(path);
+    return 1;
+  }
+  std::vector<uint8_t> data;
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+    data.insert(data.end(), buf, buf + n);
+  if (path)
+    fclose(file);
+
+  /* the text is split in lines, an event can start anywhere : the sketch writes it in one piece between two pieces of text */
+  uint64_t events = 0, corrupted = 0, lost = 0, snapshots = 0;
+  std::string line;
+  for (size_t i = 0; i < data.size();) {
+    if (data[i] == TRACE_SYNC && i + TRACE_FRAME_LENGTH <= data.size()) {
+      uint8_t sum = 0;
+      for (size_t k = 1; k <= sizeof(structTraceRecord); k++)
+        sum += data[i + k];
+      if (sum == data[i + TRACE_FRAME_LENGTH - 1]) {
+        structTraceRecord record;
+        memcpy(&record, &data[i + 1], sizeof(record));
+        printEvent(record);
+        events++;
+        if (record.event == TRACE_LOST)
+          lost += record.a;
+        i += TRACE_FRAME_LENGTH;
+        continue;
+      }
+      corrupted++;
+      i++;
+      continue;
+    }
+    if (data[i] == METRICS_SYNC && i + METRICS_FRAME_LENGTH <= data.size() && data[i + 1] == sizeof(structMetricsSnapshot)) {
+      uint8_t sum = 0;
+      for (size_t k = 1; k < METRICS_FRAME_LENGTH - 1; k++)
+        sum += data[i + k];
+      if (sum == data[i + METRICS_FRAME_LENGTH - 1]) {
+        snapshots++;
+        i += METRICS_FRAME_LENGTH;
+        continue;
+      }
+    }
+    if (data[i] == '\n') {
+      if (!eventsOnly)
+        printf("%s\n", line.c_str());
+      line.clear();
+    } else if (data[i] != '\r') {
+      line += (char)data[i];
+    }
+    i++;
+  }
+  if (!line.empty() && !eventsOnly)
+    printf("%s\n", line.c_str());
+  fprintf(stderr, "%llu events, %llu events lost by the sketch, %llu corrupted, %llu snapshots of the metrics skipped\n",
+          (unsigned long long)events, (unsigned long long)lost, (unsigned long long)corrupted, (unsigned long long)snapshots);
+  return 0;
+}
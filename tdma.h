@@ -0,0 +1,254 @@
+#ifndef TDMA_H
+#define TDMA_H
+
+/* ---- Declaration of librairies ---- */
+#include <Arduino.h>
+#include <stdint.h>
+#include <string.h>
+#include "message.h"
+#include "buoyRegistry.h"
+
+/* ---- Declaration of constants ---- */
+/*
+    The time slots of the slaves (TDMA) use the following constants :
+    - TDMA_SLOT_MS, the duration of a slot : a DATA message of 250 bytes, its WiFi acknowledgement and the DATA_ACK of the master.
+      With 0, there is no slot nor BEACON : the slaves send as soon as they want (free contention, as before).
+    - TDMA_SLOTS, the number of slots of a superframe (at most 256). The slot 0 is the BEACON of the master, the other slots are given
+      to the slaves, except the slots of the master. A slave without slot sends in free contention.
+    - TDMA_MASTER_EVERY, the spacing of the slots of the master : the slots 0, TDMA_MASTER_EVERY, 2 * TDMA_MASTER_EVERY... belong to the
+      master, which sends its HEARTBEAT and its ID_REPLY_BATCH there (see tdmaMasterMayTransmit()). 8 slots are 40 ms, and leave 224 slots
+      to the slaves. TDMA_MASTER_PERIOD_MS, the time between two slots of the master.
+    - TDMA_SILENT_FRAMES, the number of superframes without message of a slave after which its slot is given back. Only the slaves which
+      send their telemetry (see telemetry.h) are sure to be heard in this time : without telemetry, the slots are never given back.
+    - TDMA_BEACON_ENTRIES, the number of slots described by a BEACON : the whole table of the slots is sent in TDMA_SLOTS / TDMA_BEACON_ENTRIES BEACON.
+*/
+#ifndef TDMA_SLOT_MS
+#define TDMA_SLOT_MS 5
+#endif
+#ifndef TDMA_SLOTS
+#define TDMA_SLOTS 256
+#endif
+#ifndef TDMA_SILENT_FRAMES
+#define TDMA_SILENT_FRAMES 5
+#endif
+#ifndef TDMA_MASTER_EVERY
+#define TDMA_MASTER_EVERY 8
+#endif
+#define TDMA_BEACON_ENTRIES 32
+
+#define TDMA_SLOT_US ((uint32_t)TDMA_SLOT_MS * 1000)
+#define TDMA_FRAME_US (TDMA_SLOT_US * TDMA_SLOTS)
+#define TDMA_MASTER_PERIOD_MS (TDMA_SLOT_MS * TDMA_MASTER_EVERY)
+
+static_assert((TDMA_SLOTS >= 2) && (TDMA_SLOTS <= 256), "TDMA_SLOTS must be between 2 and 256");
+static_assert(TDMA_SLOTS % TDMA_BEACON_ENTRIES == 0, "the BEACON describe the slots by groups of TDMA_BEACON_ENTRIES");
+static_assert((TDMA_MASTER_EVERY >= 2) && (TDMA_SLOTS % TDMA_MASTER_EVERY == 0), "the slots of the master must divide the superframe");
+
+/* ---- Definition of the time slots ---- */
+/*
+   The master gives a slot to a slave with its ID (ID_REPLY and ID_REPLY_BATCH carry the slot after the ID, -1 if there is none), and
+   broadcasts a BEACON at the beginning of every superframe, in the slot 0. The payload of a BEACON is :
+   the time of the master (millis(), 4 bytes), the number of slots described (1 byte), then every slot : its number (1 byte) and the ID
+   of its owner (2 bytes, -1 if it is free), and the number of hops of its sender to the master (1 byte, 0 for the master, see relay.h).
+   Every BEACON describes the next TDMA_BEACON_ENTRIES slots of the table, in turn.
+   - a slave aligns its superframe on the reception of the BEACON, and the time of its samples on the time of the master (see telemetry.h).
+     It sends a DATA message only in the first half of its slot, once per superframe, so that the DATA_ACK of the master ends
+     in the slot. It learns a new slot, or the loss of its slot, from the BEACON.
+   - the master gives a slot to a slave which joins, or which sends a message without slot, and gives it back once the slave has been
+     silent for TDMA_SILENT_FRAMES superframes : the slots are redistributed as the fleet changes. Every message of the slave counts,
+     and a slave silent for long is only a dead one when it sends its telemetry periodically.
+   - the slots of the master (every TDMA_MASTER_EVERY slots) are described as owned by the ID 0. The master sends its broadcasts there
+     (its HEARTBEAT, see failover.h, and its ID_REPLY_BATCH), so that they never fall in the slot of a slave. The DATA_ACK of a DATA message
+     sent in a slot is sent at once, it ends in this slot.
+   A slave which has no slot, or which has not heard a BEACON for TDMA_SILENT_FRAMES superframes, sends in free contention.
+
+   State of a slave :
+   - tdmaSlot, its slot (-1 if it has none).
+   - tdmaFrameStart, the beginning of the current superframe (micros()), and tdmaBeaconAt, the reception of the last BEACON (millis()).
+   - tdmaTimeOffset, the time of the master minus the time of the slave, in milliseconds.
+   - tdmaSentAt, the time of the last DATA message sent in the slot (micros()).
+   State of the master :
+   - tdmaSlotOwner, the ID of the owner of every slot (-1 if it is free, 0 for the master), tdmaLastHeard, the superframe in which it was last heard.
+   - tdmaBuoySlot, the slot of every buoy (-1 if it has none).
+   - tdmaFrame, the number of the current superframe, which started at tdmaFrameStart. tdmaBeaconNext, the first slot of the next BEACON.
+*/
+int tdmaSlot = -1;
+bool tdmaAligned = false;
+uint32_t tdmaFrameStart;
+unsigned long tdmaBeaconAt;
+int32_t tdmaTimeOffset = 0;
+uint32_t tdmaSentAt;
+
+int16_t tdmaSlotOwner[TDMA_SLOTS];
+uint16_t tdmaLastHeard[TDMA_SLOTS];
+int16_t tdmaBuoySlot[BUOY_MAX];
+uint16_t tdmaFrame = 0;
+int tdmaBeaconNext = 0;
+
+/* ---- Procedure for initialising the time slots ---- */
+void initTdma() {
+  tdmaSlot = -1;
+  tdmaAligned = false;
+  tdmaTimeOffset = 0;
+  for (int i = 0; i < TDMA_SLOTS; i++)
+    tdmaSlotOwner[i] = -1;
+  for (int i = 0; i < BUOY_MAX; i++)
+    tdmaBuoySlot[i] = -1;
+  for (int i = 0; i < TDMA_SLOTS; i += TDMA_MASTER_EVERY)
+    tdmaSlotOwner[i] = 0;
+  tdmaFrame = 0;
+  tdmaBeaconNext = 0;
+}
+
+/* ---- Procedure for giving a slot to a buoy (master) ---- */
+/*
+   INPUT : the ID of the buoy (int).
+   OUTPUT : the slot of the buoy, -1 if there is no free slot or no TDMA (int).
+   DESCRITPION : A buoy keeps its slot. Else it takes the first free slot, and is counted as heard in the current superframe.
+*/
+int tdmaAssignSlot(int buoyID) {
+  if ((TDMA_SLOT_MS == 0) || (buoyID <= 0) || (buoyID >= BUOY_MAX))
+    return -1;
+  if (tdmaBuoySlot[buoyID] != -1)
+    return tdmaBuoySlot[buoyID];
+  for (int slot = 1; slot < TDMA_SLOTS; slot++) {
+    if (tdmaSlotOwner[slot] == -1) {
+      tdmaSlotOwner[slot] = buoyID;
+      tdmaLastHeard[slot] = tdmaFrame;
+      tdmaBuoySlot[buoyID] = slot;
+      return slot;
+    }
+  }
+  return -1;
+}
+
+/* ---- Procedure for recording a message of a buoy (master) ---- */
+/*
+   INPUT : the ID of the buoy (int).
+   OUTPUT : nothing (void).
+   DESCRITPION : The buoy is counted as heard in the current superframe. A buoy without slot gets one, which it learns from the BEACON.
+*/
+void tdmaHeard(int buoyID) {
+  int slot = tdmaAssignSlot(buoyID);
+  if (slot != -1)
+    tdmaLastHeard[slot] = tdmaFrame;
+}
+
+/* ---- Procedure for starting a superframe (master) ---- */
+/*
+   INPUT : true if the slaves send periodically, so that a silent slave is a dead one (bool).
+   OUTPUT : true if a new superframe starts and its BEACON must be sent (bool).
+   DESCRITPION : It must be called regularly by the master. At the beginning of a superframe, the slots of the slaves silent for
+   TDMA_SILENT_FRAMES superframes are given back, if the slaves send periodically.
+*/
+bool tdmaBeaconDue(bool reclaim) {
+  if (TDMA_SLOT_MS == 0)
+    return false;
+  uint32_t now = micros();
+  if (tdmaAligned && (now - tdmaFrameStart < TDMA_FRAME_US))
+    return false;
+  /*a late master starts the superframe now instead of catching up the superframes missed.*/
+  tdmaFrameStart = (tdmaAligned && (now - tdmaFrameStart < 2 * TDMA_FRAME_US)) ? tdmaFrameStart + TDMA_FRAME_US : now;
+  tdmaAligned = true;
+  tdmaFrame++;
+  for (int slot = 1; reclaim && (slot < TDMA_SLOTS); slot++) {
+    if ((tdmaSlotOwner[slot] > 0) && ((uint16_t)(tdmaFrame - tdmaLastHeard[slot]) > TDMA_SILENT_FRAMES)) {
+      tdmaBuoySlot[tdmaSlotOwner[slot]] = -1;
+      tdmaSlotOwner[slot] = -1;
+    }
+  }
+  return true;
+}
+
+/* ---- Procedure for asking to send a broadcast of the master (master) ---- */
+/*
+   INPUT : nothing (void).
+   OUTPUT : true if the master may send a broadcast now (bool).
+   DESCRITPION : Without TDMA, or before the first BEACON, the master sends at once. Else it sends in the first half of its slots.
+*/
+bool tdmaMasterMayTransmit() {
+#if TDMA_SLOT_MS == 0
+  return true;
+#else
+  if (!tdmaAligned)
+    return true;
+  uint32_t offset = (micros() - tdmaFrameStart) % TDMA_FRAME_US;
+  return ((offset / TDMA_SLOT_US) % TDMA_MASTER_EVERY == 0) && (offset % TDMA_SLOT_US < TDMA_SLOT_US / 2);
+#endif
+}
+
+/* ---- Procedure for preparing a BEACON (master) ---- */
+/*
+   INPUT : the message (structMessage), the ID of the board (int).
+   OUTPUT : the length of the message (int).
+*/
+int prepareBeacon(structMessage *msg, int senderID) {
+  int len = prepareMessage(msg, BEACON, senderID, -1);
+  uint32_t time = millis();
+  memcpy((uint8_t *)msg + len, &time, sizeof(time));
+  len += sizeof(time);
+  ((uint8_t *)msg)[len++] = TDMA_BEACON_ENTRIES;
+  for (int i = 0; i < TDMA_BEACON_ENTRIES; i++) {
+    int slot = (tdmaBeaconNext + i) % TDMA_SLOTS;
+    ((uint8_t *)msg)[len++] = slot;
+    len = putID(msg, len, tdmaSlotOwner[slot]);
+  }
+  tdmaBeaconNext = (tdmaBeaconNext + TDMA_BEACON_ENTRIES) % TDMA_SLOTS;
+  ((uint8_t *)msg)[len++] = 0;
+  return len;
+}
+
+/* ---- Procedure for receiving a BEACON (slave) ---- */
+/*
+   INPUT : the message (structMessage), its length (int), the ID of the board (int) and the time of its reception (uint32_t, micros()).
+   OUTPUT : nothing (void).
+   DESCRITPION : The superframe starts when the BEACON has been sent : its reception by the WiFi callback, not its handling after the
+   receive queue (see rxQueue.h), is moved back by the time of the BEACON on the air at 1 Mbps (its length, the 43 bytes around an
+   ESP-NOW payload and the 192 microseconds of preamble). The slot of the board is read in the slots described.
+   NB : A BEACON relayed (see relay.h) is late by the time spent in the relays, the slots far from the master are less precise.
+*/
+void tdmaReceiveBeacon(const structMessage *msg, int len, int myID, uint32_t receivedAt) {
+  if ((TDMA_SLOT_MS == 0) || (len < (int)MESSAGE_HEADER_LENGTH + 5))
+    return;
+  tdmaFrameStart = receivedAt - (192 + (len + 43) * 8);
+  tdmaBeaconAt = millis() - (micros() - receivedAt) / 1000;
+  tdmaAligned = true;
+  uint32_t masterTime;
+  memcpy(&masterTime, msg->payload, sizeof(masterTime));
+  tdmaTimeOffset = (int32_t)(masterTime - tdmaBeaconAt);
+  int count = msg->payload[4];
+  for (int i = 0; (i < count) && ((int)MESSAGE_HEADER_LENGTH + 5 + (i + 1) * 3 <= len); i++) {
+    int slot = msg->payload[5 + 3 * i];
+    int owner = getID(msg, MESSAGE_HEADER_LENGTH + 5 + 3 * i + 1);
+    if (owner == myID)
+      tdmaSlot = slot;
+    else if (slot == tdmaSlot)
+      tdmaSlot = -1;
+  }
+}
+
+/* ---- Procedure for asking to send a DATA message (slave) ---- */
+/*
+   INPUT : nothing (void).
+   OUTPUT : true if the board may send a DATA message now (bool).
+   DESCRITPION : Without slot, or without BEACON for TDMA_SILENT_FRAMES superframes, the board sends at once (free contention).
+   Else it may send once per superframe, in the first half of its slot : a true answer uses the slot of the current superframe.
+   NB : It is called by the reliable delivery (see reliable.h) before every transmission of a DATA message.
+*/
+bool tdmaMayTransmit() {
+#if TDMA_SLOT_MS == 0
+  return true;
+#else
+  if ((tdmaSlot <= 0) || !tdmaAligned
+      || (millis() - tdmaBeaconAt > (unsigned long)TDMA_SILENT_FRAMES * TDMA_FRAME_US / 1000))
+    return true;
+  uint32_t now = micros();
+  uint32_t offset = (now - tdmaFrameStart) % TDMA_FRAME_US;
+  if ((offset < tdmaSlot * TDMA_SLOT_US) || (offset >= tdmaSlot * TDMA_SLOT_US + TDMA_SLOT_US / 2) || (now - tdmaSentAt < TDMA_FRAME_US / 2))
+    return false;
+  tdmaSentAt = now;
+  return true;
+#endif
+}
+
+#endif
@@ -0,0 +1,271 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+/* ---- Declaration of librairies ---- */
+#include <Arduino.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "message.h"
+#include "buoyRegistry.h"
+#include "macAddress.h"
+#include "tdma.h"
+#include "reliable.h"
+#include "moduleStats.h"
+
+/* ---- Declaration of constants ---- */
+/*
+    The telemetry uses the following constants :
+    - TELEMETRY_PERIOD_MS, the time between two samples of a slave. With 0, the slaves do not sample.
+    - TELEMETRY_VALUES, the number of values of a sample.
+    - TELEMETRY_BATCH, the number of samples packed in a DATA message before it is sent (at most TELEMETRY_BATCH_MAX, 29).
+    - TELEMETRY_FLUSH_MS, the maximum age of the first sample of a batch : an incomplete batch is sent after this time.
+    - TELEMETRY_RING_LENGTH, the number of samples kept by the master for every buoy. It must be a power of 2, and hold a whole batch.
+    - TELEMETRY_BUOY_MAX, the number of buoys whose samples are kept by the master (the buoys 0 to TELEMETRY_BUOY_MAX - 1).
+      The ring buffers are a global variable : they take TELEMETRY_BUOY_MAX * (TELEMETRY_RING_LENGTH * 10 + 8) bytes of the RAM of every
+      board, slaves included : 10.3 kB with the default values, 82 kB with TELEMETRY_BUOY_MAX=256 for a master which keeps the samples
+      of a larger fleet.
+    - TELEMETRY_EXPORT, the master writes the samples received on the serial monitor (1) or only keeps them (0).
+*/
+#ifndef TELEMETRY_PERIOD_MS
+#define TELEMETRY_PERIOD_MS 0
+#endif
+#define TELEMETRY_VALUES 3
+#ifndef TELEMETRY_BATCH
+#define TELEMETRY_BATCH TELEMETRY_BATCH_MAX
+#endif
+#ifndef TELEMETRY_FLUSH_MS
+#define TELEMETRY_FLUSH_MS 1000
+#endif
+#ifndef TELEMETRY_RING_LENGTH
+#define TELEMETRY_RING_LENGTH 32
+#endif
+#ifndef TELEMETRY_BUOY_MAX
+#define TELEMETRY_BUOY_MAX 32
+#endif
+#ifndef TELEMETRY_EXPORT
+#define TELEMETRY_EXPORT 0
+#endif
+
+/*
+   TELEMETRY_SAMPLE_LENGTH is the length of a sample in a DATA message, TELEMETRY_BATCH_MAX the number of them which fit in a message after
+   the number of samples (1 byte) and the time of the first one (4 bytes).
+*/
+#define TELEMETRY_SAMPLE_LENGTH (2 + 2 * TELEMETRY_VALUES)
+#define TELEMETRY_BATCH_MAX ((int)(MESSAGE_LENGTH_MAX - MESSAGE_HEADER_LENGTH - 5) / TELEMETRY_SAMPLE_LENGTH)
+
+static_assert((TELEMETRY_BATCH > 0) && (TELEMETRY_BATCH <= TELEMETRY_BATCH_MAX), "TELEMETRY_BATCH must be between 1 and TELEMETRY_BATCH_MAX");
+static_assert(TELEMETRY_FLUSH_MS < 65536, "the samples of a batch are dated in milliseconds from the first one, on 16 bits");
+static_assert((TELEMETRY_RING_LENGTH & (TELEMETRY_RING_LENGTH - 1)) == 0, "TELEMETRY_RING_LENGTH must be a power of 2");
+static_assert(TELEMETRY_RING_LENGTH >= TELEMETRY_BATCH, "a ring buffer must hold a whole batch");
+static_assert((TELEMETRY_BUOY_MAX > 0) && (TELEMETRY_BUOY_MAX <= BUOY_MAX), "TELEMETRY_BUOY_MAX must be between 1 and BUOY_MAX");
+static_assert((TELEMETRY_PERIOD_MS == 0) || (TDMA_SLOT_MS == 0)
+                  || (TELEMETRY_FLUSH_MS + TELEMETRY_PERIOD_MS < (TDMA_SILENT_FRAMES - 1) * (TDMA_FRAME_US / 1000)),
+              "a slave which sends its telemetry must be heard before its time slot is given back (see tdma.h)");
+
+/* ---- Definition of the telemetry ---- */
+/*
+   A slave takes a sample every TELEMETRY_PERIOD_MS : its time (millis() of the slave) and TELEMETRY_VALUES values. The time is sent
+   in the time of the master, given by the BEACON (see tdma.h), or in the time of the slave without BEACON.
+   The samples are packed in a batch, a DATA message sent with the reliable delivery (see reliable.h) to the master once it holds
+   TELEMETRY_BATCH samples or once its first sample is TELEMETRY_FLUSH_MS old. The payload of the DATA message is :
+   the number of samples (1 byte), the time of the first sample (4 bytes), then every sample : its time from the first one
+   in milliseconds (2 bytes) and its values (2 bytes each). A message carries up to 29 samples for one header.
+   If the window of the reliable delivery is full, the batch waits and keeps the new samples. Once it is full, the new samples are dropped.
+
+   The master keeps the last TELEMETRY_RING_LENGTH samples of every buoy in a ring buffer indexed by its ID (the ID of the registry).
+   The samples of a buoy whose ID is TELEMETRY_BUOY_MAX or more are acknowledged but not kept (counted in unstored).
+   The latency of a batch is the age of its last sample when the master receives it : its maximum, sum and sum of squares give its mean
+   and its jitter (standard deviation).
+   With TELEMETRY_EXPORT, it writes them on the serial monitor, one line per sample :
+   "T,<buoyID>,<MAC address>,<time in ms>,<value 0>,<value 1>,<value 2>"
+   The lines are written as long as the UART has room for them, a sample overwritten in its ring before being written is counted.
+   On Linux, the serial monitor of the master is written in a file by espnow_sim --traceNode 0 --serialFile F (see sim/trace_decode.cpp).
+   - telemetryBatch, the batch of the slave, with the number of its samples and the time of the first one.
+   - telemetryStore, the ring buffers of the master : the samples of every buoy, the number of samples received and written since the boot.
+   - telemetryStats, the counters of the telemetry (see moduleStats.h).
+*/
+typedef struct __attribute__((packed)) structSample {
+  uint32_t time;
+  int16_t values[TELEMETRY_VALUES];
+} structSample;
+
+typedef struct structTelemetryBatch {
+  uint8_t data[MESSAGE_LENGTH_MAX - MESSAGE_HEADER_LENGTH];
+  int count;
+  uint32_t firstTime;
+} structTelemetryBatch;
+
+typedef struct structTelemetryStore {
+  structSample samples[TELEMETRY_BUOY_MAX][TELEMETRY_RING_LENGTH];
+  uint32_t head[TELEMETRY_BUOY_MAX];
+  uint32_t exported[TELEMETRY_BUOY_MAX];
+  int exportCursor;
+} structTelemetryStore;
+
+structTelemetryBatch telemetryBatch;
+structTelemetryStore telemetryStore;
+structTelemetryStats telemetryStats;
+unsigned long telemetryLast;
+
+/* ---- Procedure for initialising the telemetry ---- */
+/*
+   INPUT : nothing (void).
+   OUTPUT : nothing (void).
+   DESCRITPION : The batch and the ring buffers are emptied. The first sample is taken at a random time in the next TELEMETRY_FLUSH_MS,
+   so that the slaves which received their ID together do not send their batches at the same time (they would collide every time).
+*/
+void initTelemetry() {
+  telemetryBatch.count = 0;
+  memset(telemetryStore.head, 0, sizeof(telemetryStore.head));
+  memset(telemetryStore.exported, 0, sizeof(telemetryStore.exported));
+  telemetryStore.exportCursor = 0;
+  memset(&telemetryStats, 0, sizeof(telemetryStats));
+  telemetryLast = millis() + random(0, TELEMETRY_FLUSH_MS);
+}
+
+/* ---- Procedure for reading the sensors ---- */
+/*
+   INPUT : the values to fill (table of int16_t), the number of the sample (uint32_t).
+   OUTPUT : nothing (void).
+   DESCRITPION : The buoy has no sensor yet : the values are the number of the sample times 1, 2 and 3, so that the samples received
+   by the master can be checked.
+*/
+void readSensors(int16_t values[TELEMETRY_VALUES], uint32_t number) {
+  for (int i = 0; i < TELEMETRY_VALUES; i++)
+    values[i] = (int16_t)(number * (i + 1));
+}
+
+/* ---- Procedure for adding a sample to the batch ---- */
+/*
+   INPUT : the time of the sample (uint32_t).
+   OUTPUT : false if the batch was full and the sample dropped (bool).
+*/
+bool addSample(uint32_t time) {
+  structTelemetryBatch *batch = &telemetryBatch;
+  if ((batch->count == TELEMETRY_BATCH) || ((batch->count > 0) && (time - batch->firstTime > 0xFFFF)))
+    return false;
+  if (batch->count == 0)
+    batch->firstTime = time;
+  uint8_t *sample = &batch->data[5 + batch->count * TELEMETRY_SAMPLE_LENGTH];
+  uint16_t delta = time - batch->firstTime;
+  int16_t values[TELEMETRY_VALUES];
+  readSensors(values, telemetryStats.sampled);
+  memcpy(sample, &delta, sizeof(delta));
+  memcpy(sample + sizeof(delta), values, sizeof(values));
+  batch->count++;
+  return true;
+}
+
+/* ---- Procedure for servicing the telemetry of a slave ---- */
+/*
+   INPUT : the ID of the board (int), the MAC address of the master (table of uint8_t).
+   OUTPUT : nothing (void).
+   DESCRITPION : It must be called regularly by loop(). The samples due since the last call are taken, then the batch is sent if it is full
+   or old enough. If the reliable delivery refuses it (window full), it is sent at a next call.
+*/
+void serviceTelemetry(int senderID, const uint8_t masterAddress[]) {
+  if (TELEMETRY_PERIOD_MS == 0)
+    return;
+  unsigned long now = millis();
+  while ((long)(now - telemetryLast) >= (long)TELEMETRY_PERIOD_MS) {
+    telemetryLast += TELEMETRY_PERIOD_MS;
+    if (!addSample(telemetryLast))
+      telemetryStats.dropped++;
+    telemetryStats.sampled++;
+  }
+  structTelemetryBatch *batch = &telemetryBatch;
+  if ((batch->count == 0) || ((batch->count < TELEMETRY_BATCH) && (now - batch->firstTime < TELEMETRY_FLUSH_MS)))
+    return;
+  batch->data[0] = batch->count;
+  uint32_t firstTime = batch->firstTime + tdmaTimeOffset;
+  memcpy(&batch->data[1], &firstTime, sizeof(firstTime));
+  if (reliableSend(senderID, 0, masterAddress, batch->data, 5 + batch->count * TELEMETRY_SAMPLE_LENGTH)) {
+    telemetryStats.batchesSent++;
+    telemetryStats.samplesSent += batch->count;
+    batch->count = 0;
+  }
+}
+
+/* ---- Procedure for storing the samples received by the master ---- */
+/*
+   INPUT : the message DATA (structMessage) and its length (int).
+   OUTPUT : nothing (void).
+   DESCRITPION : Every sample of the batch is written in the ring buffer of its buoy, the oldest sample of a full ring is overwritten.
+   A batch whose length does not match its number of samples is ignored.
+*/
+void storeTelemetry(const structMessage *msg, int len) {
+  int buoyID = msg->senderID;
+  int count = msg->payload[0];
+  if ((buoyID < 0) || (len != (int)MESSAGE_HEADER_LENGTH + 5 + count * TELEMETRY_SAMPLE_LENGTH))
+    return;
+  if (buoyID >= TELEMETRY_BUOY_MAX) {
+    telemetryStats.unstored += count;
+    return;
+  }
+  uint32_t firstTime;
+  memcpy(&firstTime, &msg->payload[1], sizeof(firstTime));
+  uint32_t last = firstTime;
+  for (int i = 0; i < count; i++) {
+    const uint8_t *data = &msg->payload[5 + i * TELEMETRY_SAMPLE_LENGTH];
+    structSample *sample = &telemetryStore.samples[buoyID][telemetryStore.head[buoyID]++ & (TELEMETRY_RING_LENGTH - 1)];
+    uint16_t delta;
+    memcpy(&delta, data, sizeof(delta));
+    sample->time = firstTime + delta;
+    memcpy(sample->values, data + sizeof(delta), sizeof(sample->values));
+    last = sample->time;
+  }
+  /*a sample stamped in the future (a clock not aligned yet) counts as no latency.*/
+  int32_t age = millis() - last;
+  uint32_t latency = (age > 0) ? age : 0;
+  if (latency > telemetryStats.latencyMaxMs)
+    telemetryStats.latencyMaxMs = latency;
+  telemetryStats.latencySumMs += latency;
+  telemetryStats.latencySquaresMs += (uint64_t)latency * latency;
+  telemetryStats.batchesReceived++;
+  telemetryStats.stored += count;
+}
+
+/* ---- Procedure for exporting the samples of the master ---- */
+/*
+   INPUT : the buoy registry (structBuoyRegistry).
+   OUTPUT : the number of samples written (int).
+   DESCRITPION : The buoys are visited in turn from the last one exported, and their samples not written yet are written on the serial monitor
+   as long as the UART has room for a whole line, so that the main task never waits. It must be called regularly by the master (loop()).
+   NB : The UART is only asked for its room if a sample is waiting.
+*/
+int exportTelemetry(const structBuoyRegistry *registry) {
+  if (!TELEMETRY_EXPORT)
+    return 0;
+  structTelemetryStore *store = &telemetryStore;
+  int written = 0;
+  int buoys = (registry->count < TELEMETRY_BUOY_MAX) ? registry->count : TELEMETRY_BUOY_MAX;
+  for (int visited = 0; visited < buoys; visited++) {
+    int buoyID = store->exportCursor;
+    while (store->exported[buoyID] != store->head[buoyID]) {
+      /*the samples overwritten before being written are skipped.*/
+      if (store->head[buoyID] - store->exported[buoyID] > TELEMETRY_RING_LENGTH) {
+        telemetryStats.overwritten += store->head[buoyID] - store->exported[buoyID] - TELEMETRY_RING_LENGTH;
+        store->exported[buoyID] = store->head[buoyID] - TELEMETRY_RING_LENGTH;
+      }
+      const structSample *sample = &store->samples[buoyID][store->exported[buoyID] & (TELEMETRY_RING_LENGTH - 1)];
+      char mac[MAC_STRING_LENGTH];
+      char line[96];
+      formatMacKey(mac, registry->macAddresses[buoyID]);
+      int len = snprintf(line, sizeof(line), "T,%d,%s,%lu", buoyID, mac, (unsigned long)sample->time);
+      for (int i = 0; i < TELEMETRY_VALUES; i++)
+        len += snprintf(line + len, sizeof(line) - len, ",%d", sample->values[i]);
+      len += snprintf(line + len, sizeof(line) - len, "\r\n");
+      if (Serial.availableForWrite() < len)
+        return written;
+      Serial.write((const uint8_t *)line, len);
+      store->exported[buoyID]++;
+      telemetryStats.exported++;
+      written++;
+    }
+    store->exportCursor = (buoyID + 1 < buoys) ? buoyID + 1 : 0;
+  }
+  return written;
+}
+
+#endif
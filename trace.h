@@ -0,0 +1,120 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/* ---- Declaration of librairies ---- */
+#include <Arduino.h>
+#include <stdint.h>
+#include <string.h>
+#include "traceEvents.h"
+
+/* ---- Declaration of constants ---- */
+/*
+    The trace replaces the messages printed on the serial monitor by the callbacks and by the handling of the messages.
+    It uses one constant, the events and their level are defined in traceEvents.h :
+    - TRACE_LENGTH, the number of events the trace can hold before it is flushed. It must be a power of 2.
+*/
+#ifndef TRACE_LENGTH
+#define TRACE_LENGTH 128
+#endif
+
+static_assert((TRACE_LENGTH & (TRACE_LENGTH - 1)) == 0, "TRACE_LENGTH must be a power of 2");
+
+/* ---- Definition of the trace ---- */
+/*
+   An event (see traceEvents.h) is written by the callbacks (WiFi task) and by the main task in a ring buffer in RAM, which is much faster
+   than a line sent at 115200 bauds (87 microseconds per character once the UART FIFO is full). The main task flushes the trace later
+   on the serial monitor with traceFlush(), without waiting for the UART.
+   - head, the number of places taken since the boot, by any task. A place is taken with an atomic compare-and-swap.
+   - tail, the number of events flushed since the boot. Only written by the main task.
+   - lost and lostFlushed, the number of events dropped because the trace was full, and the part of them already reported (TRACE_LOST).
+   The event of a record is written last, with a release store : traceFlush() stops at the first record whose event is still 0.
+*/
+typedef struct structTrace {
+  uint32_t head;
+  uint32_t tail;
+  uint32_t lost;
+  uint32_t lostFlushed;
+  structTraceRecord records[TRACE_LENGTH];
+} structTrace;
+
+structTrace trace;
+
+/* ---- Procedure for recording an event ---- */
+/*
+   INPUT : the event (int) and its arguments (uint16_t, uint32_t, uint32_t).
+   OUTPUT : nothing (void).
+   DESCRITPION : The event is written in the next free place of the trace, or counted as lost if the trace is full. It never waits.
+   NB : It is called through TRACE(), which removes the events above TRACE_LEVEL at the compilation.
+*/
+void traceRecord(int event, uint16_t a, uint32_t b, uint32_t c) {
+  uint32_t head = __atomic_load_n(&trace.head, __ATOMIC_RELAXED);
+  do {
+    if (head - __atomic_load_n(&trace.tail, __ATOMIC_ACQUIRE) >= TRACE_LENGTH) {
+      __atomic_fetch_add(&trace.lost, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  } while (!__atomic_compare_exchange_n(&trace.head, &head, head + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+  structTraceRecord *record = &trace.records[head & (TRACE_LENGTH - 1)];
+  record->time = micros();
+  record->a = a;
+  record->b = b;
+  record->c = c;
+  __atomic_store_n(&record->event, (uint16_t)event, __ATOMIC_RELEASE);
+}
+
+#define TRACE(event, a, b, c)                  \
+  do {                                         \
+    if (traceEventLevel[event] <= TRACE_LEVEL) \
+      traceRecord(event, a, b, c);             \
+  } while (0)
+
+/* the MAC address of an event is given as its 4 lower bytes (b) and its 2 upper bytes (c) */
+#define TRACE_MAC(event, a, addressMac)                                                                                        \
+  TRACE(event, a, (uint32_t)(addressMac)[0] | ((uint32_t)(addressMac)[1] << 8) | ((uint32_t)(addressMac)[2] << 16)            \
+                      | ((uint32_t)(addressMac)[3] << 24),                                                                     \
+        (uint32_t)(addressMac)[4] | ((uint32_t)(addressMac)[5] << 8))
+
+/* ---- Procedure for writing an event on the serial monitor ---- */
+void traceWrite(const structTraceRecord *record) {
+  uint8_t frame[TRACE_FRAME_LENGTH];
+  uint8_t sum = 0;
+  frame[0] = TRACE_SYNC;
+  memcpy(&frame[1], record, sizeof(structTraceRecord));
+  for (size_t i = 1; i <= sizeof(structTraceRecord); i++)
+    sum += frame[i];
+  frame[TRACE_FRAME_LENGTH - 1] = sum;
+  Serial.write(frame, TRACE_FRAME_LENGTH);
+}
+
+/* ---- Procedure for flushing the trace ---- */
+/*
+   INPUT : nothing (void).
+   OUTPUT : the number of events written (int).
+   DESCRITPION : The events are written on the serial monitor as long as the UART has room for them, so that the main task never waits.
+   The events left are written at the next call. It must be called regularly by the main task (loop()).
+   NB : The UART is only asked for its room if an event is waiting, an empty trace costs two loads.
+*/
+int traceFlush() {
+  int written = 0;
+  for (;;) {
+    uint32_t lost = __atomic_load_n(&trace.lost, __ATOMIC_RELAXED);
+    structTraceRecord *record = &trace.records[trace.tail & (TRACE_LENGTH - 1)];
+    bool waiting = (trace.tail != __atomic_load_n(&trace.head, __ATOMIC_ACQUIRE))
+                   && (__atomic_load_n(&record->event, __ATOMIC_ACQUIRE) != TRACE_EVENT_NONE);
+    if ((!waiting && (lost == trace.lostFlushed)) || (Serial.availableForWrite() < (int)TRACE_FRAME_LENGTH))
+      return written;
+    /*the events lost are reported before the next ones.*/
+    if (lost != trace.lostFlushed) {
+      structTraceRecord lostRecord = {(uint32_t)micros(), TRACE_LOST, (uint16_t)(lost - trace.lostFlushed), 0, 0};
+      traceWrite(&lostRecord);
+      trace.lostFlushed = lost;
+    } else {
+      traceWrite(record);
+      record->event = TRACE_EVENT_NONE;
+      __atomic_store_n(&trace.tail, trace.tail + 1, __ATOMIC_RELEASE);
+    }
+    written++;
+  }
+}
+
+#endif
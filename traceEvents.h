@@ -0,0 +1,78 @@
+#ifndef TRACE_EVENTS_H
+#define TRACE_EVENTS_H
+
+/* ---- Declaration of librairies ---- */
+#include <stdint.h>
+
+/* ---- Declaration of constants ---- */
+/*
+    The events of the trace (see trace.h) use the following constants :
+    - TRACE_LEVEL, the events kept at the compilation (by default TRACE_LEVEL_INFO). An event above this level costs nothing,
+      with TRACE_LEVEL_NONE the trace is removed.
+    - TRACE_SYNC, the first byte of an event on the serial monitor. It is not an ASCII character, so that a decoder finds the events
+      among the lines printed as text.
+*/
+#define TRACE_LEVEL_NONE 0
+#define TRACE_LEVEL_ERROR 1
+#define TRACE_LEVEL_INFO 2
+#define TRACE_LEVEL_DEBUG 3
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_LEVEL_INFO
+#endif
+#define TRACE_SYNC 0xA5
+
+/* ---- Definition of the events ---- */
+/*
+   Every event has a name, a level and the format used by the decoder (sim/trace_decode.cpp) to print its arguments a, b and c :
+   %a, %b and %c print an argument in decimal, %m prints the MAC address held by b (4 lower bytes) and c (2 upper bytes).
+   The list is only extended at its end, so that an old trace can still be decoded.
+*/
+#define TRACE_EVENTS(EVENT)                                                                      \
+  EVENT(TRACE_LOST, TRACE_LEVEL_ERROR, "%a events lost, the trace was full")                     \
+  EVENT(TRACE_BOOT_STATE, TRACE_LEVEL_INFO, "boot state %a")                                     \
+  EVENT(TRACE_SEND, TRACE_LEVEL_DEBUG, "send type %a, %b bytes, result %c")                      \
+  EVENT(TRACE_SEND_FAIL, TRACE_LEVEL_ERROR, "error sending to %m")                               \
+  EVENT(TRACE_RECV, TRACE_LEVEL_DEBUG, "receive %a bytes from %m")                               \
+  EVENT(TRACE_RX_DROP, TRACE_LEVEL_ERROR, "receive queue full, %a bytes from %m dropped")        \
+  EVENT(TRACE_ID_ASSIGNED, TRACE_LEVEL_INFO, "my new ID is %a")                                  \
+  EVENT(TRACE_BUOY_KNOWN, TRACE_LEVEL_INFO, "buoy known, buoyID %a, MAC address %m")             \
+  EVENT(TRACE_BUOY_NEW, TRACE_LEVEL_INFO, "new buoy, buoyID %a, MAC address %m")                 \
+  EVENT(TRACE_REGISTRY_FULL, TRACE_LEVEL_ERROR, "buoy registry full, %m has no ID")              \
+  EVENT(TRACE_BATCH_SENT, TRACE_LEVEL_INFO, "ID_REPLY_BATCH sent, %a slaves, %b new buoys")      \
+  EVENT(TRACE_POOL_EMPTY, TRACE_LEVEL_ERROR, "frame pool empty, message type %a not sent")       \
+  EVENT(TRACE_RETRANSMIT, TRACE_LEVEL_DEBUG, "DATA %b to buoyID %a sent again, retry %c")        \
+  EVENT(TRACE_DATA_FAILED, TRACE_LEVEL_ERROR, "DATA %b to buoyID %a given up after %c sendings") \
+  EVENT(TRACE_MASTER_LOST, TRACE_LEVEL_ERROR, "master %m silent for %a ms, election")            \
+  EVENT(TRACE_TAKEOVER, TRACE_LEVEL_INFO, "this board becomes the master, its former ID was %a") \
+  EVENT(TRACE_NEW_MASTER, TRACE_LEVEL_INFO, "new master %m, claiming buoyID %a")                 \
+  EVENT(TRACE_BUOY_CLAIMED, TRACE_LEVEL_INFO, "buoy claimed buoyID %a, MAC address %m")          \
+  EVENT(TRACE_METRICS_TIMEOUT, TRACE_LEVEL_ERROR, "buoyID %a has not answered the METRICS query") \
+  EVENT(TRACE_BUOY_UNSAVED, TRACE_LEVEL_ERROR, "buoyID %a not saved in the flash, %m has no reply")
+
+#define TRACE_EVENT_ID(name, level, format) name,
+#define TRACE_EVENT_LEVEL(name, level, format) level,
+
+/* the event 0 is not used, a place of the trace whose event is 0 is not written yet */
+enum { TRACE_EVENT_NONE, TRACE_EVENTS(TRACE_EVENT_ID) TRACE_EVENT_COUNT };
+
+static constexpr uint8_t traceEventLevel[] = {TRACE_LEVEL_NONE, TRACE_EVENTS(TRACE_EVENT_LEVEL)};
+
+/* ---- Definition of the record of an event ---- */
+/*
+   An event is a record of 16 bytes : the time in microseconds (micros()), the event and its three arguments.
+   On the serial monitor, an event is TRACE_SYNC, the record in little-endian, then the sum of its 16 bytes (TRACE_FRAME_LENGTH bytes).
+*/
+typedef struct structTraceRecord {
+  uint32_t time;
+  uint16_t event;
+  uint16_t a;
+  uint32_t b;
+  uint32_t c;
+} structTraceRecord;
+
+#define TRACE_FRAME_LENGTH (sizeof(structTraceRecord) + 2)
+
+static_assert(sizeof(structTraceRecord) == 16, "a record of the trace is 16 bytes long");
+
+#endif
@@ -1,6 +1,22 @@
 /* ---- Declaration of librairies ---- */
 #include <esp_now.h>
 #include <WiFi.h>
+#include "buoyRegistry.h"
+#include "macAddress.h"
+#include "registryLog.h"
+#include "message.h"
+#include "rxQueue.h"
+#include "framePool.h"
+#include "trace.h"
+#include "metrics.h"
+#include "tdma.h"
+#include "relay.h"
+#include "peerCache.h"
+#include "reliable.h"
+#include "telemetry.h"
+#include "backoff.h"
+#include "bootCache.h"
+#include "failover.h"
 
 /* ---- Declaration of constants ---- */
 /*
@@ -13,41 +29,31 @@
 
 /* ---- Declaration of variables ---- */
 /*
-   In this program, we use five global variables :
+   In this program, we use eight global variables :
    - receiverAddress, the receiver MAC address. Initially, it sets to the broadcast address. It becomes the master MAC address if the board is a slave.
    - myMacAddress, the MAC address of the board. It will be used during ESP communications to identify the board.
+   - myRawMacAddress, the MAC address of the board as a table of uint8_t, as it is written in the messages.
    - ESPstatus, determines whether the board is master (1) or slave (-1) during ESP communications. Initially, it sets to 0 as long as the status is indeterminate.
    - myID, the ID of the board. It is used to identify the board during data recovery. Initially, it sets to -1 as long as the status is indeterminate.
    - master, a bool that represents the presence (or not) of a master on the ESP network.
+   - masterHeardAt, the last time a message of the master (ID 0) was received from receiverAddress. A buoy which acknowledges the
+     messages of the board without sending as the master may be alive but no longer the master (see BOOT_WARM_START).
    - peerInfo, contains all the information about the chanel (cryptage, the address of communication...).
 */
 uint8_t receiverAddress[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 String myMacAddress = String(WiFi.macAddress());
+uint8_t myRawMacAddress[MAC_ADDRESS_LENGTH];
 int ESPstatus = 0;
 int myID = -1;
 bool master = false;
+unsigned long masterHeardAt = 0;
 esp_now_peer_info_t peerInfo = {};
 
-/* ---- Definition of the message structure ---- */
+/* ---- Definition of the buoy structure and the buoy registry ---- */
 /*
-   An ESP message is composed of four elements :
-   - senderID, the ID of the board who sends the message.
-   - receiverID, the ID of the board to xhich the message is addressed.
-   - typeMessage, it is used to classify the different categories of message send on the ESP network.
-   - message, the content of the ESP message. This can be for example a mac address or others.
-*/
-typedef struct structMessage {
-  int senderID;
-  int receiverID;
-  char typeMessage[CHAR_LENGTH];
-  char message[CHAR_LENGTH];
-} structMessage;
-
-/* ---- Definition of the buoy structure and the buoy list ---- */
-/*
-   The master records the infos of all the slaves in a linked list. Initially, the linked list is empty.
-   Thanks to this list the master can a link between the MAC address and the ID of every buoy.
-   Each element (or buoy) of the list is composed of four fields :
+   The master records the infos of all the slaves in a registry (see buoyRegistry.h). Initially, the registry is empty.
+   Thanks to this registry the master can a link between the MAC address and the ID of every buoy.
+   The infos of a buoy are gathered in a structBuoy, composed of three fields :
    - buoyID, the ID of the buoy. It has been chosen to assign the ID 0 to the master.
    - buoyName, the name of the buoy if there is a need to differentiate them other than by their ID. Currently, every buoy name has the same structure : "Buoy n°" + its buoyID.
    - buoyMacAddress, the MAC address of the buoy, unique board identifier.
@@ -56,185 +62,83 @@ typedef struct structBuoy {
   int buoyID;
   char buoyName [CHAR_LENGTH];
   uint8_t buoyMacAddress[MAC_ADDRESS_LENGTH];
-  struct structBuoy *nxt;
 } structBuoy;
 
-typedef structBuoy* structBuoyList;
-structBuoyList buoyList = NULL;
+structBuoyRegistry buoyList;
 
-/* ---- Procedure for counting the number of buoys in the list ---- */
+/* ---- Procedure for getting the infos of a buoy ---- */
 /*
-   INPUT : the buoy list (structBuoyList)
-   OUTPUT : the number of buoys present in the list (int).
-   DESCRITPION : If the buoy list is empty then the procedure return 0, else the program recursively goes through the list to count the buoys.
+   INPUT : the registry (structBuoyRegistry), the ID of the buoy (int), the buoy to fill (structBuoy).
+   OUTPUT : nothing (void).
+   DESCRITPION : The program fills the fields of the buoy from its ID. The name is built from the ID and the MAC address is read from the registry.
 */
-int nbBuoys(structBuoyList myList) {
-  /*if the buoy list is empty...*/
-  if (myList == NULL)
-    /*...then it returns 0.*/
-    return 0;
-  /*...else it recursively goes through the list to count the buoys*/
-  return nbBuoys(myList->nxt) + 1;
+void getBuoy(const structBuoyRegistry *registry, int buoyID, structBuoy *buoy) {
+  buoy->buoyID = buoyID;
+  snprintf(buoy->buoyName, CHAR_LENGTH, "Buoy n°%d", buoyID);
+  keyToMacAddress(buoy->buoyMacAddress, registry->macAddresses[buoyID]);
 }
 
 /* ---- Procedure for printing a Mac Address ---- */
 /*
    INPUT : the MAC address to print (table of uint8_t(Unsigned Integers of 8 bits)).
    OUTPUT : nothing (void).
-   DESCRITPION : The program goes through the table. If the character is smaller than 16 (because a MAC address is in hexadecimal) the program prints "0".
-   Every MAC address element is composed of two alphanumeric characters. After printing the character, the program checks that it is not the last character.
-   If it is not the case, it print ":" to separate the different characters.
-   NB : "HEX" is used to display the character in hexadecimal.
-*/
-void printMacAddress(uint8_t addressMac[]) {
-  for (int i = 0; i < MAC_ADDRESS_LENGTH; i++) {
-    /*if the MAC address element is greater smaller than 16...*/
-    if (addressMac[i] < 16) {
-      /*...then the program prints a "0" to have two characters*/
-      Serial.print("0");
-    }
-    /*it prints the MAC address element in a hexadecimal format*/
-    Serial.print(addressMac[i], HEX);
-    /*if it is not the last element of the table...*/
-    if (i != MAC_ADDRESS_LENGTH - 1)
-      /*...then it prints a ":" symbol to the monitor.*/
-      Serial.print(":");
-    else
-      /*...else it does a break line*/
-      Serial.println();
-  }
+   DESCRITPION : The MAC address is formatted in a buffer on the stack (see macAddress.h) and printed in one piece, followed by a break line.
+*/
+void printMacAddress(const uint8_t addressMac[]) {
+  char stringMacAddress[MAC_STRING_LENGTH];
+  formatMacAddress(stringMacAddress, addressMac);
+  Serial.println(stringMacAddress);
 }
 
 /* ---- Procedure for modifying a Mac Address ---- */
 /*
    INPUT : the MAC address copied (table of uint8_t), the MAC address to copy (String).
-   OUTPUT : nothing (void).
-   DESCRITPION : The program goes through the table. The ith element of the table corresponds to (3*i)th and (3*i+1)th characters of the String.
-   The program checks for each character if the character is between 0 and 9 or A and F. If the character is a letter then it substracts 55 else only 48.
-   This allows the correct ASCII code of the character to be found. Finally the program adds the two character with the correct power to have the ith element of the table.
-   NB : hex1 (16 pow 1) and hex0 (16 pow 0) represent each alphanumeric of a MAC address character.
-   The function .charAt(n) returns the nth character of the string.
-*/
-void modifMacAddress(uint8_t addressMac[], String stringMacAddress) {
-  int hex1, hex0;
-  for (int i = 0; i < MAC_ADDRESS_LENGTH; i++) {
-    /*if the first alphanumeric element is a letter...*/
-    if ((int)stringMacAddress.charAt(3 * i) > 63)
-      /*...then it substracts 55*/
-      hex1 = (int)stringMacAddress.charAt(3 * i) - 55;
-    /*...else it substracts 48*/
-    else
-      hex1 = (int)stringMacAddress.charAt(3 * i) - 48;
-    /*if the second alphanumeric element is a letter...*/
-    if ((int)stringMacAddress.charAt(3 * i + 1) > 63)
-      /*...then it substracts 55*/
-      hex0 = (int)stringMacAddress.charAt(3 * i + 1) - 55;
-    else
-      /*...else it substracts 48*/
-      hex0 = (int)stringMacAddress.charAt(3 * i + 1) - 48;
-    /*hex1 and hex0 are used to calculated the ith element of the MAC address*/
-    addressMac[i] = 16 * hex1 + hex0;
-  }
+   OUTPUT : true if the String is a MAC address (bool).
+   DESCRITPION : The String is parsed with parseMacAddress() (see macAddress.h), which accepts the upper and the lower case.
+   If it is not a MAC address, the table is not modified.
+*/
+bool modifMacAddress(uint8_t addressMac[], const String &stringMacAddress) {
+  uint64_t key;
+  if (!parseMacAddress(stringMacAddress.c_str(), &key))
+    return false;
+  keyToMacAddress(addressMac, key);
+  return true;
 }
 
-
 /* ---- Procedure for converting a Mac Address ---- */
 /*
    INPUT : a MAC address (table of uint8_t).
    OUTPUT : a MAC address converted (String).
-   DESCRITPION : The program goes through the table. For every element of the table, the program calculates hex0 as the rest of the Euclidean division by 16 and hex1 as the quotient.
-   The program expresses each number in hexadecimal. Then they are concatnated in a string and if they are not the last MAC character, a ":" symbol is added to the String.
-   NB : hex1 (16 pow 1) and hex0 (16 pow 0) represent each alphanumeric of a MAC address character.
-   The function .toUpperCase() returns an upper-case version of a String.
-*/
-String macAddressToString(uint8_t addressMac[]) {
-  String stringMacAddress = "";
-  String hex1, hex0;
-  for (int i = 0; i < MAC_ADDRESS_LENGTH; i++) {
-    /*hex0 is calculated as the rest of the Euclidean division by 16, expressed in hexadecimal*/
-    hex0 = String(addressMac[i] % 16, HEX);
-    /*if the character is a letter...*/
-    if (addressMac[i] % 16 > 9) {
-      /*... then it is capitalised.*/
-      hex0.toUpperCase();
-    }
-    /* and hex1 quotient, expressed in hexadecimal*/
-    hex1 = String((addressMac[i] - addressMac[i] % 16) / 16, HEX);
-    /*if the character is a letter...*/
-    if ((addressMac[i] - addressMac[i] % 16) / 16 > 9) {
-      /*... then it is capitalised.*/
-      hex1.toUpperCase();
-    }
-    /*hex1 and hex0 are concatenated to the result*/
-    stringMacAddress += hex1 + hex0;
-    /*if it is not the last element of the table...*/
-    if (i != MAC_ADDRESS_LENGTH - 1)
-      /*... then it adds a ":" symbol to the result.*/
-      stringMacAddress += ":";
-  }
-  return stringMacAddress;
-}
-
-/* ---- Procedure for initialising the buoyList and adding a buoy in the list ---- */
-/*
-   INPUT : the buoy list (structBuoyList), the MAC address of the buoy (String).
-   OUTPUT : the buoy list modified (structBuoyList).
-   DESCRITPION : Firstly the program creates a new buoy by fillling all the fields (ID, name...). It knows the ID using the nbBuoys function presented above.
-   Then, if the list is empty it returns the new buoy else it goes through the list until the last element.
-   Once arrived, the program creates a link between the last element and the new buoy, which is now the new last element of the list.
-   NB : temp is a temporary pointer to go through the list.
-*/
-structBuoyList addNewBuoy(structBuoyList myList, String macAddressBuoy) {
-  /*the program creates the new buoy, by allocating memories and filling the field of the new buoy*/
-  structBuoy *newBuoy = (structBuoy*)malloc(sizeof(structBuoy));
-  newBuoy->buoyID = nbBuoys(myList);
-  String nameBuoy = "Buoy n°" + String(nbBuoys(myList));
-  nameBuoy.toCharArray(newBuoy->buoyName, CHAR_LENGTH);
-  modifMacAddress(newBuoy->buoyMacAddress, macAddressBuoy);
-  newBuoy->nxt = NULL;
-  /*if the list is empty...*/
-  if (myList == NULL) {
-    /*... then it returns the new buoy.*/
-    return newBuoy;
-  }
-  else {
-    /*...else it creates a temporary pointer to go through the list*/
-    structBuoy* temp = myList;
-    /*as long as the pointer is not on the last element of the list then...*/
-    while (temp->nxt != NULL) {
-      /*... it goes to the next element.*/
-      temp = temp->nxt;
-    }
-    /*it adds the new buoy as the new last element of the list.*/
-    temp->nxt = newBuoy;
-    /*finally, it returns the buoy list modified.*/
-    return myList;
-  }
+   DESCRITPION : The MAC address is formatted in a buffer on the stack (see macAddress.h), the String is the only allocation.
+   NB : It is only used by the messages printed during the boot, the other paths use formatMacAddress() directly.
+*/
+String macAddressToString(const uint8_t addressMac[]) {
+  char stringMacAddress[MAC_STRING_LENGTH];
+  formatMacAddress(stringMacAddress, addressMac);
+  return String(stringMacAddress);
 }
 
 /* ---- Procedure for printing the buoyList ---- */
 /*
-   INPUT : the buoy list (structBuoyList).
+   INPUT : the buoy registry (structBuoyRegistry).
    OUTPUT : nothing (void).
-   DESCRITPION : The program goes through the whole buoy list and prints the information of every buoy while it is not the last element of the list.
-   NB : temp is a temporary pointer to go through the list.
+   DESCRITPION : The program goes through the whole registry in the order of the IDs and prints the information of every buoy.
 */
-void printBuoyList(structBuoyList myList)
+void printBuoyList(const structBuoyRegistry *registry)
 {
-  /*the program creates a temporary pointer to go through the list.*/
-  structBuoy *temp = myList;
+  structBuoy buoy;
   Serial.println(F("------------- ID LIST -------------"));
-  /*as long as the pointer is not on the last element of the list then...*/
-  while (temp != NULL) {
-    /*... it prints the infos of the buoy*/
-    Serial.println("buoyID : " + String(temp->buoyID));
-    Serial.println("buoyName : " + String(temp->buoyName));
+  for (int id = 0; id < nbBuoys(registry); id++) {
+    /*it prints the infos of the buoy*/
+    getBuoy(registry, id, &buoy);
+    Serial.print(F("buoyID : "));
+    Serial.println(buoy.buoyID);
+    Serial.print(F("buoyName : "));
+    Serial.println(buoy.buoyName);
     Serial.print(F("buoyMacAddress : "));
-    printMacAddress(temp->buoyMacAddress);
-    /*and goes to the next buoy.*/
-    temp = temp->nxt;
+    printMacAddress(buoy.buoyMacAddress);
     /*if it is not the last buoy...*/
-    if (temp != NULL)
+    if (id != nbBuoys(registry) - 1)
       /*...then it does a break line.*/
       Serial.println();
   }
@@ -242,33 +146,6 @@ void printBuoyList(structBuoyList myList)
   Serial.println();
 }
 
-/* ---- Procedure for checking if a buoy is in the buoy list ---- */
-/*
-   INPUT : the buoy list (structBuoyList), the MAC address of the buoy sought (String).
-   OUTPUT : the place of the buoy (int).
-   DESCRITPION : The program goes through the whole buoy list and searches by comparing the mac addresses if a buoy is present.
-   If it the case it returns its place else it returns -1.
-   NB : The function compareTo() compares character by character two strings. It returns 0 if they are equal.
-*/
-int isBuoyExists(structBuoyList structBuoyList, String addressMac) {
-  /*place is used to find the place of the buoy in the list.*/
-  int place = 0;
-  /*the program creates a temporary pointer to go through the list.*/
-  structBuoy* temp = structBuoyList;
-  /*as long as the pointer is not on the last element of the list then...*/
-  while (temp != NULL) {
-    /*...it checks if the MAC address of the buoy is the one required...*/
-    if (macAddressToString(temp->buoyMacAddress).compareTo(addressMac) == 0)
-      /*...then it returns the place of the buoy in the list (which is its ID).*/
-      return place;
-    /*...else it goes to the next buoy and increments place.*/
-    temp = temp->nxt;
-    place ++;
-  }
-  /*if the buoy has not been found in the list then it is not known and the value -1 is returned.*/
-  return -1;
-}
-
 /* ---- Procedure for printing the board informations ---- */
 /*
    INPUT : nothing(void).
@@ -279,7 +156,7 @@ void printBoardInfo() {
   Serial.println(F("------ new board informations ------"));
   Serial.print(F("myID : "));
   if (myID != -1)
-    Serial.println(String(myID));
+    Serial.println(myID);
   else Serial.println(F("Unattributed"));
   Serial.print(F("ESPstatus : "));
   if (ESPstatus == -1)
@@ -287,63 +164,609 @@ void printBoardInfo() {
   else if (ESPstatus == 0)
     Serial.println(F("Unattributed"));
   else Serial.println(F("Master"));
-  Serial.println("MAC address : " + myMacAddress);
+  Serial.print(F("MAC address : "));
+  printMacAddress(myRawMacAddress);
   Serial.println(F("------------------------------------"));
   Serial.println();
 }
 
-/* Defintition of the type of received data (dataRcv) and data sent (myData) */
+/* Defintition of the type of received data (dataRcv), with its length in bytes (dataRcvLength) and the time of its reception (dataRcvAt, micros()) */
 structMessage dataRcv;
-structMessage myData;
+int dataRcvLength;
+uint32_t dataRcvAt;
+
+/* Definition of the pool of the messages sent (see framePool.h) : a message is prepared in a frame taken from the pool, then the frame is released once sent */
+structFramePool framePool;
+
+/* Definition of the receive queue (see rxQueue.h), filled by OnDataRecv and emptied by dispatchMessages() */
+structRxQueue rxQueue;
+
+/* Definition of the handle of the main task (mainTask), notified by the callbacks when it waits for a message */
+TaskHandle_t mainTask = NULL;
 
 /* ----- Define callbacks for sending data ----- */
 /*
    DESCRITPION : define the behaviour when the card sends a message.
+   A unicast message which has not been acknowledged by its receiver sets sendFailed, so that the main task does not wait for a reply which will not come.
+   If the receiver is the master, the slave also holds its DATA messages until it hears the master again (see failover.h).
+   The callback runs in the WiFi task, the error is written in the trace (see trace.h) instead of the serial monitor.
+   Every status is also given to the reliable delivery (see reliable.h), which sends again the DATA messages not acknowledged.
+   The failures are counted in the metrics (see metrics.h).
 */
+volatile bool sendFailed = false;
+
 void OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status) {
+  reliableSendStatus(mac_addr, status);
   /*if the data is not correctly sent...*/
   if (status != ESP_NOW_SEND_SUCCESS) {
-    /*...then it prints an error.*/
-    Serial.println(F("error sending"));
+    /*...then it traces an error and wakes the main task up.*/
+    TRACE_MAC(TRACE_SEND_FAIL, 0, mac_addr);
+    metricsCount(METRIC_SEND_FAILED);
+    sendFailed = true;
+    if ((ESPstatus == -1) && !memcmp(mac_addr, receiverAddress, 6))
+      failoverUnanswered = true;
+    if (mainTask != NULL)
+      xTaskNotifyGive(mainTask);
   }
   /*...else it does nothing.*/
 }
 
-/* ---- Define callbacks for received data ---- */
+/* ---- Definition of the ID_REPLY batch ---- */
 /*
-   DESCRITPION : define the behaviour when the card receives a message.
-   NB: The function toInt() converts a String into an integer.
-   The function strcmp() returns 0 if two Strings are equal.
-   The function indexOf() locates a String in antoher String. It returns -1 if not found.
-   The functioin toCharArray() transforms a String into a char array.
+   When a whole fleet powers on together, the master receives many ID_REQUEST messages in a short time. Instead of one ID_REPLY each,
+   it collects them during ID_BATCH_WINDOW_MS milliseconds and replies with one ID_REPLY_BATCH message (up to ID_BATCH_MAX slaves).
+   If ID_BATCH_WINDOW_MS is 0, every ID_REQUEST gets its own ID_REPLY, as before.
+   - idBatch, the frame of the batch message being filled, taken from the pool when the batch starts (NULL if there is no batch).
+   - idBatchStart, the time of the first ID_REQUEST of the batch (millis()).
+   - idBatchNewBuoys, the number of buoys added in the registry since the last batch, written in the trace with the batch.
+*/
+#ifndef ID_BATCH_WINDOW_MS
+#define ID_BATCH_WINDOW_MS 20
+#endif
+
+structFrame *idBatch = NULL;
+unsigned long idBatchStart;
+int idBatchNewBuoys = 0;
+
+/* ---- Procedure for sending the ID_REPLY batch ---- */
+/*
+   INPUT : nothing (void).
+   OUTPUT : nothing (void).
+   DESCRITPION : If the batch is not empty, the program sends it to the broadcast address and empties it. A batch of one slave is sent
+   to it if it is in the peer cache (see peerCache.h).
+*/
+void sendIdBatch() {
+  if (idBatch == NULL)
+    return;
+  const uint8_t *address = (idBatch->msg.payload[0] == 1) ? peerCacheAddress(&idBatch->msg.payload[1]) : receiverAddress;
+  sendMessage(address, &idBatch->msg, idBatch->len);
+  if (!memcmp(address, relayBroadcastAddress, MAC_ADDRESS_LENGTH))
+    failoverBroadcast();
+  /*the new buoys have been traced one by one, the buoy list is not printed : it would keep the master deaf for a second at 200 buoys.*/
+  TRACE(TRACE_BATCH_SENT, idBatch->msg.payload[0], idBatchNewBuoys, 0);
+  releaseFrame(&framePool, idBatch);
+  idBatch = NULL;
+  idBatchNewBuoys = 0;
+}
+
+/* ---- Procedure for adding a slave to the ID_REPLY batch ---- */
+/*
+   INPUT : the MAC address of the slave (table of uint8_t), its ID (int), its time slot (int).
+   OUTPUT : nothing (void).
+   DESCRITPION : The program starts a new batch if needed, then adds the slave unless it is already in the batch (a slave repeats its ID_REQUEST).
+   A full batch is sent at once. If the pool has no free frame, the slave is not answered and will repeat its ID_REQUEST.
+*/
+void addToIdBatch(const uint8_t addressMac[], int buoyID, int slot) {
+  /*if there is no batch...*/
+  if (idBatch == NULL) {
+    /*...then a new batch is started in a frame of the pool.*/
+    if ((idBatch = allocFrame(&framePool)) == NULL) {
+      TRACE(TRACE_POOL_EMPTY, ID_REPLY_BATCH, 0, 0);
+      return;
+    }
+    idBatch->len = prepareMessage(&idBatch->msg, ID_REPLY_BATCH, myID, -1);
+    idBatch->msg.payload[0] = 0;
+    idBatch->len++;
+    idBatchStart = millis();
+  }
+  /*if the slave is already in the batch, it is not added twice.*/
+  for (int i = 0; i < idBatch->msg.payload[0]; i++)
+    if (!memcmp(&idBatch->msg.payload[1 + i * ID_BATCH_ENTRY_LENGTH], addressMac, MAC_ADDRESS_LENGTH))
+      return;
+  idBatch->len = putMacAddress(&idBatch->msg, idBatch->len, addressMac);
+  idBatch->len = putID(&idBatch->msg, idBatch->len, buoyID);
+  idBatch->len = putID(&idBatch->msg, idBatch->len, slot);
+  idBatch->msg.payload[0]++;
+  /*if the batch is full, it is sent.*/
+  if (idBatch->msg.payload[0] == ID_BATCH_MAX)
+    sendIdBatch();
+}
+
+/* ---- Procedure for sending the ID_REPLY batch at the end of its window ---- */
+/*
+   DESCRITPION : It must be called regularly by the master, the batch is sent ID_BATCH_WINDOW_MS milliseconds after its first ID_REQUEST,
+   in the next slot of the master with the time slots (see tdma.h).
+*/
+void serviceIdBatch() {
+#if ID_BATCH_WINDOW_MS > 0
+  if ((idBatch != NULL) && (millis() - idBatchStart >= ID_BATCH_WINDOW_MS) && tdmaMasterMayTransmit())
+    sendIdBatch();
+#endif
+}
+
+/* ---- Procedure for sending the BEACON at the beginning of every superframe ---- */
+/*
+   DESCRITPION : It must be called regularly by the master, the BEACON gives the time of the master and the time slots to the slaves (see tdma.h).
+   The slot of a silent slave is only given back if the slaves send their telemetry.
+*/
+void serviceBeacon() {
+  if (!tdmaBeaconDue(TELEMETRY_PERIOD_MS > 0))
+    return;
+  structFrame *beacon = allocFrame(&framePool);
+  if (beacon == NULL) {
+    TRACE(TRACE_POOL_EMPTY, BEACON, 0, 0);
+    return;
+  }
+  beacon->len = prepareBeacon(&beacon->msg, myID);
+  sendMessage(receiverAddress, &beacon->msg, beacon->len);
+  releaseFrame(&framePool, beacon);
+}
+
+/* ---- Procedure for following the next hop of the relay ---- */
+/*
+   DESCRITPION : In relay mode, receiverAddress is the next hop of the slave (see relay.h). When the next hop changes, the new one becomes
+   an ESP-NOW peer of the board in place of the old one, so that the messages to the master keep their WiFi acknowledgement.
+*/
+void followNextHop() {
+  if (!memcmp(receiverAddress, relayParentAddress, MAC_ADDRESS_LENGTH))
+    return;
+  memcpy(peerInfo.peer_addr, relayParentAddress, MAC_ADDRESS_LENGTH);
+  if ((esp_now_add_peer(&peerInfo) != ESP_OK) && !esp_now_is_peer_exist(relayParentAddress))
+    return;
+  /*the broadcast peer is kept, the BEACON and the MASTER_REPLY of the relay are sent to it.*/
+  if (memcmp(receiverAddress, relayBroadcastAddress, MAC_ADDRESS_LENGTH))
+    esp_now_del_peer(receiverAddress);
+  memcpy(receiverAddress, relayParentAddress, MAC_ADDRESS_LENGTH);
+}
+
+/* ---- Procedure for relaying a received message (slave) ---- */
+/*
+   INPUT : nothing (void).
+   OUTPUT : nothing (void).
+   DESCRITPION : In relay mode, a slave with an ID handles the messages of dataRcv for the buoys which do not hear the master (see relay.h) :
+   - it answers a MASTER_DETECTION with its MAC address and its number of hops, if it has a route to the master.
+   - it wraps an ID_REQUEST, a DATA or a METRICS message sent to it for the master in a RELAY message, sent to its next hop.
+   - it passes a RELAY message to the next hop.
+*/
+void relaySlaveMessage() {
+  structFrame *frame = allocFrame(&framePool);
+  if (frame == NULL) {
+    TRACE(TRACE_POOL_EMPTY, dataRcv.typeMessage, 0, 0);
+    return;
+  }
+  const uint8_t *address = relayParentAddress;
+  frame->len = 0;
+  if (dataRcv.typeMessage == RELAY) {
+    frame->len = relayForward(&dataRcv, dataRcvLength, myID, &frame->msg, &address);
+  } else if ((dataRcv.typeMessage == MASTER_DETECTION) && (relayHops > 0) && (relayHops < RELAY_HOPS_MAX)) {
+    frame->len = prepareMessage(&frame->msg, MASTER_REPLY, myID, -1);
+    frame->len = putMacAddress(&frame->msg, frame->len, myRawMacAddress);
+    ((uint8_t *)&frame->msg)[frame->len++] = relayHops;
+    address = relayBroadcastAddress;
+  } else if ((dataRcv.typeMessage == ID_REQUEST) || (dataRcv.typeMessage == DATA) || (dataRcv.typeMessage == METRICS)) {
+    frame->len = relayWrapUp(&dataRcv, dataRcvLength, myID, &frame->msg);
+  }
+  if (frame->len > 0)
+    sendMessage(address, &frame->msg, frame->len);
+  releaseFrame(&framePool, frame);
+}
+
+/* ---- Procedure for relaying a BEACON (slave) ---- */
+/*
+   INPUT : the MAC address of the sender (table of uint8_t).
+   OUTPUT : true if it is the first copy of the BEACON (bool).
+   DESCRITPION : In relay mode, every copy of a BEACON updates the routing table of the slave, the first one is sent again with the number
+   of hops of the board, unless the board is too far from the master.
+*/
+bool relayBeacon(const uint8_t *mac) {
+  bool first = relayHeardBeacon(mac, &dataRcv, dataRcvLength);
+  followNextHop();
+  if (!first || (relayHops <= 0) || (relayHops >= RELAY_HOPS_MAX))
+    return first;
+  structFrame *beacon = allocFrame(&framePool);
+  if (beacon == NULL) {
+    TRACE(TRACE_POOL_EMPTY, BEACON, 0, 0);
+    return first;
+  }
+  memcpy(&beacon->msg, &dataRcv, dataRcvLength);
+  beacon->msg.senderID = myID;
+  ((uint8_t *)&beacon->msg)[dataRcvLength - 1] = relayHops;
+  sendMessage(relayBroadcastAddress, &beacon->msg, dataRcvLength);
+  releaseFrame(&framePool, beacon);
+  relayStats.beacons++;
+  return first;
+}
+
+/* ---- Procedure for reading the ID of the board in a ID_REPLY (slave) ---- */
+/*
+   INPUT : nothing (void).
+   OUTPUT : true if dataRcv gives an ID to the board (bool).
+   DESCRITPION : The ID and the time slot of the board follow its MAC address, in a ID_REPLY or in one entry of a ID_REPLY_BATCH.
+*/
+bool readIdReply() {
+  /*if the type message received is a ID_REPLY and the message contains the MAC address of the board...*/
+  if ((dataRcv.typeMessage == ID_REPLY) && (dataRcvLength >= (int)MESSAGE_HEADER_LENGTH + 10) && (!memcmp(dataRcv.payload, myRawMacAddress, MAC_ADDRESS_LENGTH))) {
+    /*...then it reads the new ID of the board and its time slot after the MAC address.*/
+    myID = getID(&dataRcv, MESSAGE_HEADER_LENGTH + MAC_ADDRESS_LENGTH);
+    tdmaSlot = getID(&dataRcv, MESSAGE_HEADER_LENGTH + MAC_ADDRESS_LENGTH + 2);
+    return true;
+  }
+  /*if the type message received is a ID_REPLY_BATCH, it looks for the MAC address of the board in the batch.*/
+  if ((dataRcv.typeMessage == ID_REPLY_BATCH) && (dataRcvLength > (int)MESSAGE_HEADER_LENGTH)) {
+    for (int i = 0; (i < dataRcv.payload[0]) && ((int)MESSAGE_HEADER_LENGTH + 1 + (i + 1) * ID_BATCH_ENTRY_LENGTH <= dataRcvLength); i++) {
+      if (!memcmp(&dataRcv.payload[1 + i * ID_BATCH_ENTRY_LENGTH], myRawMacAddress, MAC_ADDRESS_LENGTH)) {
+        myID = getID(&dataRcv, MESSAGE_HEADER_LENGTH + 1 + i * ID_BATCH_ENTRY_LENGTH + MAC_ADDRESS_LENGTH);
+        tdmaSlot = getID(&dataRcv, MESSAGE_HEADER_LENGTH + 1 + i * ID_BATCH_ENTRY_LENGTH + MAC_ADDRESS_LENGTH + 2);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/* ---- Procedure for sending a message with the MAC address of the board ---- */
+/*
+   INPUT : the opcode of the message (uint8_t), the ID of the receiver (int) and its address (table of uint8_t).
+   OUTPUT : nothing (void).
+   DESCRITPION : It sends the HEARTBEAT and the ELECTION to the broadcast address, and the claims (ID_REQUEST) to the new master (see failover.h).
+   The HEARTBEAT also carries the number of IDs given by the master.
+*/
+void sendMacAddress(uint8_t typeMessage, int receiverID, const uint8_t address[]) {
+  structFrame *frame = allocFrame(&framePool);
+  if (frame == NULL) {
+    TRACE(TRACE_POOL_EMPTY, typeMessage, 0, 0);
+    return;
+  }
+  frame->len = prepareMessage(&frame->msg, typeMessage, myID, receiverID);
+  frame->len = putMacAddress(&frame->msg, frame->len, myRawMacAddress);
+  if (typeMessage == HEARTBEAT)
+    frame->len = putID(&frame->msg, frame->len, nbBuoys(&buoyList));
+  sendMessage(address, &frame->msg, frame->len);
+  releaseFrame(&framePool, frame);
+}
+
+/* ---- Procedure for following a new master (slave) ---- */
+/*
+   INPUT : the MAC address of the new master (table of uint8_t).
+   OUTPUT : nothing (void).
+   DESCRITPION : After a failover, the new master becomes the ESP-NOW peer of the board in place of the old one, and the DATA messages
+   in flight to the old one are given up (see reliable.h).
+*/
+void followMaster(const uint8_t masterAddress[]) {
+  memcpy(peerInfo.peer_addr, masterAddress, MAC_ADDRESS_LENGTH);
+  if ((esp_now_add_peer(&peerInfo) != ESP_OK) && !esp_now_is_peer_exist(masterAddress))
+    return;
+  if (memcmp(receiverAddress, relayBroadcastAddress, MAC_ADDRESS_LENGTH))
+    esp_now_del_peer(receiverAddress);
+  memcpy(receiverAddress, masterAddress, MAC_ADDRESS_LENGTH);
+  master = true;
+  reliableForget(0);
+  TRACE_MAC(TRACE_NEW_MASTER, myID, masterAddress);
+}
+
+/* ---- Procedure for becoming the master after a failover ---- */
+/*
+   INPUT : nothing (void).
+   OUTPUT : nothing (void).
+   DESCRITPION : The board has won the election (see failover.h). It creates a new registry with itself as the buoy 0, the slaves will claim
+   their IDs, which are kept as holes until then. Its messages are now sent to the broadcast address, and the DATA messages it had sent
+   to the old master are given up.
+*/
+void takeOver() {
+  uint64_t myKey = macAddressToKey(myRawMacAddress);
+  failoverTakeOver(myID, myKey);
+  if (memcmp(receiverAddress, relayBroadcastAddress, MAC_ADDRESS_LENGTH))
+    esp_now_del_peer(receiverAddress);
+  memset(receiverAddress, 0xFF, MAC_ADDRESS_LENGTH);
+  ESPstatus = 1;
+  myID = 0;
+  /*the registry saved in the flash belongs to another network, it is not read but replaced.*/
+  mountRegistryLog();
+  initRegistry(&buoyList);
+  addNewBuoy(&buoyList, myKey);
+  /*the IDs given by the old master are kept for the claims of the slaves, a new buoy gets the next one.*/
+  while (nbBuoys(&buoyList) < failoverFleetCount)
+    addNewBuoy(&buoyList, REGISTRY_NO_BUOY);
+  compactRegistryLog(&buoyList);
+  initTdma();
+  relayStartMaster(&buoyList);
+  reliableForget(0);
+}
+
+/* ---- Procedure for handling a HEARTBEAT or an ELECTION ---- */
+/*
+   INPUT : nothing (void).
+   OUTPUT : nothing (void).
+   DESCRITPION : The message is in dataRcv, its payload is the MAC address of the master or of the candidate, then the number of IDs given
+   by the master for a HEARTBEAT. A master which gives way to another one becomes its slave with the ID it had before the takeover (see failover.h).
+*/
+void handleFailover() {
+  if ((FAILOVER_HEARTBEAT_MS == 0) || (dataRcvLength < (int)MESSAGE_HEADER_LENGTH + MAC_ADDRESS_LENGTH))
+    return;
+  uint64_t key = macAddressToKey(dataRcv.payload);
+  uint64_t myKey = macAddressToKey(myRawMacAddress);
+  if (dataRcv.typeMessage == ELECTION) {
+    failoverCandidate(key, myKey);
+    return;
+  }
+  int fleetCount = (dataRcvLength >= (int)MESSAGE_HEADER_LENGTH + MAC_ADDRESS_LENGTH + 2) ? getID(&dataRcv, MESSAGE_HEADER_LENGTH + MAC_ADDRESS_LENGTH) : 0;
+  if (failoverHeartbeat(key, myKey, (ESPstatus == 1) ? failoverFormerID : myID, fleetCount) != FAILOVER_FOLLOW_NEW)
+    return;
+  if (ESPstatus == 1) {
+    ESPstatus = -1;
+    myID = failoverFormerID;
+    relayRegistry = NULL;
+    clearPeerCache();
+    initTdma();
+  }
+  followMaster(dataRcv.payload);
+}
+
+/* ---- Procedure for servicing the failover ---- */
+/*
+   INPUT : nothing (void).
+   OUTPUT : true if the master or the ID of the board has changed (bool), the boot cache must then be written again.
+   DESCRITPION : It must be called regularly once the board has its role : the master sends its HEARTBEAT, a slave checks that its master
+   is alive, takes part in an election or claims its ID from a new master (see failover.h).
+*/
+bool serviceFailover() {
+#if FAILOVER_HEARTBEAT_MS == 0
+  return false;
+#else
+  switch (failoverStep(macAddressToKey(myRawMacAddress))) {
+    case FAILOVER_SEND_HEARTBEAT:
+      sendMacAddress(HEARTBEAT, -1, relayBroadcastAddress);
+      break;
+    case FAILOVER_SEND_ELECTION:
+      sendMacAddress(ELECTION, -1, relayBroadcastAddress);
+      break;
+    case FAILOVER_TAKE_OVER:
+      takeOver();
+      break;
+    case FAILOVER_SEND_CLAIM:
+      /*the ID claimed is the senderID of the ID_REQUEST.*/
+      sendMacAddress(ID_REQUEST, 0, receiverAddress);
+      break;
+  }
+  reliableHeld = failoverHolding();
+  /*the master saves the IDs claimed once the claims stop (see registryLog.h).*/
+  if (ESPstatus == 1)
+    serviceRegistryLog(&buoyList);
+  return failoverChange();
+#endif
+}
+
+/* ---- Procedure for taking a snapshot of the metrics of the board ---- */
+/*
+   INPUT : the snapshot (structMetricsSnapshot).
+   OUTPUT : nothing (void).
+   DESCRITPION : The counters copied from the other modules are updated, then the registry is copied in the snapshot (see metrics.h).
+*/
+void snapshotMetrics(structMetricsSnapshot *snapshot) {
+  metrics.counters[METRIC_RX_DROPS] = rxQueue.drops;
+  metrics.counters[METRIC_RX_HIGH_WATER] = rxQueue.highWater;
+  metrics.counters[METRIC_REGISTRY_SIZE] = (ESPstatus == 1) ? nbBuoys(&buoyList) : 0;
+  metrics.counters[METRIC_DATA_RETRIES] = reliableStats.retransmissions;
+  metrics.counters[METRIC_DATA_FAILED] = reliableStats.failed;
+  metrics.counters[METRIC_POOL_FAILURES] = framePool.failures;
+  metricsTakeSnapshot(snapshot, ESPstatus, myID);
+}
+
+/* ---- Procedure for sending a METRICS message ---- */
+/*
+   INPUT : the address of the receiver (table of uint8_t), its ID (int), true to send the snapshot of the board, false to ask for the
+   snapshot of the receiver (bool).
+   OUTPUT : nothing (void).
+*/
+void sendMetrics(const uint8_t *address, int receiverID, bool snapshot) {
+  structFrame *frame = allocFrame(&framePool);
+  if (frame == NULL) {
+    TRACE(TRACE_POOL_EMPTY, METRICS, 0, 0);
+    return;
+  }
+  frame->len = prepareMessage(&frame->msg, METRICS, myID, receiverID);
+  if (snapshot) {
+    structMetricsSnapshot metricsSnapshot;
+    snapshotMetrics(&metricsSnapshot);
+    memcpy(frame->msg.payload, &metricsSnapshot, sizeof(metricsSnapshot));
+    frame->len += sizeof(metricsSnapshot);
+  }
+  sendMessage(address, &frame->msg, frame->len);
+  releaseFrame(&framePool, frame);
+}
+
+/* ---- Procedure for handling a METRICS message ---- */
+/*
+   INPUT : the MAC address of the sender (table of uint8_t).
+   OUTPUT : nothing (void).
+   DESCRITPION : The message is in dataRcv. Without payload, the sender asks for the metrics of the board : a slave answers the master
+   through receiverAddress (its next hop in relay mode), the other buoys on its MAC address if it is a peer. With a snapshot, it is the
+   answer to a query of the host, the snapshot is written on the serial monitor.
+*/
+void handleMetrics(const uint8_t *mac) {
+  if (dataRcvLength == (int)MESSAGE_HEADER_LENGTH) {
+    sendMetrics(((ESPstatus == -1) && (dataRcv.senderID == 0)) ? receiverAddress : peerCacheAddress(mac), dataRcv.senderID, true);
+    return;
+  }
+  if (dataRcvLength == (int)(MESSAGE_HEADER_LENGTH + sizeof(structMetricsSnapshot))) {
+    metricsWrite((const structMetricsSnapshot *)dataRcv.payload);
+    metricsAnswered(dataRcv.senderID);
+  }
+}
+
+/* ---- Procedure for servicing the queries of the host ---- */
+/*
+   INPUT : nothing (void).
+   OUTPUT : nothing (void).
+   DESCRITPION : It must be called regularly once the board has its role. The snapshot of the board is written at once, another buoy
+   is asked with a METRICS message : the master reaches it on its MAC address if it is in the peer cache (see peerCache.h), a slave
+   asks the master directly and the other buoys on the broadcast address, their ID in the header selects them.
+*/
+void serviceMetrics() {
+  int buoyID = metricsReadQuery();
+  if (buoyID == METRICS_NO_QUERY)
+    return;
+  if ((buoyID == -1) || (buoyID == myID)) {
+    structMetricsSnapshot snapshot;
+    snapshotMetrics(&snapshot);
+    metricsWrite(&snapshot);
+    return;
+  }
+  const uint8_t *address = relayBroadcastAddress;
+  uint8_t mac[MAC_ADDRESS_LENGTH];
+  if ((ESPstatus == 1) && (buoyID > 0) && (buoyID < nbBuoys(&buoyList))) {
+    keyToMacAddress(mac, buoyList.macAddresses[buoyID]);
+    address = peerCacheAddress(mac);
+  } else if ((ESPstatus == -1) && (buoyID == 0)) {
+    address = receiverAddress;
+  }
+  sendMetrics(address, buoyID, false);
+  metricsAsked(buoyID);
+}
+
+/* ---- Procedure for handling a received message ---- */
+/*
+   INPUT : the MAC address of the sender (table of uint8_t), the message received (table of uint8_t), its length (int) and the time
+   of its reception by the WiFi callback (uint32_t, micros()).
+   OUTPUT : nothing (void).
+   DESCRITPION : define the behaviour when the card receives a message. It is called by the dispatcher (main task), not by the WiFi callback.
+   NB: The function isMessageValid() checks the length and the protocol version of the message.
+   The function memcmp() returns 0 if two memory blocs are equal.
    The function memcpy() copies a memory bloc.
 */
-void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
+void handleMessage(const uint8_t * mac, const uint8_t *incomingData, int len, uint32_t receivedAt) {
+  /*if the data received is not a message of this protocol version, it is ignored.*/
+  if (!isMessageValid(incomingData, len))
+    return;
   /*the program copies the message in a variable to manipulate it.*/
-  memcpy(&dataRcv, incomingData, sizeof(dataRcv));
+  memcpy(&dataRcv, incomingData, len);
+  dataRcvLength = len;
+  dataRcvAt = receivedAt;
+  /*every message of the master shows that it is alive (see failover.h), the master keeps the buoys with an ID heard recently as peers (see peerCache.h).*/
+  failoverHeard(mac);
+  if ((ESPstatus == 1) && (dataRcv.senderID > 0)) {
+    peerCacheHeard(mac);
+    /*the slave keeps its time slot (see tdma.h).*/
+    tdmaHeard(dataRcv.senderID);
+  }
+  if ((dataRcv.senderID == 0) && (memcmp(mac, receiverAddress, MAC_ADDRESS_LENGTH) == 0))
+    masterHeardAt = millis();
+  /*if the message is a BEACON, a slave aligns its time slot on it (see tdma.h), in relay mode only on its first copy.*/
+  if (dataRcv.typeMessage == BEACON) {
+    if ((ESPstatus == -1) && (myID != -1) && (!RELAY_MODE || relayBeacon(mac)))
+      tdmaReceiveBeacon(&dataRcv, dataRcvLength, myID, dataRcvAt);
+    return;
+  }
+  /*if the message is a HEARTBEAT or an ELECTION, it is handled by the failover (see failover.h).*/
+  if ((dataRcv.typeMessage == HEARTBEAT) || (dataRcv.typeMessage == ELECTION)) {
+    handleFailover();
+    return;
+  }
+  /*in relay mode (see relay.h), a RELAY message is unwrapped by the master or passed to the next hop by a slave.*/
+  if (RELAY_MODE && (dataRcv.typeMessage == RELAY)) {
+    if (ESPstatus == -1) {
+      if (myID > 0)
+        relaySlaveMessage();
+      return;
+    }
+    if (ESPstatus != 1)
+      return;
+    structFrame *frame = allocFrame(&framePool);
+    if (frame == NULL) {
+      TRACE(TRACE_POOL_EMPTY, RELAY, 0, 0);
+      return;
+    }
+    /*the message relayed is handled as if its origin had sent it, then the master forgets the origin.*/
+    frame->len = relayUnwrap(&dataRcv, dataRcvLength, &frame->msg);
+    if (frame->len > 0)
+      handleMessage(mac, (const uint8_t *)&frame->msg, frame->len, dataRcvAt);
+    releaseFrame(&framePool, frame);
+    relayOrigin = 0;
+    relayPathHops = 1;
+    return;
+  }
+  /*in relay mode, a board which hears another one looking for a master waits longer before becoming the master (see attemptMax).*/
+  if (RELAY_MODE && (ESPstatus == 0) && (dataRcv.typeMessage == MASTER_DETECTION)) {
+    relayDetectionHeard = true;
+    return;
+  }
+  /*in relay mode, a slave relays the messages of the buoys which do not hear the master.*/
+  if (RELAY_MODE && (ESPstatus == -1) && (myID > 0) && (dataRcv.receiverID == 0)) {
+    relaySlaveMessage();
+    return;
+  }
+  /*a slave which claims its ID from a new master reads the ID_REPLY addressed to the boards without ID, it may get another ID.*/
+  if ((failoverState == FAILOVER_CLAIM) && (ESPstatus == -1) && (dataRcv.receiverID == -1) && (dataRcv.senderID == 0)) {
+    if (readIdReply()) {
+      TRACE(TRACE_ID_ASSIGNED, myID, 0, 0);
+      failoverAttached();
+    }
+    return;
+  }
+  /*if the message is a METRICS addressed to the board, it asks for its metrics or answers a query of the host (see metrics.h).*/
+  if ((dataRcv.typeMessage == METRICS) && (myID != -1) && (dataRcv.receiverID == myID)) {
+    handleMetrics(mac);
+    return;
+  }
+  /*if the message is a DATA or a DATA_ACK addressed to the board, it is given to the reliable delivery (see reliable.h).*/
+  if ((myID != -1) && (dataRcv.receiverID == myID)) {
+    if (dataRcv.typeMessage == DATA) {
+      /*a duplicate is acknowledged again but not handled, the master stores the samples of a new one and records the path of its messages.*/
+      if (ESPstatus == 1)
+        setBuoyPath(&buoyList, dataRcv.senderID, relayOrigin, relayPathHops);
+      if (reliableReceive(mac, &dataRcv, dataRcvLength) && (ESPstatus == 1))
+        storeTelemetry(&dataRcv, dataRcvLength);
+      return;
+    }
+    if (dataRcv.typeMessage == DATA_ACK) {
+      reliableAck(&dataRcv, dataRcvLength);
+      return;
+    }
+  }
   /*if the receiver ID in the message is the same than the ID of the board...*/
   if (dataRcv.receiverID == myID) {
     /*...then it reads the message in function of the ESP status of the board.*/
     switch (ESPstatus) {
       /* case 1 : The buoy is a slave.*/
       case -1:
-        /*if the type message received is a ID_REPLY and the message contains the MAC address of the board...*/
-        if ((!strcmp(dataRcv.typeMessage, "ID_REPLY")) && (String(dataRcv.message).indexOf(myMacAddress) != -1)) {
-          /*...then it removes the MAC address int the message to keep the new ID of the board.*/
-          myID = String(dataRcv.message).substring(20, CHAR_LENGTH).toInt();
-          /*and the program prints it in the monitor.*/
-          Serial.println("my new ID is : " + String(myID));
-          Serial.println();
+        /*if the type message received is a ID_REPLY or a ID_REPLY_BATCH which contains the MAC address of the board...*/
+        if (readIdReply()) {
+          /*...then the program writes the new ID of the board in the trace.*/
+          TRACE(TRACE_ID_ASSIGNED, myID, 0, 0);
+        /*elsif the relay mode is on and the type message received is a MASTER_REPLY, it gives a neighbour and its number of hops (see relay.h).*/
+        } else if (RELAY_MODE && (dataRcv.typeMessage == MASTER_REPLY) && (dataRcvLength > (int)MESSAGE_HEADER_LENGTH + MAC_ADDRESS_LENGTH)) {
+          relayHeard(dataRcv.payload, dataRcv.payload[MAC_ADDRESS_LENGTH]);
+          followNextHop();
         }
         break;
       /* case 2 : The buoy doesn't has a role yet.*/
       case 0:
-        /*if the type message received is a MASTER_REPLY...*/
-        if (!strcmp(dataRcv.typeMessage, "MASTER_REPLY")) {
+        /*in relay mode, the MASTER_REPLY of the master and of the slaves are all kept, the board joins through the one with the fewest hops.*/
+        if (RELAY_MODE && (dataRcv.typeMessage == MASTER_REPLY) && (dataRcvLength > (int)MESSAGE_HEADER_LENGTH + MAC_ADDRESS_LENGTH)) {
+          relayHeard(dataRcv.payload, dataRcv.payload[MAC_ADDRESS_LENGTH]);
+          if (master) {
+            followNextHop();
+            break;
+          }
+          memcpy(dataRcv.payload, relayParentAddress, MAC_ADDRESS_LENGTH);
+        }
+        /*if the type message received is a MASTER_REPLY, or a ID_REPLY_BATCH which only the master sends...*/
+        if (((dataRcv.typeMessage == MASTER_REPLY) && (dataRcvLength >= (int)MESSAGE_HEADER_LENGTH + MAC_ADDRESS_LENGTH))
+            || (dataRcv.typeMessage == ID_REPLY_BATCH)) {
           /*...then the boolean master becomes true.*/
           master = true;
           /*the board modifies the address of ESP communication to the master MAC address*/
-          modifMacAddress(receiverAddress, dataRcv.message);
+          memcpy(receiverAddress, (dataRcv.typeMessage == MASTER_REPLY) ? dataRcv.payload : mac, MAC_ADDRESS_LENGTH);
           /*if the new peer is not correctly added...*/
           memcpy(peerInfo.peer_addr, receiverAddress, 6);
           if (esp_now_add_peer(&peerInfo) != ESP_OK) {
@@ -355,63 +778,100 @@ void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
         break;
       /* case 3 : The buoy is the master.*/
       case 1:
-        /*IDslave is used to found a specific ID in the buoy list.*/
+        /*IDslave is used to found a specific ID in the buoy registry.*/
         int IDslave;
-        /*reply is used for the ID_REPLY message.*/
-        String reply = "";
         /*if the type message received is a MASTER_DETECTION...*/
-        if (!strcmp(dataRcv.typeMessage, "MASTER_DETECTION")) {
+        if (dataRcv.typeMessage == MASTER_DETECTION) {
           /*...then the program sends a MASTER_REPLY message.*/
           /*
             senderID = 0
             receiverID = -1
             typeMessage = MASTER_REPLY
-            message = the MAC address of the board
+            payload = the MAC address of the board + its number of hops to the master (0)
           */
-          myData.senderID = myID;
-          myData.receiverID = -1;
-          strcpy(myData.typeMessage, "MASTER_REPLY");
-          myMacAddress.toCharArray(myData.message, CHAR_LENGTH);
-          /*the message is sent to the broadcast address.*/
-          esp_err_t result = esp_now_send(receiverAddress, (uint8_t *) &myData, sizeof(myData));
+          structFrame *reply = allocFrame(&framePool);
+          if (reply == NULL) {
+            TRACE(TRACE_POOL_EMPTY, MASTER_REPLY, 0, 0);
+            break;
+          }
+          reply->len = prepareMessage(&reply->msg, MASTER_REPLY, myID, -1);
+          reply->len = putMacAddress(&reply->msg, reply->len, myRawMacAddress);
+          ((uint8_t *)&reply->msg)[reply->len++] = 0;
+          /*the message is sent to the broadcast address, ESP-NOW copies it so the frame is released at once.*/
+          sendMessage(receiverAddress, &reply->msg, reply->len);
+          releaseFrame(&framePool, reply);
           /*elsif the type message received is a ID_REQUEST...*/
-        } else if (!strcmp(dataRcv.typeMessage, "ID_REQUEST")) {
-          /*...then the program sends a ID_REPLY message.*/
+        } else if ((dataRcv.typeMessage == ID_REQUEST) && (dataRcvLength >= (int)MESSAGE_HEADER_LENGTH + MAC_ADDRESS_LENGTH)) {
+          /*...then the program sends a ID_REPLY message, or adds the slave to the next ID_REPLY_BATCH message.*/
           /*
             senderID = 0
             receiverID = -1
             typeMessage = ID_REPLY
-            message = the MAC address of the slave + its ID
+            payload = the MAC address of the slave + its ID + its time slot
           */
-          myData.senderID = myID;
-          myData.receiverID = -1;
-          strcpy(myData.typeMessage, "ID_REPLY");
-          /*the programs verifies is the slave is in the buoy list thanks to its MAC address.*/
-          IDslave = isBuoyExists(buoyList, dataRcv.message);
+          /*the programs verifies is the slave is in the buoy registry thanks to its MAC address.*/
+          IDslave = isBuoyExists(&buoyList, macAddressToKey(dataRcv.payload));
           /*if IDslave is different from -1, the slave is known...*/
           if (IDslave != -1) {
-            /*...then IDslave is adding to the message.*/
-            reply = String(dataRcv.message) + " : " + String(IDslave);
-            /*the String is converted to a char array.*/
-            reply.toCharArray(myData.message, CHAR_LENGTH);
-            /*and the program prints the slave ID in the monitor.*/
-            Serial.println("buoy known, buoyID = " + String(IDslave));
-            Serial.println();
-
+            /*...then the program writes the slave ID in the trace.*/
+            TRACE_MAC(TRACE_BUOY_KNOWN, IDslave, dataRcv.payload);
           } else {
             /*...else IDslave is -1, the slave is unknown...*/
-            /*the slave is added to buoy list.*/
-            buoyList = addNewBuoy(buoyList, dataRcv.message);
-            /*the slave ID is calculated from the number of buoys in the list and added to the message.*/
-            reply = String(dataRcv.message) + " : " + String(nbBuoys(buoyList) - 1);
-            /*the String is converted to a char array.*/
-            reply.toCharArray(myData.message, CHAR_LENGTH);
-            /*and the program prints the new buoy list in the monitor.*/
-            Serial.println(F("new buoy created, structBuoyList :"));
-            printBuoyList(buoyList);
+            int count = nbBuoys(&buoyList);
+            /*a slave which already has an ID claims it after a failover (see failover.h), it keeps it unless another buoy has it.*/
+            if (dataRcv.senderID > 0)
+              IDslave = claimBuoy(&buoyList, macAddressToKey(dataRcv.payload), dataRcv.senderID);
+            /*else the slave is added to buoy registry, its ID is the number of buoys already registered.*/
+            if (IDslave == -1)
+              IDslave = addNewBuoy(&buoyList, macAddressToKey(dataRcv.payload));
+            /*if the registry is full...*/
+            if (IDslave == -1) {
+              /*...then the slave can't get an ID and no reply is sent.*/
+              TRACE_MAC(TRACE_REGISTRY_FULL, 0, dataRcv.payload);
+              break;
+            }
+            /*the new buoy is saved in the flash before its ID is sent, and written in the trace.*/
+            if (IDslave == dataRcv.senderID) {
+              claimRegistryLog(&buoyList, count, IDslave);
+              TRACE_MAC(TRACE_BUOY_CLAIMED, IDslave, dataRcv.payload);
+            } else {
+              appendRegistryLog(&buoyList, IDslave);
+              TRACE_MAC(TRACE_BUOY_NEW, IDslave, dataRcv.payload);
+            }
+            if (ID_BATCH_WINDOW_MS > 0)
+              idBatchNewBuoys++;
           }
-          /*the message is sent to the broadcast MAC address.*/
-          esp_err_t result = esp_now_send(receiverAddress, (uint8_t *) &myData, sizeof(myData));
+          /*the ID is only sent once it is saved in the flash (see registryLog.h), else the slave asks it again later.*/
+          if (!registryLogSaved(&buoyList, IDslave)) {
+            TRACE_MAC(TRACE_BUOY_UNSAVED, IDslave, dataRcv.payload);
+            break;
+          }
+          /*the slave gets a time slot with its ID (see tdma.h), it keeps the slot it already has.*/
+          int slot = tdmaAssignSlot(IDslave);
+          /*the path of the request is the path to the slave, a slave which joins through a relay gets its own ID_REPLY (see relay.h).*/
+          setBuoyPath(&buoyList, IDslave, relayOrigin, relayPathHops);
+          /*the slave which has its ID takes a place in the peer cache, its ID_REPLY is sent to it if it is alone in the batch.*/
+          if (relayOrigin == 0)
+            peerCacheHeard(mac);
+          /*if the replies are batched...*/
+          if ((ID_BATCH_WINDOW_MS > 0) && (relayOrigin == 0)) {
+            /*...then the slave is added to the batch, which is sent when it is full or at the end of the window.*/
+            addToIdBatch(dataRcv.payload, IDslave, slot);
+            break;
+          }
+          /*the MAC address of the slave, its ID and its time slot are added to the message.*/
+          structFrame *reply = allocFrame(&framePool);
+          if (reply == NULL) {
+            TRACE(TRACE_POOL_EMPTY, ID_REPLY, 0, 0);
+            break;
+          }
+          reply->len = prepareMessage(&reply->msg, ID_REPLY, myID, -1);
+          reply->len = putMacAddress(&reply->msg, reply->len, dataRcv.payload);
+          reply->len = putID(&reply->msg, reply->len, IDslave);
+          reply->len = putID(&reply->msg, reply->len, slot);
+          /*the message is sent to the slave if it is in the peer cache, else to the broadcast MAC address.*/
+          sendMessage(peerCacheAddress(dataRcv.payload), &reply->msg, reply->len);
+          releaseFrame(&framePool, reply);
           break;
         }
     }
@@ -419,6 +879,158 @@ void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
   /*...else it does nothing.*/
 }
 
+/* ---- Define callbacks for received data ---- */
+/*
+   DESCRITPION : define the behaviour when the card receives a message.
+   The callback runs in the WiFi task, so it only pushes the frame in the receive queue and notifies the main task (mainTask),
+   which may be waiting in delayAndDispatch(). The frame is handled later by dispatchMessages().
+*/
+void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
+  if (!rxQueuePush(&rxQueue, mac, incomingData, len, micros())) {
+    TRACE_MAC(TRACE_RX_DROP, len, mac);
+    return;
+  }
+  TRACE_MAC(TRACE_RECV, len, mac);
+  if (mainTask != NULL)
+    xTaskNotifyGive(mainTask);
+}
+
+/* ---- Procedure for dispatching the received messages ---- */
+/*
+   INPUT : nothing (void).
+   OUTPUT : the number of messages handled (int).
+   DESCRITPION : The program handles the frames waiting in the receive queue, at most RX_BATCH_MAX at a time. It must be called regularly by the main task.
+   Every frame is counted in the metrics with its opcode (see metrics.h).
+   Then the reliable delivery is serviced : the DATA_ACK of the DATA messages just handled are sent together, and the DATA messages are sent again if needed.
+*/
+int dispatchMessages() {
+  int handled = 0;
+  const structRxFrame *frame;
+  /*as long as a frame is waiting and the batch is not complete...*/
+  while ((handled < RX_BATCH_MAX) && ((frame = rxQueuePeek(&rxQueue)) != NULL)) {
+    /*...then it is counted, handled and its place is released.*/
+    if (isMessageValid(frame->data, frame->len))
+      metricsReceived(frame->data[1]);
+    else
+      metricsCount(METRIC_RX_INVALID);
+    handleMessage(frame->macAddress, frame->data, frame->len, frame->receivedAt);
+    rxQueueRelease(&rxQueue);
+    handled++;
+  }
+  reliableService(myID);
+  return handled;
+}
+
+/* ---- Procedure for waiting while dispatching the received messages ---- */
+/*
+   INPUT : the time to wait in milliseconds (unsigned long).
+   OUTPUT : nothing (void).
+   DESCRITPION : It replaces delay() in the main task : the received messages are handled during the wait, as soon as they arrive.
+   NB : ulTaskNotifyTake() sleeps until OnDataRecv notifies the main task or until the end of the wait.
+*/
+void delayAndDispatch(unsigned long ms) {
+  unsigned long start = millis();
+  unsigned long elapsed;
+  while ((elapsed = millis() - start) < ms) {
+    /*if no message was waiting, the task sleeps until the next one.*/
+    if (dispatchMessages() == 0)
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms - elapsed));
+  }
+}
+
+/* ---- Procedure for waiting for a reply ---- */
+/*
+   INPUT : the maximum time to wait in milliseconds (unsigned long), a function which returns true once the reply has been handled.
+   OUTPUT : REPLY_RECEIVED, SEND_FAILED if the request could not be delivered, or REPLY_TIMEOUT (int).
+   DESCRITPION : As delayAndDispatch(), but the wait stops as soon as the reply arrives or OnDataSent reports a failure.
+   NB : sendFailed must be set to false before sending the request.
+*/
+#define REPLY_RECEIVED 0
+#define SEND_FAILED 1
+#define REPLY_TIMEOUT 2
+
+int waitReply(unsigned long ms, bool (*replied)()) {
+  unsigned long start = millis();
+  unsigned long elapsed;
+  for (;;) {
+    while (dispatchMessages() > 0);
+    if (replied())
+      return REPLY_RECEIVED;
+    if (sendFailed)
+      return SEND_FAILED;
+    if ((elapsed = millis() - start) >= ms)
+      return REPLY_TIMEOUT;
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms - elapsed));
+  }
+}
+
+/* ---- Procedure for waiting a random backoff ---- */
+/*
+   INPUT : the backoff (structBackoff), a function which returns true once the reply has been handled.
+   OUTPUT : nothing (void).
+   DESCRITPION : The program waits a random number of slots drawn in the window of the backoff, and handles the messages received meanwhile.
+   The wait stops as soon as the reply expected by the previous request arrives.
+   With BACKOFF_CONTENTION_WINDOW, as the CSMA/CA of the WiFi, the countdown is frozen during a slot in which a message has been heard :
+   a busy channel delays the sending instead of being wasted by a collision.
+*/
+void backoffWait(structBackoff *backoff, bool (*replied)()) {
+  long slots = backoffDelay(backoff) / BACKOFF_SLOT_MS;
+  while ((slots > 0) && !replied()) {
+    uint32_t heard = __atomic_load_n(&rxQueue.head, __ATOMIC_ACQUIRE);
+    delayAndDispatch(BACKOFF_SLOT_MS);
+    if ((BACKOFF_STRATEGY != BACKOFF_CONTENTION_WINDOW) || (__atomic_load_n(&rxQueue.head, __ATOMIC_ACQUIRE) == heard))
+      slots--;
+  }
+}
+
+/* ---- Procedures for the replies awaited by setup() ---- */
+bool isMasterFound() {
+  return master;
+}
+
+bool isIDAssigned() {
+  return myID != -1;
+}
+
+/* ---- Procedure for printing the receive queue counters ---- */
+/*
+   DESCRITPION : prints the maximum number of frames which waited in the receive queue and the number of frames dropped, to size RX_QUEUE_LENGTH.
+*/
+void printRxQueueStats() {
+  Serial.print(F("rx queue high-water : "));
+  Serial.print(rxQueue.highWater);
+  Serial.print(F(" / "));
+  Serial.println(RX_QUEUE_LENGTH);
+  Serial.print(F("rx queue drops : "));
+  Serial.println(rxQueue.drops);
+}
+
+/* ---- Procedure for printing the memory report ---- */
+/*
+   DESCRITPION : prints the size of the heap, its free memory now and at its lowest since the boot (the high-water mark of the heap),
+   and the counters of the frame pool, to check that the program does not allocate memory once it runs and to size FRAME_POOL_LENGTH.
+*/
+void printMemoryReport() {
+  Serial.println(F("---------- memory report ----------"));
+  Serial.print(F("heap size : "));
+  Serial.println(ESP.getHeapSize());
+  Serial.print(F("heap free : "));
+  Serial.println(ESP.getFreeHeap());
+  Serial.print(F("heap high-water : "));
+  Serial.println(ESP.getHeapSize() - ESP.getMinFreeHeap());
+  Serial.print(F("frame pool in use : "));
+  Serial.print(framePool.inUse);
+  Serial.print(F(" / "));
+  Serial.println(FRAME_POOL_LENGTH);
+  Serial.print(F("frame pool high-water : "));
+  Serial.println(framePool.highWater);
+  Serial.print(F("frame pool allocations : "));
+  Serial.println(framePool.allocations);
+  Serial.print(F("frame pool failures : "));
+  Serial.println(framePool.failures);
+  Serial.println(F("-----------------------------------"));
+}
+
 /* ---- Init the ESP board ---- */
 /*
    INPUT : nothing(void).
@@ -429,6 +1041,22 @@ void initBoard() {
   /* Init serial monitor */
   Serial.begin(115200);
 
+  /* Init the raw MAC address of the board, written in the messages */
+  if (!modifMacAddress(myRawMacAddress, myMacAddress))
+    Serial.println(F("invalid MAC address"));
+
+  /* Init the handle of the main task, notified by OnDataRecv */
+  mainTask = xTaskGetCurrentTaskHandle();
+
+  /* Init the buoy registry (only used by the master) */
+  initRegistry(&buoyList);
+
+  /* Init the pool of the messages sent and the reliable delivery */
+  initFramePool(&framePool);
+  initReliable();
+  initTdma();
+  initRelay();
+
   /* Set device as a Wi-Fi Station */
   WiFi.mode(WIFI_STA);
 